@@ -0,0 +1,69 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#pragma once
+
+// Counts heap allocations per thread so the import path can check it is not allocating per vertex.
+// Only active when LEARNOPENGL_COUNT_ALLOCATIONS is defined (the Debug configurations), because it
+// replaces the global operator new. Replacement operators may not be inline, so like the rest of the
+// headers this must only be included from main.cpp's translation unit.
+#ifdef LEARNOPENGL_COUNT_ALLOCATIONS
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace AllocationCounter
+{
+	inline size_t& threadCounter()
+	{
+		thread_local size_t count = 0;
+		return count;
+	}
+
+	/*
+	* Number of allocations made by the calling thread so far.
+	* @return size_t
+	*/
+	inline size_t threadCount()
+	{
+		return threadCounter();
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	AllocationCounter::threadCounter()++;
+	if (void* block = std::malloc(size ? size : 1))
+		return block;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* block) noexcept
+{
+	std::free(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+	std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept
+{
+	std::free(block);
+}
+
+void operator delete[](void* block, std::size_t) noexcept
+{
+	std::free(block);
+}
+
+#endif
+
+#endif
@@ -1,140 +0,0 @@
-#version 330 core
-struct Material {
-	sampler2D diffuse;
-	sampler2D specular;
-	float shininess;
-};
-struct DirLight {
-	vec3 direction;
-
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-};
-struct PointLight {
-	vec3 position;
-
-	float constant;
-	float linear;
-	float quadratic;
-	
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-};
-struct SpotLight {
-	vec3 position;
-	vec3 direction;
-	float cutOff;
-	float outerCutOff;
-	
-	float constant;
-	float linear;
-	float quadratic;
-	
-	
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-};
-
-#define NR_POINT_LIGHTS 4
-
-in vec3 Normal;
-in vec3 FragPos;
-in vec2 TexCoords;
-out vec4 FragColor;
-
-uniform vec3 viewPos;
-uniform Material material;
-uniform DirLight dirLight;
-uniform SpotLight spotLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-
-float LinearizeDepth(float depth)
-{
-	float z = depth * 2.0 - 1.0;
-	return (2.0 * 0.1 * 100) / (100 + 0.1 - z * (100 - 0.1));
-}
-
-void main()
-{
-	vec3 norm = normalize(Normal);
-	vec3 viewDir = normalize(viewPos - FragPos);
-	// first calculate directional lighting
-	vec3 result = CalcDirLight(dirLight, norm, viewDir);
-	// calculate any point lights and add it
-	for (int i = 0; i < NR_POINT_LIGHTS; i++)
-	{
-		result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
-	}
-	result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
-	float depth = LinearizeDepth(gl_FragCoord.z) / 100;
-	FragColor = vec4(result, 1.0);
-}
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
-{
-	vec3 lightDir = normalize(-light.direction);
-	float diff = max(dot(normal, lightDir), 0.0);
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-	
-	return (ambient + diffuse + specular);
-}
-
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-	vec3 lightDir = normalize(light.position - fragPos);
-	
-	float diff = max(dot(normal, lightDir), 0.0);
-	
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	
-	float distance = length(light.position - fragPos);
-	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-	
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-	
-	diffuse *= attenuation;
-	specular *= attenuation;
-	
-	return (ambient + diffuse + specular);
-}
-
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-	vec3 lightDir = normalize(light.position - fragPos);
-
-	float diff = max(dot(normal, lightDir), 0.0);
-
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-
-	float distance = length(light.position - fragPos);
-	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-	
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-	
-	float theta = dot(lightDir, normalize(-light.direction));
-	float epsilon = light.cutOff - light.outerCutOff;
-	float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-		
-	diffuse *= intensity * attenuation;
-	specular *= intensity * attenuation;
-
-	return (ambient + diffuse + specular);
-}
\ No newline at end of file
@@ -0,0 +1,338 @@
+#ifndef BINDLESS_TEXTURES_H
+#define BINDLESS_TEXTURES_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "gpu_memory.hpp"
+#include "texture_cache.hpp"
+
+// Optional ARB_bindless_texture path. Every material (a diffuse and a specular texture) gets a slot in a
+// uniform buffer holding the 64-bit handles of its textures, and meshes pass the slot index to the
+// shader instead of binding samplers (see cube.frag). A handle must be resident while a draw
+// may read it; textures are made resident when a draw uses them and the least recently used ones that
+// no draw of the current frame needs are made non-resident again whenever the total goes over budget.
+//
+// Without the extension enable() returns false and meshes keep binding their textures; the shader
+// compiles either way and samples the bound textures when the slot index is negative.
+class BindlessTextures
+{
+public:
+	static const int MAX_MATERIALS = 1024;		// one uvec4 each, the 16 KB uniform block every GL 3.3 driver allows
+	static const GLuint MATERIAL_BINDING = 1;	// uniform buffer binding the Materials block reads from
+
+	struct Stats
+	{
+		size_t textures;		// textures with a handle
+		size_t resident;
+		size_t residentBytes;	// estimated from the level sizes
+		size_t budgetBytes;
+		size_t madeResident;	// since enable()
+		size_t evicted;
+		size_t materials;
+		bool overBudget;		// the current frame alone needs more than the budget
+	};
+
+	static BindlessTextures &shared()
+	{
+		static BindlessTextures instance;
+		return instance;
+	}
+
+	/*
+	* Turn the bindless path on. Needs a current GL context.
+	* @param[in] budgetBytes Memory the resident textures may take, estimated from their level sizes.
+	* @return false if ARB_bindless_texture is not available.
+	*/
+	bool enable(size_t budgetBytes = static_cast<size_t>(512) << 20)
+	{
+		budget = budgetBytes;
+		if (active)
+		{
+			return true;
+		}
+		if (glfwExtensionSupported("GL_ARB_bindless_texture"))
+		{
+			getTextureHandle = reinterpret_cast<GetTextureHandleProc>(glfwGetProcAddress("glGetTextureHandleARB"));
+			makeResident = reinterpret_cast<HandleProc>(glfwGetProcAddress("glMakeTextureHandleResidentARB"));
+			makeNonResident = reinterpret_cast<HandleProc>(glfwGetProcAddress("glMakeTextureHandleNonResidentARB"));
+		}
+		if (!getTextureHandle || !makeResident || !makeNonResident)
+		{
+			std::cout << "BINDLESS_TEXTURES::UNAVAILABLE textures stay bound per draw" << std::endl;
+			return false;
+		}
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * 4 * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		GpuMemory::shared().trackBuffer(buffer, GPU_UNIFORM_BUFFERS, MAX_MATERIALS * 4 * sizeof(uint32_t), "BindlessTextures");
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BINDING, buffer);
+		slots.resize(MAX_MATERIALS, { 0, 0 });
+		TextureCache::shared().addDeleteListener([this](unsigned int texture)
+		{
+			forget(texture);
+		});
+		active = true;
+		return true;
+	}
+
+	bool enabled() const
+	{
+		return active;
+	}
+
+	/*
+	* Tell which textures are complete. A handle freezes its texture, so textures still being filled in
+	* level by level, such as those of a TextureStreamer, must not get one yet.
+	* @param[in] ready Takes a GL name; empty treats every texture as complete.
+	* @return void
+	*/
+	void setReadyCheck(std::function<bool(unsigned int)> ready)
+	{
+		this->ready = std::move(ready);
+	}
+
+	// Point a program's Materials block at MATERIAL_BINDING; GLSL 3.30 cannot do it in the shader.
+	void attach(unsigned int program)
+	{
+		if (!programs.insert(program).second)
+		{
+			return;
+		}
+		const GLuint index = glGetUniformBlockIndex(program, "Materials");
+		if (index != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(program, index, MATERIAL_BINDING);
+		}
+	}
+
+	/*
+	* Slot of a material, shared by every mesh with the same textures.
+	* @param[in] diffuse GL name of a 2D texture.
+	* @param[in] specular GL name of a 2D texture, 0 for none.
+	* @return index into the Materials block, -1 when bindless is off, a texture is not complete yet or every slot is taken.
+	*/
+	int material(unsigned int diffuse, unsigned int specular)
+	{
+		if (!active || diffuse == 0)
+		{
+			return -1;
+		}
+		const uint64_t key = static_cast<uint64_t>(diffuse) << 32 | specular;
+		auto found = materials.find(key);
+		if (found != materials.end())
+		{
+			return found->second;
+		}
+		if (ready && (!ready(diffuse) || (specular != 0 && !ready(specular))))
+		{
+			return -1;
+		}
+		int index;
+		if (!freeSlots.empty())
+		{
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else if (nextSlot < MAX_MATERIALS)
+		{
+			index = nextSlot++;
+		}
+		else
+		{
+			return -1;
+		}
+
+		const GLuint64 diffuseHandle = record(diffuse).handle;
+		const GLuint64 specularHandle = specular != 0 ? record(specular).handle : 0;
+		// std140 uvec4: the two handles as low, high word pairs
+		const uint32_t words[4] = { static_cast<uint32_t>(diffuseHandle), static_cast<uint32_t>(diffuseHandle >> 32),
+			static_cast<uint32_t>(specularHandle), static_cast<uint32_t>(specularHandle >> 32) };
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, index * sizeof(words), sizeof(words), words);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		slots[index] = { diffuse, specular };
+		materials[key] = index;
+		return index;
+	}
+
+	/*
+	* Make the textures of a material resident for a draw, then evict while over budget.
+	* @param[in] material Slot returned by material().
+	* @return void
+	*/
+	void use(int material)
+	{
+		touch(slots[material].first);
+		if (slots[material].second != 0)
+		{
+			touch(slots[material].second);
+		}
+		while (residentBytes > budget && !lru.empty())
+		{
+			Record &oldest = records[lru.back()];
+			if (oldest.lastUsed == frame)
+			{
+				// everything left is needed by this frame
+				overBudget = true;
+				break;
+			}
+			makeNonResident(oldest.handle);
+			oldest.resident = false;
+			residentBytes -= oldest.bytes;
+			lru.pop_back();
+			evicted++;
+		}
+	}
+
+	// Start a new frame; textures used by earlier frames become candidates for eviction.
+	void endFrame()
+	{
+		frame++;
+		overBudget = false;
+	}
+
+	/*
+	* Drop a texture that is about to be deleted, and the materials using it.
+	* @param[in] texture GL name.
+	* @return void
+	*/
+	void forget(unsigned int texture)
+	{
+		auto found = records.find(texture);
+		if (found == records.end())
+		{
+			return;
+		}
+		if (found->second.resident)
+		{
+			makeNonResident(found->second.handle);
+			residentBytes -= found->second.bytes;
+			lru.erase(found->second.position);
+		}
+		records.erase(found);
+		for (int i = 0; i < nextSlot; i++)
+		{
+			if (slots[i].first == texture || (slots[i].second == texture && texture != 0))
+			{
+				materials.erase(static_cast<uint64_t>(slots[i].first) << 32 | slots[i].second);
+				slots[i] = { 0, 0 };
+				freeSlots.push_back(i);
+			}
+		}
+	}
+
+	Stats stats() const
+	{
+		return { records.size(), lru.size(), residentBytes, budget, madeResident, evicted, materials.size(), overBudget };
+	}
+
+private:
+	typedef GLuint64 (APIENTRY *GetTextureHandleProc)(GLuint texture);
+	typedef void (APIENTRY *HandleProc)(GLuint64 handle);
+
+	struct Record
+	{
+		GLuint64 handle = 0;
+		size_t bytes = 0;
+		uint64_t lastUsed = 0;
+		bool resident = false;
+		std::list<unsigned int>::iterator position;	// in lru while resident
+	};
+
+	GetTextureHandleProc getTextureHandle = nullptr;
+	HandleProc makeResident = nullptr;
+	HandleProc makeNonResident = nullptr;
+	bool active = false;
+	unsigned int buffer = 0;
+	std::function<bool(unsigned int)> ready;
+	std::unordered_set<unsigned int> programs;
+
+	std::unordered_map<unsigned int, Record> records;
+	std::list<unsigned int> lru;	// resident textures, most recently used first
+	std::unordered_map<uint64_t, int> materials;
+	std::vector<std::pair<unsigned int, unsigned int>> slots;
+	std::vector<int> freeSlots;
+	int nextSlot = 0;
+
+	size_t budget = 0;
+	size_t residentBytes = 0;
+	size_t madeResident = 0;
+	size_t evicted = 0;
+	uint64_t frame = 1;
+	bool overBudget = false;
+
+	Record &record(unsigned int texture)
+	{
+		Record &entry = records[texture];
+		if (entry.handle == 0)
+		{
+			entry.handle = getTextureHandle(texture);
+		}
+		return entry;
+	}
+
+	void touch(unsigned int texture)
+	{
+		Record &entry = records[texture];
+		entry.lastUsed = frame;
+		if (entry.resident)
+		{
+			lru.splice(lru.begin(), lru, entry.position);
+			return;
+		}
+		entry.bytes = measure(texture);
+		makeResident(entry.handle);
+		entry.resident = true;
+		residentBytes += entry.bytes;
+		lru.push_front(texture);
+		entry.position = lru.begin();
+		madeResident++;
+	}
+
+	// bytes of every level the texture has; uncompressed formats are counted at four bytes a texel,
+	// which is how drivers store RGB
+	static size_t measure(unsigned int texture)
+	{
+		GLint previous = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		size_t bytes = 0;
+		for (GLint level = 0; level < 32; level++)
+		{
+			GLint width = 0, height = 0, compressed = GL_FALSE;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+			if (width == 0)
+			{
+				break;
+			}
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+			if (compressed)
+			{
+				GLint size = 0;
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+				bytes += static_cast<size_t>(size);
+			}
+			else
+			{
+				bytes += static_cast<size_t>(width) * height * 4;
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(previous));
+		return bytes;
+	}
+};
+
+#endif
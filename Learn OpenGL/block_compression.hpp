@@ -0,0 +1,648 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <vector>
+#include "thread_pool.hpp"
+
+// S3TC and BPTC are extensions on a 3.3 context, so glad does not know their names
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+enum BlockFormat
+{
+	BLOCK_BC1,	// opaque RGB, 4 bits per texel
+	BLOCK_BC3,	// RGB plus a separate alpha block, 8 bits per texel
+	BLOCK_BC4,	// one channel, 4 bits per texel
+	BLOCK_BC5,	// two independent channels, 8 bits per texel
+	BLOCK_BC7	// RGBA at higher quality than BC1/BC3, 8 bits per texel
+};
+
+// CPU encoders for the BCn formats. Every format stores 4x4 texel blocks; the encoders fit a line through
+// the block's colors along their principal axis, refine its endpoints once by least squares and pick the
+// nearest palette entry for each texel. BC7 only uses mode 6, a single RGBA line with 16 steps, which is
+// a fraction of what a full BC7 search finds but already well above BC1/BC3.
+namespace BlockCompression
+{
+	// Vulkan format numbers, which is what KTX2 stores
+	const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+	const uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+	const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+	const uint32_t VK_FORMAT_BC3_SRGB_BLOCK = 138;
+	const uint32_t VK_FORMAT_BC4_UNORM_BLOCK = 139;
+	const uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+	const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+	const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+
+	inline size_t blockBytes(BlockFormat format)
+	{
+		return format == BLOCK_BC1 || format == BLOCK_BC4 ? 8 : 16;
+	}
+
+	inline const char *name(BlockFormat format)
+	{
+		switch (format)
+		{
+		case BLOCK_BC1: return "BC1";
+		case BLOCK_BC3: return "BC3";
+		case BLOCK_BC4: return "BC4";
+		case BLOCK_BC5: return "BC5";
+		default: return "BC7";
+		}
+	}
+
+	/*
+	* Vulkan format of a block format. BC4 and BC5 have no sRGB variant and ignore the flag.
+	* @param[in] format
+	* @param[in] srgb
+	* @return uint32_t
+	*/
+	inline uint32_t vkFormat(BlockFormat format, bool srgb)
+	{
+		switch (format)
+		{
+		case BLOCK_BC1: return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case BLOCK_BC3: return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+		case BLOCK_BC4: return VK_FORMAT_BC4_UNORM_BLOCK;
+		case BLOCK_BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+		default: return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		}
+	}
+
+	/*
+	* GL internal format of a Vulkan block format.
+	* @param[in] vkFormat
+	* @return GLenum, 0 for formats this file does not encode.
+	*/
+	inline GLenum glFormat(uint32_t vkFormat)
+	{
+		switch (vkFormat)
+		{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+		case VK_FORMAT_BC3_UNORM_BLOCK: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case VK_FORMAT_BC3_SRGB_BLOCK: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+		case VK_FORMAT_BC4_UNORM_BLOCK: return GL_COMPRESSED_RED_RGTC1;
+		case VK_FORMAT_BC5_UNORM_BLOCK: return GL_COMPRESSED_RG_RGTC2;
+		case VK_FORMAT_BC7_UNORM_BLOCK: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+		case VK_FORMAT_BC7_SRGB_BLOCK: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+		default: return 0;
+		}
+	}
+
+	// Writes fields into a block least significant bit first, the order every BCn format uses.
+	struct BitWriter
+	{
+		unsigned char *out;
+		unsigned int position = 0;
+
+		void write(uint32_t value, unsigned int bits)
+		{
+			for (unsigned int i = 0; i < bits; i++, position++)
+			{
+				if (value >> i & 1)
+				{
+					out[position >> 3] |= static_cast<unsigned char>(1 << (position & 7));
+				}
+			}
+		}
+	};
+
+	/*
+	* Fit a line through a set of points: the mean and the direction of largest variance.
+	* @param[in] points count points of dims floats.
+	* @param[in] count
+	* @param[in] dims At most 4.
+	* @param[out] mean
+	* @param[out] axis Unit length, or zero when all points are equal.
+	* @return void
+	*/
+	inline void principalAxis(const float *points, int count, int dims, float *mean, float *axis)
+	{
+		float covariance[4][4] = {};
+		for (int d = 0; d < dims; d++)
+		{
+			mean[d] = 0.0f;
+			for (int i = 0; i < count; i++)
+				mean[d] += points[i * dims + d];
+			mean[d] /= count;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			for (int a = 0; a < dims; a++)
+			{
+				for (int b = 0; b < dims; b++)
+				{
+					covariance[a][b] += (points[i * dims + a] - mean[a]) * (points[i * dims + b] - mean[b]);
+				}
+			}
+		}
+
+		// power iteration, started from the channel with the most variance: its column of the covariance
+		// is never zero unless every point is equal
+		int widest = 0;
+		for (int d = 1; d < dims; d++)
+		{
+			if (covariance[d][d] > covariance[widest][widest])
+				widest = d;
+		}
+		for (int d = 0; d < dims; d++)
+			axis[d] = d == widest ? 1.0f : 0.0f;
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int a = 0; a < dims; a++)
+			{
+				for (int b = 0; b < dims; b++)
+					next[a] += covariance[a][b] * axis[b];
+				length += next[a] * next[a];
+			}
+			length = std::sqrt(length);
+			if (length < 1e-8f)
+			{
+				std::fill(axis, axis + dims, 0.0f);
+				return;
+			}
+			for (int d = 0; d < dims; d++)
+				axis[d] = next[d] / length;
+		}
+	}
+
+	/*
+	* Endpoints of a line segment through the points, pulled in by 1/16 of the spread at each end so
+	* outliers do not stretch the palette.
+	* @param[in] points
+	* @param[in] count
+	* @param[in] dims
+	* @param[out] low
+	* @param[out] high
+	* @return void
+	*/
+	inline void fitEndpoints(const float *points, int count, int dims, float *low, float *high)
+	{
+		float mean[4], axis[4];
+		principalAxis(points, count, dims, mean, axis);
+		float minimum = 0.0f, maximum = 0.0f;
+		for (int i = 0; i < count; i++)
+		{
+			float t = 0.0f;
+			for (int d = 0; d < dims; d++)
+				t += (points[i * dims + d] - mean[d]) * axis[d];
+			minimum = std::min(minimum, t);
+			maximum = std::max(maximum, t);
+		}
+		const float inset = (maximum - minimum) / 16.0f;
+		minimum += inset;
+		maximum -= inset;
+		for (int d = 0; d < dims; d++)
+		{
+			low[d] = std::min(255.0f, std::max(0.0f, mean[d] + axis[d] * minimum));
+			high[d] = std::min(255.0f, std::max(0.0f, mean[d] + axis[d] * maximum));
+		}
+	}
+
+	/*
+	* Best endpoints for fixed palette weights: each point i is approximated by (1 - w_i) * a + w_i * b.
+	* @param[in] points
+	* @param[in] weights count weights in [0, 1].
+	* @param[in] count
+	* @param[in] dims
+	* @param[in,out] a Left as is when the weights do not determine the endpoints.
+	* @param[in,out] b
+	* @return void
+	*/
+	inline void refineEndpoints(const float *points, const float *weights, int count, int dims, float *a, float *b)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ap[4] = {}, bp[4] = {};
+		for (int i = 0; i < count; i++)
+		{
+			const float w = weights[i], v = 1.0f - w;
+			aa += v * v;
+			ab += v * w;
+			bb += w * w;
+			for (int d = 0; d < dims; d++)
+			{
+				ap[d] += v * points[i * dims + d];
+				bp[d] += w * points[i * dims + d];
+			}
+		}
+		const float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+		{
+			return;
+		}
+		for (int d = 0; d < dims; d++)
+		{
+			a[d] = std::min(255.0f, std::max(0.0f, (ap[d] * bb - bp[d] * ab) / determinant));
+			b[d] = std::min(255.0f, std::max(0.0f, (bp[d] * aa - ap[d] * ab) / determinant));
+		}
+	}
+
+	inline uint16_t packRgb565(const float *color)
+	{
+		const int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+		const int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+		const int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>(r << 11 | g << 5 | b);
+	}
+
+	inline void unpackRgb565(uint16_t packed, int *color)
+	{
+		const int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+		color[0] = r << 3 | r >> 2;
+		color[1] = g << 2 | g >> 4;
+		color[2] = b << 3 | b >> 2;
+	}
+
+	// indices and squared error of a BC1 color block for two packed endpoints, with c0 > c1
+	inline int matchRgb565(const float *points, uint16_t c0, uint16_t c1, uint32_t &indices)
+	{
+		int palette[4][3];
+		unpackRgb565(c0, palette[0]);
+		unpackRgb565(c1, palette[1]);
+		for (int d = 0; d < 3; d++)
+		{
+			palette[2][d] = (2 * palette[0][d] + palette[1][d]) / 3;
+			palette[3][d] = (palette[0][d] + 2 * palette[1][d]) / 3;
+		}
+		indices = 0;
+		int total = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = INT32_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				int error = 0;
+				for (int d = 0; d < 3; d++)
+				{
+					const int difference = static_cast<int>(points[i * 3 + d]) - palette[p][d];
+					error += difference * difference;
+				}
+				if (error < bestError)
+				{
+					best = p;
+					bestError = error;
+				}
+			}
+			indices |= static_cast<uint32_t>(best) << (i * 2);
+			total += bestError;
+		}
+		return total;
+	}
+
+	/*
+	* Encode the color of a block as BC1, always in four-color mode. Also the color half of BC3.
+	* @param[in] rgba 16 texels, row by row.
+	* @param[out] out 8 bytes.
+	* @return void
+	*/
+	inline void encodeBC1(const unsigned char *rgba, unsigned char *out)
+	{
+		float points[16 * 3];
+		for (int i = 0; i < 16; i++)
+			for (int d = 0; d < 3; d++)
+				points[i * 3 + d] = rgba[i * 4 + d];
+
+		float low[3], high[3];
+		fitEndpoints(points, 16, 3, low, high);
+		uint16_t c0 = packRgb565(high), c1 = packRgb565(low);
+		if (c0 < c1)
+			std::swap(c0, c1);
+		uint32_t indices = 0;
+		int error = c0 == c1 ? 0 : matchRgb565(points, c0, c1, indices);
+
+		if (c0 != c1)
+		{
+			// least squares on the weights the first pass picked; keep the result only if it is better
+			static const float WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+			float weights[16];
+			for (int i = 0; i < 16; i++)
+				weights[i] = WEIGHTS[indices >> (i * 2) & 3];
+			int unpacked[2][3];
+			unpackRgb565(c0, unpacked[0]);
+			unpackRgb565(c1, unpacked[1]);
+			float a[3], b[3];
+			for (int d = 0; d < 3; d++)
+			{
+				a[d] = static_cast<float>(unpacked[0][d]);
+				b[d] = static_cast<float>(unpacked[1][d]);
+			}
+			refineEndpoints(points, weights, 16, 3, a, b);
+			uint16_t r0 = packRgb565(a), r1 = packRgb565(b);
+			if (r0 < r1)
+				std::swap(r0, r1);
+			uint32_t refined;
+			if (r0 != r1)
+			{
+				const int refinedError = matchRgb565(points, r0, r1, refined);
+				if (refinedError < error)
+				{
+					c0 = r0;
+					c1 = r1;
+					indices = refined;
+					error = refinedError;
+				}
+			}
+		}
+		if (c0 == c1)
+			indices = 0;
+
+		std::memset(out, 0, 8);
+		BitWriter bits = { out };
+		bits.write(c0, 16);
+		bits.write(c1, 16);
+		bits.write(indices, 32);
+	}
+
+	/*
+	* Encode one channel of a block as BC4, in the eight-value mode. Also the alpha half of BC3 and both halves of BC5.
+	* @param[in] rgba 16 texels, row by row.
+	* @param[in] channel 0 to 3.
+	* @param[out] out 8 bytes.
+	* @return void
+	*/
+	inline void encodeBC4(const unsigned char *rgba, int channel, unsigned char *out)
+	{
+		int minimum = 255, maximum = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			minimum = std::min(minimum, static_cast<int>(rgba[i * 4 + channel]));
+			maximum = std::max(maximum, static_cast<int>(rgba[i * 4 + channel]));
+		}
+
+		std::memset(out, 0, 8);
+		BitWriter bits = { out };
+		bits.write(maximum, 8);
+		bits.write(minimum, 8);
+		if (maximum == minimum)
+		{
+			return;
+		}
+		// palette: a0, a1, then six steps from a0 towards a1
+		int palette[8] = { maximum, minimum };
+		for (int p = 2; p < 8; p++)
+			palette[p] = ((8 - p) * maximum + (p - 1) * minimum) / 7;
+		for (int i = 0; i < 16; i++)
+		{
+			const int value = rgba[i * 4 + channel];
+			int best = 0;
+			for (int p = 1; p < 8; p++)
+			{
+				if (std::abs(palette[p] - value) < std::abs(palette[best] - value))
+					best = p;
+			}
+			bits.write(best, 3);
+		}
+	}
+
+	// 7-bit endpoint plus its p-bit that lands closest to an 8-bit color
+	inline void quantizeBC7Endpoint(const float *color, int *quantized, int &pBit)
+	{
+		float bestError = 0.0f;
+		for (int p = 0; p < 2; p++)
+		{
+			int candidate[4];
+			float error = 0.0f;
+			for (int d = 0; d < 4; d++)
+			{
+				candidate[d] = std::min(127, std::max(0, static_cast<int>((color[d] - p) / 2.0f + 0.5f)));
+				const float difference = static_cast<float>(candidate[d] << 1 | p) - color[d];
+				error += difference * difference;
+			}
+			if (p == 0 || error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				std::copy(candidate, candidate + 4, quantized);
+			}
+		}
+	}
+
+	// indices and squared error of a BC7 mode 6 block for two quantized endpoints
+	inline int matchBC7(const float *points, const int *e0, int p0, const int *e1, int p1, int *indices)
+	{
+		static const int WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		int palette[16][4];
+		for (int p = 0; p < 16; p++)
+		{
+			for (int d = 0; d < 4; d++)
+			{
+				const int a = e0[d] << 1 | p0, b = e1[d] << 1 | p1;
+				palette[p][d] = ((64 - WEIGHTS[p]) * a + WEIGHTS[p] * b + 32) >> 6;
+			}
+		}
+		int total = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int bestError = INT32_MAX;
+			for (int p = 0; p < 16; p++)
+			{
+				int error = 0;
+				for (int d = 0; d < 4; d++)
+				{
+					const int difference = static_cast<int>(points[i * 4 + d]) - palette[p][d];
+					error += difference * difference;
+				}
+				if (error < bestError)
+				{
+					indices[i] = p;
+					bestError = error;
+				}
+			}
+			total += bestError;
+		}
+		return total;
+	}
+
+	/*
+	* Encode a block as BC7 mode 6.
+	* @param[in] rgba 16 texels, row by row.
+	* @param[out] out 16 bytes.
+	* @return void
+	*/
+	inline void encodeBC7(const unsigned char *rgba, unsigned char *out)
+	{
+		float points[16 * 4];
+		for (int i = 0; i < 64; i++)
+			points[i] = rgba[i];
+
+		float low[4], high[4];
+		fitEndpoints(points, 16, 4, low, high);
+		int e0[4], e1[4], p0, p1, indices[16];
+		quantizeBC7Endpoint(low, e0, p0);
+		quantizeBC7Endpoint(high, e1, p1);
+		int error = matchBC7(points, e0, p0, e1, p1, indices);
+
+		// one least squares pass on the chosen weights
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = indices[i] / 15.0f;
+		refineEndpoints(points, weights, 16, 4, low, high);
+		int r0[4], r1[4], q0, q1, refined[16];
+		quantizeBC7Endpoint(low, r0, q0);
+		quantizeBC7Endpoint(high, r1, q1);
+		if (matchBC7(points, r0, q0, r1, q1, refined) < error)
+		{
+			std::copy(r0, r0 + 4, e0);
+			std::copy(r1, r1 + 4, e1);
+			std::copy(refined, refined + 16, indices);
+			p0 = q0;
+			p1 = q1;
+		}
+
+		// the first index is stored without its top bit, so it must be below 8
+		if (indices[0] >= 8)
+		{
+			std::swap(e0, e1);
+			std::swap(p0, p1);
+			for (int i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		std::memset(out, 0, 16);
+		BitWriter bits = { out };
+		bits.write(1 << 6, 7);
+		for (int d = 0; d < 4; d++)
+		{
+			bits.write(e0[d], 7);
+			bits.write(e1[d], 7);
+		}
+		bits.write(p0, 1);
+		bits.write(p1, 1);
+		bits.write(indices[0], 3);
+		for (int i = 1; i < 16; i++)
+			bits.write(indices[i], 4);
+	}
+
+	/*
+	* Encode one block in any of the formats.
+	* @param[in] format
+	* @param[in] rgba 16 texels, row by row.
+	* @param[out] out blockBytes(format) bytes.
+	* @return void
+	*/
+	inline void encodeBlock(BlockFormat format, const unsigned char *rgba, unsigned char *out)
+	{
+		switch (format)
+		{
+		case BLOCK_BC1:
+			encodeBC1(rgba, out);
+			break;
+		case BLOCK_BC3:
+			encodeBC4(rgba, 3, out);
+			encodeBC1(rgba, out + 8);
+			break;
+		case BLOCK_BC4:
+			encodeBC4(rgba, 0, out);
+			break;
+		case BLOCK_BC5:
+			encodeBC4(rgba, 0, out);
+			encodeBC4(rgba, 1, out + 8);
+			break;
+		case BLOCK_BC7:
+			encodeBC7(rgba, out);
+			break;
+		}
+	}
+
+	/*
+	* Copy the 4x4 block at a block position out of an image as RGBA, repeating the last row and column
+	* where the image does not fill the block. One channel is spread to gray, two become red and green.
+	* @param[in] pixels
+	* @param[in] width
+	* @param[in] height
+	* @param[in] components
+	* @param[in] blockX
+	* @param[in] blockY
+	* @param[out] rgba 64 bytes.
+	* @return void
+	*/
+	inline void fetchBlock(const unsigned char *pixels, int width, int height, int components, int blockX, int blockY, unsigned char *rgba)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			const int sourceY = std::min(blockY * 4 + y, height - 1);
+			for (int x = 0; x < 4; x++)
+			{
+				const int sourceX = std::min(blockX * 4 + x, width - 1);
+				const unsigned char *texel = pixels + (static_cast<size_t>(sourceY) * width + sourceX) * components;
+				unsigned char *target = rgba + (y * 4 + x) * 4;
+				target[0] = texel[0];
+				target[1] = components == 1 ? texel[0] : texel[1];
+				target[2] = components == 1 ? texel[0] : components == 2 ? 0 : texel[2];
+				target[3] = components == 4 ? texel[3] : 255;
+			}
+		}
+	}
+
+	/*
+	* Encode a whole image, splitting its block rows across the worker pool. Do not call from a pool job.
+	* @param[in] pixels
+	* @param[in] width
+	* @param[in] height
+	* @param[in] components
+	* @param[in] format
+	* @return the blocks, row by row.
+	*/
+	inline std::vector<unsigned char> encodeImage(const unsigned char *pixels, int width, int height, int components, BlockFormat format)
+	{
+		const int blocksX = (width + 3) / 4;
+		const int blocksY = (height + 3) / 4;
+		const size_t rowBytes = blocksX * blockBytes(format);
+		std::vector<unsigned char> blocks(rowBytes * blocksY);
+
+		ThreadPool &pool = ThreadPool::shared();
+		const int band = std::max(1, blocksY / static_cast<int>(pool.size() * 4));
+		std::vector<std::future<void>> jobs;
+		for (int first = 0; first < blocksY; first += band)
+		{
+			const int last = std::min(blocksY, first + band);
+			unsigned char *out = blocks.data() + first * rowBytes;
+			jobs.push_back(pool.submit([=]
+			{
+				unsigned char rgba[64];
+				unsigned char *block = out;
+				for (int y = first; y < last; y++)
+				{
+					for (int x = 0; x < blocksX; x++, block += blockBytes(format))
+					{
+						fetchBlock(pixels, width, height, components, x, y, rgba);
+						encodeBlock(format, rgba, block);
+					}
+				}
+			}));
+		}
+		for (std::future<void> &job : jobs)
+		{
+			job.get();
+		}
+		return blocks;
+	}
+}
+
+#endif
@@ -4,13 +4,18 @@ out vec4 FragColor;
 in vec3 Normal;
 in vec3 Position;
 
-uniform vec3 cameraPos;
+// camera state shared by every program, see frame_uniforms.hpp
+layout (std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
 uniform samplerCube skybox;
 
 void main()
 {
     float ratio = 1.00 / 1.52;
-    vec3 I = normalize(Position - cameraPos);
+    vec3 I = normalize(Position - viewPos);
     vec3 R = refract(I, normalize(Normal), ratio);
     FragColor = vec4(texture(skybox, R).rgb, 1.0);
 }
\ No newline at end of file
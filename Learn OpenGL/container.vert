@@ -4,8 +4,12 @@ layout (location = 1) in vec3 aNormal;
 out vec3 Normal;
 out vec3 Position;
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// camera state shared by every program, see frame_uniforms.hpp
+layout (std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
 void main()
 {
     Normal = mat3(transpose(inverse(model))) * aNormal;
@@ -1,7 +1,33 @@
 #version 330 core
+// Lit surface: a directional light, point lights and the camera's spot light, with image-based light
+// from the skybox. Reads its textures through bindless handles when the driver has them (see
+// bindless_textures.hpp), and from the bound samplers otherwise or when materialIndex is negative.
+//
+// Compiled in variants (see shader_permutations.hpp). NR_POINT_LIGHTS sets how many point lights are lit,
+// PHONG swaps Blinn-Phong's half vector for the reflected light, NORMAL_MAP reads material.normal, PACKED
+// samples textures packed into array textures by MaterialAtlas; with no defines it is Blinn-Phong with
+// every point light, no normal map and plain 2D textures.
+#extension GL_ARB_bindless_texture : enable
+#ifdef PACKED
+// a texture packed by MaterialAtlas: one layer of an array texture, and the scale (xy) and offset (zw)
+// of its rectangle in that layer
+struct PackedTexture {
+	sampler2DArray array;
+	float layer;
+	vec4 transform;
+};
+#endif
 struct Material {
+#ifdef PACKED
+	PackedTexture texture_diffuse1;
+	PackedTexture texture_specular1;
+#else
 	sampler2D diffuse;
 	sampler2D specular;
+#endif
+#ifdef NORMAL_MAP
+	sampler2D normal;
+#endif
 	float shininess;
 };
 struct DirLight {
@@ -38,22 +64,79 @@ struct SpotLight {
 	vec3 specular;
 };
 
+#ifndef NR_POINT_LIGHTS
 #define NR_POINT_LIGHTS 4
+#endif
 
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
 out vec4 FragColor;
 
-uniform vec3 viewPos;
+// camera state shared by every program, see frame_uniforms.hpp
+layout (std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+// light state shared by every program, see frame_uniforms.hpp
+layout (std140) uniform LightData {
+	DirLight dirLight;
+	SpotLight spotLight;
+#if NR_POINT_LIGHTS > 0
+	// fewer than the 4 the buffer holds leaves the rest of the block unread
+	PointLight pointLights[NR_POINT_LIGHTS];
+#endif
+};
 uniform Material material;
-uniform DirLight dirLight;
-uniform SpotLight spotLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
+
+#ifdef GL_ARB_bindless_texture
+// per material: the diffuse handle in xy, the specular handle in zw
+layout (std140) uniform Materials {
+	uvec4 materials[1024];
+};
+#endif
+uniform int materialIndex = -1;
+
+#ifdef PACKED
+vec4 SamplePacked(PackedTexture packed, vec2 uv)
+{
+	return texture(packed.array, vec3(uv * packed.transform.xy + packed.transform.zw, packed.layer));
+}
+#endif
+
+vec4 SampleDiffuse(vec2 uv)
+{
+#ifdef PACKED
+	// meshes with packed textures always bind them, the Materials block holds no arrays
+	return SamplePacked(material.texture_diffuse1, uv);
+#else
+#ifdef GL_ARB_bindless_texture
+	if (materialIndex >= 0)
+	{
+		return texture(sampler2D(materials[materialIndex].xy), uv);
+	}
+#endif
+	return texture(material.diffuse, uv);
+#endif
+}
+
+// image-based light from the skybox, baked by ibl_baker.hpp: irradiance harmonics premultiplied so their
+// sum is the diffuse light, and one GGX roughness per mip level of the prefiltered environment
+uniform bool environmentLighting = false;
+uniform vec3 irradianceSH[9];
+uniform samplerCube prefilteredEnvironment;
+uniform sampler2D brdfLut;
+uniform float prefilteredMaxLod;
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcEnvironment(vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+float Specular(vec3 lightDir, vec3 normal, vec3 viewDir);
+#ifdef NORMAL_MAP
+vec3 PerturbNormal(vec3 normal, vec2 uv);
+#endif
 
 float LinearizeDepth(float depth)
 {
@@ -64,15 +147,24 @@ float LinearizeDepth(float depth)
 void main()
 {
 	vec3 norm = normalize(Normal);
+#ifdef NORMAL_MAP
+	norm = PerturbNormal(norm, TexCoords);
+#endif
 	vec3 viewDir = normalize(viewPos - FragPos);
 	// first calculate directional lighting
 	vec3 result = CalcDirLight(dirLight, norm, viewDir);
 	// calculate any point lights and add it
+#if NR_POINT_LIGHTS > 0
 	for (int i = 0; i < NR_POINT_LIGHTS; i++)
 	{
 		result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
 	}
+#endif
 	result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
+	if (environmentLighting)
+	{
+		result += CalcEnvironment(norm, viewDir);
+	}
 	float depth = LinearizeDepth(gl_FragCoord.z) / 100;
 	result = pow(result, vec3(1.0/2.2));
 	FragColor = vec4(result, 1.0);
@@ -82,35 +174,49 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 {
 	vec3 lightDir = normalize(-light.direction);
 	float diff = max(dot(normal, lightDir), 0.0);
-	//vec3 reflectDir = reflect(-lightDir, normal);
-	//float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	vec3 halfWayDir = normalize(lightDir + viewDir);
-	float spec = pow(max(dot(normal, halfWayDir), 0.0), material.shininess);
+	float spec = Specular(lightDir, normal, viewDir);
 	
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
+	vec3 ambient = light.ambient * vec3(SampleDiffuse(TexCoords));
+	vec3 diffuse = light.diffuse * diff * vec3(SampleDiffuse(TexCoords));
 	//vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
 	vec3 specular = (ambient + diffuse) * spec;
 	
 	return (ambient + diffuse + specular);
 }
 
+vec3 CalcEnvironment(vec3 normal, vec3 viewDir)
+{
+	vec3 n = normal;
+	vec3 irradiance = irradianceSH[0] * 0.282095
+		+ 0.488603 * (irradianceSH[1] * n.y + irradianceSH[2] * n.z + irradianceSH[3] * n.x)
+		+ 1.092548 * (irradianceSH[4] * n.x * n.y + irradianceSH[5] * n.y * n.z + irradianceSH[7] * n.x * n.z)
+		+ 0.315392 * irradianceSH[6] * (3.0 * n.z * n.z - 1.0)
+		+ 0.546274 * irradianceSH[8] * (n.x * n.x - n.y * n.y);
+	// the Blinn-Phong exponent as GGX roughness, and a dielectric's reflectance
+	float roughness = sqrt(2.0 / (material.shininess + 2.0));
+	float NdotV = max(dot(normal, viewDir), 0.0);
+	vec3 prefiltered = textureLod(prefilteredEnvironment, reflect(-viewDir, normal), roughness * prefilteredMaxLod).rgb;
+	vec2 brdf = texture(brdfLut, vec2(NdotV, roughness)).rg;
+	vec3 F0 = vec3(0.04);
+
+	vec3 diffuse = vec3(SampleDiffuse(TexCoords)) * max(irradiance, 0.0);
+	vec3 specular = prefiltered * (F0 * brdf.x + brdf.y);
+	return diffuse + specular;
+}
+
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
 	vec3 lightDir = normalize(light.position - fragPos);
 	
 	float diff = max(dot(normal, lightDir), 0.0);
 	
-	//vec3 reflectDir = reflect(-lightDir, normal);
-	//float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	vec3 halfWayDir = normalize(lightDir + viewDir);
-	float spec = pow(max(dot(normal, halfWayDir), 0.0), material.shininess);
+	float spec = Specular(lightDir, normal, viewDir);
 	
 	float distance = length(light.position - fragPos);
 	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 	
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
+	vec3 ambient = light.ambient * vec3(SampleDiffuse(TexCoords));
+	vec3 diffuse = light.diffuse * diff * vec3(SampleDiffuse(TexCoords));
 	//vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
 	vec3 specular = (ambient + diffuse) * spec;
 	
@@ -126,16 +232,13 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 
 	float diff = max(dot(normal, lightDir), 0.0);
 
-	//vec3 reflectDir = reflect(-lightDir, normal);
-	//float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	vec3 halfWayDir = normalize(lightDir + viewDir);
-	float spec = pow(max(dot(normal, halfWayDir), 0.0), material.shininess);
+	float spec = Specular(lightDir, normal, viewDir);
 	
 	float distance = length(light.position - fragPos);
 	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 	
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
+	vec3 ambient = light.ambient * vec3(SampleDiffuse(TexCoords));
+	vec3 diffuse = light.diffuse * diff * vec3(SampleDiffuse(TexCoords));
 	//vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
 	vec3 specular = (ambient + diffuse) * spec;
 	
@@ -147,4 +250,35 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	specular *= intensity * attenuation;
 
 	return (ambient + diffuse + specular);
-}
\ No newline at end of file
+}
+
+float Specular(vec3 lightDir, vec3 normal, vec3 viewDir)
+{
+#ifdef PHONG
+	vec3 reflectDir = reflect(-lightDir, normal);
+	return pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+#else
+	vec3 halfWayDir = normalize(lightDir + viewDir);
+	return pow(max(dot(normal, halfWayDir), 0.0), material.shininess);
+#endif
+}
+
+#ifdef NORMAL_MAP
+// Tangent frame from the screen space derivatives of the position and texture coordinates, so meshes
+// need no tangent attribute
+vec3 PerturbNormal(vec3 normal, vec2 uv)
+{
+	vec3 dp1 = dFdx(FragPos);
+	vec3 dp2 = dFdy(FragPos);
+	vec2 duv1 = dFdx(uv);
+	vec2 duv2 = dFdy(uv);
+	vec3 dp2perp = cross(dp2, normal);
+	vec3 dp1perp = cross(normal, dp1);
+	vec3 tangent = dp2perp * duv1.x + dp1perp * duv2.x;
+	vec3 bitangent = dp2perp * duv1.y + dp1perp * duv2.y;
+	float invmax = inversesqrt(max(max(dot(tangent, tangent), dot(bitangent, bitangent)), 1e-12));
+	mat3 TBN = mat3(tangent * invmax, bitangent * invmax, normal);
+	vec3 mapped = texture(material.normal, uv).xyz * 2.0 - 1.0;
+	return normalize(TBN * mapped);
+}
+#endif
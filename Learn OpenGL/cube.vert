@@ -2,19 +2,50 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+#ifdef INSTANCING
+layout (location = 3) in mat4 instanceMatrix;
+#endif
 
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
 
+#ifndef INSTANCING
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
+// camera state shared by every program, see frame_uniforms.hpp
+layout (std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+// per-mesh dequantization for VERTEX_COMPACT meshes; the defaults leave full precision vertices untouched
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionOffset = vec3(0.0);
+uniform bool octahedralNormals = false;
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
-	FragPos = vec3(model * vec4(aPos, 1.0));
-	Normal = mat3(transpose(inverse(model))) * aNormal;
+	vec3 position = aPos * positionScale + positionOffset;
+	vec3 normal = octahedralNormals ? decodeOctahedral(aNormal.xy) : aNormal;
+#ifdef INSTANCING
+	mat4 world = instanceMatrix;
+#else
+	mat4 world = model;
+#endif
+	gl_Position = projection * view * world * vec4(position, 1.0);
+	FragPos = vec3(world * vec4(position, 1.0));
+	Normal = mat3(transpose(inverse(world))) * normal;
 	TexCoords = aTexCoords;
 }
\ No newline at end of file
@@ -0,0 +1,221 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstring>
+#include <unordered_set>
+#include "gpu_memory.hpp"
+#include "shader.hpp"
+
+// C++ mirrors of the FrameData and LightData blocks, laid out by the std140 rules: vec3 members align
+// to 16 bytes and may be followed by a scalar in their fourth slot, and every struct and array element
+// rounds up to 16. The static_asserts below pin each member to the offset GLSL gives it.
+struct DirLightStd140
+{
+	glm::vec3 direction;
+	float pad0;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+struct PointLightStd140
+{
+	glm::vec3 position;
+	float constant;
+	float linear;
+	float quadratic;
+	float pad0[2];
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+struct SpotLightStd140
+{
+	glm::vec3 position;
+	float pad0;
+	glm::vec3 direction;
+	float cutOff;
+	float outerCutOff;
+	float constant;
+	float linear;
+	float quadratic;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+struct FrameData
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 viewPos;
+	float pad0;
+};
+
+struct LightData
+{
+	static const int POINT_LIGHTS = 4;	// NR_POINT_LIGHTS in the shaders
+
+	DirLightStd140 dirLight;
+	SpotLightStd140 spotLight;
+	PointLightStd140 pointLights[POINT_LIGHTS];
+};
+
+static_assert(offsetof(DirLightStd140, ambient) == 16 && offsetof(DirLightStd140, specular) == 48 && sizeof(DirLightStd140) == 64,
+	"DirLight does not match std140");
+static_assert(offsetof(PointLightStd140, constant) == 12 && offsetof(PointLightStd140, quadratic) == 20 &&
+	offsetof(PointLightStd140, ambient) == 32 && offsetof(PointLightStd140, specular) == 64 && sizeof(PointLightStd140) == 80,
+	"PointLight does not match std140");
+static_assert(offsetof(SpotLightStd140, direction) == 16 && offsetof(SpotLightStd140, cutOff) == 28 &&
+	offsetof(SpotLightStd140, quadratic) == 44 && offsetof(SpotLightStd140, ambient) == 48 && offsetof(SpotLightStd140, specular) == 80 &&
+	sizeof(SpotLightStd140) == 96, "SpotLight does not match std140");
+static_assert(offsetof(FrameData, view) == 64 && offsetof(FrameData, viewPos) == 128 && sizeof(FrameData) == 144,
+	"FrameData does not match std140");
+static_assert(offsetof(LightData, spotLight) == 64 && offsetof(LightData, pointLights) == 160 && sizeof(LightData) == 480,
+	"LightData does not match std140");
+
+// Camera and light state shared by every program through the FrameData and LightData uniform blocks.
+// Fill frame and lights, upload() once per frame and every attached program reads the same copy, so
+// switching programs re-uploads nothing.
+//
+// The blocks live in one uniform buffer with a region per frame in flight. upload() maps the next region
+// unsynchronized and binds it; endFrame() fences the region after the frame's draws, and a region is
+// only written again once its fence has signalled.
+class FrameUniforms
+{
+public:
+	static const int RING_SIZE = 3;
+	// uniform buffer bindings; BindlessTextures::MATERIAL_BINDING takes 1, and 0 is left to blocks nobody bound
+	static const GLuint FRAME_BINDING = 2;
+	static const GLuint LIGHT_BINDING = 3;
+
+	struct Stats
+	{
+		size_t uploads;
+		size_t stalls;		// uploads that had to wait for the GPU to finish with their region
+	};
+
+	FrameData frame = {};
+	LightData lights = {};
+
+	/*
+	* Constructor for the uniforms. Needs a current GL context.
+	* @return FrameUniforms
+	*/
+	FrameUniforms()
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		lightOffset = alignUp(sizeof(FrameData), static_cast<size_t>(alignment));
+		stride = alignUp(lightOffset + sizeof(LightData), static_cast<size_t>(alignment));
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, stride * RING_SIZE, nullptr, GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		GpuMemory::shared().trackBuffer(buffer, GPU_UNIFORM_BUFFERS, stride * RING_SIZE, "FrameUniforms");
+	}
+
+	FrameUniforms(const FrameUniforms&) = delete;
+	FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+	// Point a program's FrameData and LightData blocks at their bindings; GLSL 3.30 cannot do it in the shader.
+	// The block indices only exist once the program has linked, so a program still linking is bound at its
+	// first use instead of waited for here. Shaders sharing a program each bind it, whichever is used first.
+	void attach(const Shader &shader)
+	{
+		if (!shaders.insert(&shader).second)
+		{
+			return;
+		}
+		const unsigned int program = shader.ID;
+		shader.whenLinked([program]()
+		{
+			const GLuint frameIndex = glGetUniformBlockIndex(program, "FrameData");
+			if (frameIndex != GL_INVALID_INDEX)
+			{
+				glUniformBlockBinding(program, frameIndex, FRAME_BINDING);
+			}
+			const GLuint lightIndex = glGetUniformBlockIndex(program, "LightData");
+			if (lightIndex != GL_INVALID_INDEX)
+			{
+				glUniformBlockBinding(program, lightIndex, LIGHT_BINDING);
+			}
+		});
+	}
+
+	// Write frame and lights into the next region and bind it. Call once per frame before drawing.
+	void upload()
+	{
+		GLsync &fence = fences[current];
+		if (fence)
+		{
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				stalls++;
+				glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			}
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		const GLintptr base = static_cast<GLintptr>(stride * current);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		unsigned char *mapped = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, base, static_cast<GLsizeiptr>(stride),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+		if (mapped)
+		{
+			std::memcpy(mapped, &frame, sizeof(FrameData));
+			std::memcpy(mapped + lightOffset, &lights, sizeof(LightData));
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, buffer, base, sizeof(FrameData));
+		glBindBufferRange(GL_UNIFORM_BUFFER, LIGHT_BINDING, buffer, base + static_cast<GLintptr>(lightOffset), sizeof(LightData));
+		uploads++;
+	}
+
+	// Fence the region the frame read from and move on to the next. Call after the frame's last draw.
+	void endFrame()
+	{
+		fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		current = (current + 1) % RING_SIZE;
+	}
+
+	Stats stats() const
+	{
+		return { uploads, stalls };
+	}
+
+private:
+	unsigned int buffer = 0;
+	size_t lightOffset = 0;
+	size_t stride = 0;
+	int current = 0;
+	GLsync fences[RING_SIZE] = {};
+	std::unordered_set<const Shader*> shaders;
+	size_t uploads = 0;
+	size_t stalls = 0;
+
+	static size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+};
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <vector>
+#include "gpu_memory.hpp"
+
+// Draws gathered for one multi-draw: byte offsets into the arena's index buffer plus base vertices.
+struct DrawBatch
+{
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+	std::vector<GLint> baseVertices;
+
+	void clear()
+	{
+		counts.clear();
+		offsets.clear();
+		baseVertices.clear();
+	}
+
+	/*
+	* Add a range of indices, merging it into the previous draw when the two are contiguous.
+	* @param[in] count Number of indices.
+	* @param[in] offset Byte offset of the first index.
+	* @param[in] baseVertex
+	* @param[in] indexSize Size of one index in bytes.
+	* @return void
+	*/
+	void add(GLsizei count, size_t offset, GLint baseVertex, size_t indexSize)
+	{
+		if (!counts.empty() && baseVertices.back() == baseVertex &&
+			reinterpret_cast<size_t>(offsets.back()) + counts.back() * indexSize == offset)
+		{
+			counts.back() += count;
+			return;
+		}
+		counts.push_back(count);
+		offsets.push_back(reinterpret_cast<const void*>(offset));
+		baseVertices.push_back(baseVertex);
+	}
+};
+
+// One vertex buffer, one index buffer and one vertex array shared by every mesh with the same vertex
+// layout and index type. Meshes are suballocated back to back and drawn with base-vertex offsets, so
+// their indices stay local and any number of them can go out in a single multi-draw. Released ranges
+// leave holes that compact() squeezes out; allocate() compacts on its own before growing when at
+// least half of the used space is dead.
+class GeometryArena
+{
+public:
+	typedef void (*AttributeSetup)();
+
+	struct Range
+	{
+		unsigned int baseVertex;
+		unsigned int vertexCount;
+		unsigned int firstIndex;
+		unsigned int indexCount;
+		bool live;
+	};
+
+	struct Stats
+	{
+		size_t vertexCapacity;
+		size_t indexCapacity;
+		size_t verticesUsed;	// end of the last allocation, including holes
+		size_t indicesUsed;
+		size_t verticesLive;
+		size_t indicesLive;
+		size_t allocations;
+		size_t growths;
+		size_t compactions;
+	};
+
+	// Owns one allocation and releases it when destroyed. Move only.
+	class Handle
+	{
+	public:
+		Handle() = default;
+		Handle(GeometryArena *arena, unsigned int id) : arena(arena), id(id) {}
+		Handle(Handle &&other) noexcept : arena(other.arena), id(other.id)
+		{
+			other.arena = nullptr;
+		}
+		Handle& operator=(Handle &&other) noexcept
+		{
+			if (this != &other)
+			{
+				reset();
+				arena = other.arena;
+				id = other.id;
+				other.arena = nullptr;
+			}
+			return *this;
+		}
+		Handle(const Handle&) = delete;
+		Handle& operator=(const Handle&) = delete;
+		~Handle()
+		{
+			reset();
+		}
+
+		void reset()
+		{
+			if (arena)
+			{
+				arena->release(id);
+				arena = nullptr;
+			}
+		}
+		GeometryArena *owner() const
+		{
+			return arena;
+		}
+		// ranges move when the arena compacts, so look them up at draw time
+		const Range &range() const
+		{
+			return arena->range(id);
+		}
+
+	private:
+		GeometryArena *arena = nullptr;
+		unsigned int id = 0;
+	};
+
+	/*
+	* Constructor for the arena. No GL objects are created until the first allocation.
+	* @param[in] vertexSize Size of one vertex in bytes.
+	* @param[in] indexType GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+	* @param[in] setupAttributes Sets the attribute pointers for the buffer bound to GL_ARRAY_BUFFER.
+	* @return GeometryArena
+	*/
+	GeometryArena(size_t vertexSize, GLenum indexType, AttributeSetup setupAttributes)
+		: vertexSize(vertexSize), indexType(indexType), setupAttributes(setupAttributes)
+	{
+	}
+
+	// The arenas live until exit, after the GL context is gone, so the buffers are left to the driver.
+	GeometryArena(const GeometryArena&) = delete;
+	GeometryArena& operator=(const GeometryArena&) = delete;
+
+	/*
+	* Copy a mesh into the arena.
+	* @param[in] vertexData vertexCount vertices in the arena's layout.
+	* @param[in] vertexCount
+	* @param[in] indexData indexCount indices of the arena's type, relative to the mesh's first vertex.
+	* @param[in] indexCount
+	* @return Handle of the allocation.
+	*/
+	Handle allocate(const void *vertexData, unsigned int vertexCount, const void *indexData, unsigned int indexCount)
+	{
+		if (VAO == 0)
+		{
+			glGenVertexArrays(1, &VAO);
+		}
+		if (verticesUsed + vertexCount > vertexCapacity || indicesUsed + indexCount > indexCapacity)
+		{
+			if (verticesUsed - verticesLive >= verticesLive || indicesUsed - indicesLive >= indicesLive)
+			{
+				compact();
+			}
+			if (verticesUsed + vertexCount > vertexCapacity || indicesUsed + indexCount > indexCapacity)
+			{
+				rebuild(std::max({ vertexCapacity * 2, verticesUsed + vertexCount, MIN_VERTICES }),
+					std::max({ indexCapacity * 2, indicesUsed + indexCount, MIN_INDICES }), false);
+				growths++;
+			}
+		}
+
+		Range range = { static_cast<unsigned int>(verticesUsed), vertexCount, static_cast<unsigned int>(indicesUsed), indexCount, true };
+		glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, range.baseVertex * vertexSize, vertexCount * vertexSize, vertexData);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * indexSize(), indexCount * indexSize(), indexData);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		verticesUsed += vertexCount;
+		indicesUsed += indexCount;
+		verticesLive += vertexCount;
+		indicesLive += indexCount;
+
+		unsigned int id;
+		if (!freeIds.empty())
+		{
+			id = freeIds.back();
+			freeIds.pop_back();
+			ranges[id] = range;
+		}
+		else
+		{
+			id = static_cast<unsigned int>(ranges.size());
+			ranges.push_back(range);
+		}
+		return Handle(this, id);
+	}
+
+	void release(unsigned int id)
+	{
+		Range &range = ranges[id];
+		verticesLive -= range.vertexCount;
+		indicesLive -= range.indexCount;
+		range.live = false;
+		freeIds.push_back(id);
+		// the tail can be reused right away
+		if (verticesLive == 0)
+		{
+			verticesUsed = 0;
+			indicesUsed = 0;
+		}
+	}
+
+	const Range &range(unsigned int id) const
+	{
+		return ranges[id];
+	}
+
+	/*
+	* Move every live allocation to the front of freshly allocated buffers, dropping the holes left by
+	* released meshes. Handles stay valid; their ranges change.
+	* @return void
+	*/
+	void compact()
+	{
+		if (VBO == 0 || (verticesUsed == verticesLive && indicesUsed == indicesLive))
+		{
+			return;
+		}
+		rebuild(vertexCapacity, indexCapacity, true);
+		compactions++;
+	}
+
+	void draw(const DrawBatch &batch) const
+	{
+		if (batch.counts.empty())
+		{
+			return;
+		}
+		if (batch.counts.size() == 1)
+		{
+			glDrawElementsBaseVertex(GL_TRIANGLES, batch.counts[0], indexType, const_cast<void*>(batch.offsets[0]), batch.baseVertices[0]);
+			return;
+		}
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts.data(), indexType, batch.offsets.data(),
+			static_cast<GLsizei>(batch.counts.size()), batch.baseVertices.data());
+	}
+
+	Stats stats() const
+	{
+		size_t allocations = 0;
+		for (const Range &range : ranges)
+		{
+			allocations += range.live;
+		}
+		return { vertexCapacity, indexCapacity, verticesUsed, indicesUsed, verticesLive, indicesLive, allocations, growths, compactions };
+	}
+
+	unsigned int vertexArray() const
+	{
+		return VAO;
+	}
+	GLenum getIndexType() const
+	{
+		return indexType;
+	}
+	size_t indexSize() const
+	{
+		return indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+	}
+
+private:
+	static constexpr size_t MIN_VERTICES = 1 << 16;
+	static constexpr size_t MIN_INDICES = 1 << 18;
+
+	size_t vertexSize;
+	GLenum indexType;
+	AttributeSetup setupAttributes;
+	unsigned int VAO = 0, VBO = 0, EBO = 0;
+	size_t vertexCapacity = 0, indexCapacity = 0;
+	size_t verticesUsed = 0, indicesUsed = 0;
+	size_t verticesLive = 0, indicesLive = 0;
+	size_t growths = 0, compactions = 0;
+	std::vector<Range> ranges;
+	std::vector<unsigned int> freeIds;
+
+	// Replace both buffers, copying the old contents on the GPU either as one block or packed.
+	void rebuild(size_t newVertexCapacity, size_t newIndexCapacity, bool pack)
+	{
+		unsigned int buffers[2];
+		glGenBuffers(2, buffers);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+		glBufferData(GL_COPY_WRITE_BUFFER, newVertexCapacity * vertexSize, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+		glBufferData(GL_COPY_WRITE_BUFFER, newIndexCapacity * indexSize(), nullptr, GL_STATIC_DRAW);
+		GpuMemory::shared().trackBuffer(buffers[0], GPU_VERTEX_BUFFERS, newVertexCapacity * vertexSize, "GeometryArena");
+		GpuMemory::shared().trackBuffer(buffers[1], GPU_INDEX_BUFFERS, newIndexCapacity * indexSize(), "GeometryArena");
+
+		if (VBO != 0)
+		{
+			if (!pack)
+			{
+				copy(VBO, buffers[0], 0, 0, verticesUsed * vertexSize);
+				copy(EBO, buffers[1], 0, 0, indicesUsed * indexSize());
+			}
+			else
+			{
+				size_t vertexEnd = 0, indexEnd = 0;
+				for (Range &range : ranges)
+				{
+					if (!range.live)
+					{
+						continue;
+					}
+					copy(VBO, buffers[0], range.baseVertex * vertexSize, vertexEnd * vertexSize, range.vertexCount * vertexSize);
+					copy(EBO, buffers[1], range.firstIndex * indexSize(), indexEnd * indexSize(), range.indexCount * indexSize());
+					range.baseVertex = static_cast<unsigned int>(vertexEnd);
+					range.firstIndex = static_cast<unsigned int>(indexEnd);
+					vertexEnd += range.vertexCount;
+					indexEnd += range.indexCount;
+				}
+				verticesUsed = vertexEnd;
+				indicesUsed = indexEnd;
+			}
+			GpuMemory::shared().releaseBuffer(VBO);
+			GpuMemory::shared().releaseBuffer(EBO);
+			glDeleteBuffers(1, &VBO);
+			glDeleteBuffers(1, &EBO);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		VBO = buffers[0];
+		EBO = buffers[1];
+		vertexCapacity = newVertexCapacity;
+		indexCapacity = newIndexCapacity;
+
+		// point the vertex array at the new buffers
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		setupAttributes();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBindVertexArray(0);
+	}
+
+	static void copy(unsigned int source, unsigned int destination, size_t readOffset, size_t writeOffset, size_t size)
+	{
+		if (size == 0)
+		{
+			return;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, source);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, readOffset, writeOffset, size);
+	}
+};
+
+#endif
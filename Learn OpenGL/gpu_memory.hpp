@@ -0,0 +1,428 @@
+#ifndef GPU_MEMORY_H
+#define GPU_MEMORY_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "block_compression.hpp"
+
+#ifndef GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX
+#define GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+#endif
+#ifndef GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_GPU_MEMORY_INFO_EVICTION_COUNT_NVX
+#define GL_GPU_MEMORY_INFO_EVICTION_COUNT_NVX 0x904A
+#endif
+#ifndef GL_GPU_MEMORY_INFO_EVICTED_MEMORY_NVX
+#define GL_GPU_MEMORY_INFO_EVICTED_MEMORY_NVX 0x904B
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+enum GpuCategory
+{
+	GPU_VERTEX_BUFFERS,
+	GPU_INDEX_BUFFERS,
+	GPU_UNIFORM_BUFFERS,
+	GPU_STAGING_BUFFERS,	// pixel pack and unpack buffers
+	GPU_TEXTURES,
+	GPU_RENDER_TARGETS,		// renderbuffers and textures drawn into
+	GPU_MULTISAMPLE,		// multisampled attachments
+	GPU_CATEGORY_COUNT
+};
+
+// Registry of the video memory the renderer allocates. Every buffer, texture and renderbuffer is recorded
+// with its size, format and owner when its storage is specified and dropped again when it is deleted,
+// which gives a live breakdown per category and per owner. Sizes are what the data needs, with three
+// channel formats counted at four the way drivers store them; drivers add alignment and bookkeeping on
+// top, so where the NVX or ATI memory info extension exists the report puts the driver's figure next
+// to the tracked one.
+//
+// Over budget, update() runs the eviction callbacks in the order they were added until the total fits;
+// under it, the relief callbacks learn how much room there is, so memory given up earlier can come back.
+// It is called once per frame rather than from inside an allocation, so callbacks may free and allocate
+// as they like, and whatever they free later (a streamer that drops levels on its next update) counts
+// the frame after. GL thread only.
+class GpuMemory
+{
+public:
+	struct Stats
+	{
+		size_t objects[GPU_CATEGORY_COUNT];
+		size_t bytes[GPU_CATEGORY_COUNT];
+		size_t total;
+		size_t peak;
+		size_t budget;			// 0 for none
+		size_t evictionRuns;	// frames the callbacks had to run
+		bool overBudget;		// still over after the callbacks ran
+	};
+
+	// What the driver reports, where it reports anything.
+	struct DriverMemory
+	{
+		const char *source;		// extension the numbers come from, null without one
+		size_t totalBytes;		// 0 if the extension does not tell
+		size_t freeBytes;
+		size_t evictions;
+		size_t evictedBytes;
+	};
+
+	static GpuMemory &shared()
+	{
+		static GpuMemory instance;
+		return instance;
+	}
+
+	GpuMemory(const GpuMemory&) = delete;
+	GpuMemory& operator=(const GpuMemory&) = delete;
+
+	/*
+	* Record the storage of a buffer, replacing what was recorded for it before.
+	* @param[in] buffer GL name.
+	* @param[in] category One of the buffer categories.
+	* @param[in] bytes
+	* @param[in] owner Subsystem that allocated it, a string literal.
+	* @return void
+	*/
+	void trackBuffer(unsigned int buffer, GpuCategory category, size_t bytes, const char *owner)
+	{
+		track(key(OBJECT_BUFFER, buffer), { category, 0, 0, 0, bytes, owner });
+	}
+
+	/*
+	* Record the storage of a texture, replacing what was recorded for it before.
+	* @param[in] texture GL name.
+	* @param[in] format Internal format, block-compressed ones included.
+	* @param[in] width Size of level 0.
+	* @param[in] height
+	* @param[in] layers Array layers or cube faces, 1 otherwise.
+	* @param[in] levels Mip levels allocated.
+	* @param[in] owner Subsystem that allocated it, a string literal.
+	* @param[in] category
+	* @param[in] samples Samples per texel of a multisample texture.
+	* @return void
+	*/
+	void trackTexture(unsigned int texture, GLenum format, int width, int height, int layers, int levels, const char *owner,
+		GpuCategory category = GPU_TEXTURES, int samples = 1)
+	{
+		size_t bytes = 0;
+		for (int level = 0; level < levels; level++)
+		{
+			bytes += levelBytes(format, std::max(1, width >> level), std::max(1, height >> level));
+		}
+		bytes *= static_cast<size_t>(std::max(1, layers)) * std::max(1, samples);
+		track(key(OBJECT_TEXTURE, texture), { category, format, width, height, bytes, owner });
+	}
+
+	/*
+	* Record the storage of a renderbuffer, replacing what was recorded for it before.
+	* @param[in] renderbuffer GL name.
+	* @param[in] format Internal format.
+	* @param[in] width
+	* @param[in] height
+	* @param[in] samples 0 or 1 for a single sampled one.
+	* @param[in] owner Subsystem that allocated it, a string literal.
+	* @return void
+	*/
+	void trackRenderbuffer(unsigned int renderbuffer, GLenum format, int width, int height, int samples, const char *owner)
+	{
+		const size_t bytes = levelBytes(format, width, height) * std::max(1, samples);
+		track(key(OBJECT_RENDERBUFFER, renderbuffer), { samples > 1 ? GPU_MULTISAMPLE : GPU_RENDER_TARGETS, format, width, height, bytes, owner });
+	}
+
+	// Forget objects that are about to be deleted; unknown names are ignored.
+	void releaseBuffer(unsigned int buffer)
+	{
+		release(key(OBJECT_BUFFER, buffer));
+	}
+
+	void releaseTexture(unsigned int texture)
+	{
+		release(key(OBJECT_TEXTURE, texture));
+	}
+
+	void releaseRenderbuffer(unsigned int renderbuffer)
+	{
+		release(key(OBJECT_RENDERBUFFER, renderbuffer));
+	}
+
+	/*
+	* Set the memory the tracked objects may take before eviction callbacks run.
+	* @param[in] bytes 0 turns the budget off.
+	* @return void
+	*/
+	void setBudget(size_t bytes)
+	{
+		budget = bytes;
+	}
+
+	/*
+	* Add a way to free memory under pressure.
+	* @param[in] evict Takes the number of bytes the total is over budget by.
+	* @return void
+	*/
+	void addEvictionCallback(std::function<void(size_t)> evict)
+	{
+		evictors.push_back(std::move(evict));
+	}
+
+	/*
+	* Add a way to take memory back once the pressure is gone.
+	* @param[in] relieve Takes the number of bytes the total is under budget by.
+	* @return void
+	*/
+	void addReliefCallback(std::function<void(size_t)> relieve)
+	{
+		relievers.push_back(std::move(relieve));
+	}
+
+	// Enforce the budget. Call once per frame.
+	void update()
+	{
+		if (budget == 0 || total <= budget)
+		{
+			overBudget = false;
+			for (const std::function<void(size_t)> &relieve : relievers)
+			{
+				relieve(budget == 0 ? SIZE_MAX : budget - total);
+			}
+			return;
+		}
+		evictionRuns++;
+		for (const std::function<void(size_t)> &evict : evictors)
+		{
+			evict(total - budget);
+			if (total <= budget)
+			{
+				break;
+			}
+		}
+		const bool over = total > budget;
+		if (over && !overBudget)
+		{
+			std::cout << "GPU_MEMORY::OVER_BUDGET " << total << "/" << budget << std::endl;
+		}
+		overBudget = over;
+	}
+
+	Stats stats() const
+	{
+		Stats result = {};
+		for (const auto &entry : records)
+		{
+			result.objects[entry.second.category]++;
+			result.bytes[entry.second.category] += entry.second.bytes;
+		}
+		result.total = total;
+		result.peak = peak;
+		result.budget = budget;
+		result.evictionRuns = evictionRuns;
+		result.overBudget = overBudget;
+		return result;
+	}
+
+	/*
+	* Ask the driver through GL_NVX_gpu_memory_info or GL_ATI_meminfo. Needs a current GL context.
+	* @return DriverMemory, with a null source if neither extension is there.
+	*/
+	DriverMemory queryDriver() const
+	{
+		DriverMemory memory = {};
+		if (glfwExtensionSupported("GL_NVX_gpu_memory_info"))
+		{
+			GLint total = 0, available = 0, evictions = 0, evicted = 0;
+			glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &total);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_EVICTION_COUNT_NVX, &evictions);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_EVICTED_MEMORY_NVX, &evicted);
+			// the extension counts in kilobytes
+			memory = { "NVX", static_cast<size_t>(total) << 10, static_cast<size_t>(available) << 10,
+				static_cast<size_t>(evictions), static_cast<size_t>(evicted) << 10 };
+		}
+		else if (glfwExtensionSupported("GL_ATI_meminfo"))
+		{
+			// total free, largest free block, total auxiliary free, largest auxiliary block, in kilobytes
+			GLint free[4] = {};
+			glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, free);
+			memory = { "ATI", 0, static_cast<size_t>(free[0]) << 10, 0, 0 };
+		}
+		return memory;
+	}
+
+	// Print the live breakdown by category and owner, and the driver's view next to it.
+	void printReport() const
+	{
+		static const char *names[GPU_CATEGORY_COUNT] = { "VERTEX_BUFFERS", "INDEX_BUFFERS", "UNIFORM_BUFFERS", "STAGING_BUFFERS",
+			"TEXTURES", "RENDER_TARGETS", "MULTISAMPLE" };
+		const Stats current = stats();
+		for (int category = 0; category < GPU_CATEGORY_COUNT; category++)
+		{
+			std::cout << "GPU_MEMORY::" << names[category] << " OBJECTS " << current.objects[category]
+				<< " BYTES " << current.bytes[category] << std::endl;
+		}
+		std::map<std::string, size_t> owners;
+		for (const auto &entry : records)
+		{
+			owners[entry.second.owner] += entry.second.bytes;
+		}
+		for (const auto &owner : owners)
+		{
+			std::cout << "GPU_MEMORY::OWNER " << owner.first << " BYTES " << owner.second << std::endl;
+		}
+		std::cout << "GPU_MEMORY::TOTAL " << current.total << " PEAK " << current.peak << " BUDGET " << current.budget
+			<< " EVICTION_RUNS " << current.evictionRuns << std::endl;
+
+		const DriverMemory driver = queryDriver();
+		if (driver.source)
+		{
+			std::cout << "GPU_MEMORY::DRIVER " << driver.source << " TOTAL " << driver.totalBytes << " FREE " << driver.freeBytes;
+			if (driver.totalBytes > 0)
+			{
+				// everything else on the device, other processes and the window's own buffers included
+				std::cout << " USED " << driver.totalBytes - driver.freeBytes << " UNTRACKED "
+					<< static_cast<long long>(driver.totalBytes - driver.freeBytes) - static_cast<long long>(current.total);
+			}
+			std::cout << " EVICTIONS " << driver.evictions << " EVICTED " << driver.evictedBytes << std::endl;
+		}
+	}
+
+	/*
+	* Bytes of one image of a format.
+	* @param[in] format Internal format.
+	* @param[in] width
+	* @param[in] height
+	* @return size_t
+	*/
+	static size_t levelBytes(GLenum format, int width, int height)
+	{
+		const size_t blockBytes = compressedBlockBytes(format);
+		if (blockBytes != 0)
+		{
+			return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+		}
+		return static_cast<size_t>(width) * height * texelBytes(format);
+	}
+
+private:
+	enum ObjectType
+	{
+		OBJECT_BUFFER = 1,
+		OBJECT_TEXTURE,
+		OBJECT_RENDERBUFFER
+	};
+
+	struct Record
+	{
+		GpuCategory category;
+		GLenum format;		// 0 for buffers
+		int width;
+		int height;
+		size_t bytes;
+		const char *owner;
+	};
+
+	// GL names are only unique per object type
+	std::unordered_map<uint64_t, Record> records;
+	std::vector<std::function<void(size_t)>> evictors;
+	std::vector<std::function<void(size_t)>> relievers;
+	size_t total = 0;
+	size_t peak = 0;
+	size_t budget = 0;
+	size_t evictionRuns = 0;
+	bool overBudget = false;
+
+	GpuMemory() = default;
+
+	static uint64_t key(ObjectType type, unsigned int name)
+	{
+		return static_cast<uint64_t>(type) << 32 | name;
+	}
+
+	void track(uint64_t object, const Record &record)
+	{
+		if (static_cast<unsigned int>(object) == 0)
+		{
+			return;
+		}
+		release(object);
+		records[object] = record;
+		total += record.bytes;
+		peak = std::max(peak, total);
+	}
+
+	void release(uint64_t object)
+	{
+		auto found = records.find(object);
+		if (found != records.end())
+		{
+			total -= found->second.bytes;
+			records.erase(found);
+		}
+	}
+
+	static size_t compressedBlockBytes(GLenum format)
+	{
+		switch (format)
+		{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RED_RGTC1:
+		case GL_COMPRESSED_SIGNED_RED_RGTC1:
+			return 8;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		case GL_COMPRESSED_RG_RGTC2:
+		case GL_COMPRESSED_SIGNED_RG_RGTC2:
+		case GL_COMPRESSED_RGBA_BPTC_UNORM:
+		case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+			return 16;
+		default:
+			return 0;
+		}
+	}
+
+	static size_t texelBytes(GLenum format)
+	{
+		switch (format)
+		{
+		case GL_RED:
+		case GL_R8:
+			return 1;
+		case GL_RG:
+		case GL_RG8:
+		case GL_R16F:
+			return 2;
+		case GL_RG16F:
+		case GL_RG16UI:
+		case GL_R32F:
+		case GL_DEPTH_COMPONENT24:
+		case GL_DEPTH24_STENCIL8:
+		case GL_DEPTH_COMPONENT32F:
+			return 4;
+		case GL_RGB16F:
+		case GL_RGBA16F:
+		case GL_RG32F:
+			return 8;
+		case GL_RGB32F:
+		case GL_RGBA32F:
+			return 16;
+		default:
+			// RGB, RGBA and their sized and sRGB variants
+			return 4;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef HASH_H
+#define HASH_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+/*
+* 64-bit FNV-1a hash of a block of memory. Pass a previous result as seed to hash several blocks as one.
+* @param[in] data Bytes to hash.
+* @param[in] size Number of bytes.
+* @param[in] seed Running hash value.
+* @return uint64_t
+*/
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = FNV_OFFSET_BASIS)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+inline uint64_t hashString(const std::string& str, uint64_t seed = FNV_OFFSET_BASIS)
+{
+	return hashBytes(str.data(), str.size(), seed);
+}
+
+/*
+* Same hash as hashString for a null-terminated string, usable in constant expressions so string literals
+* can be hashed at compile time.
+* @param[in] str
+* @param[in] seed Running hash value.
+* @return uint64_t
+*/
+constexpr uint64_t hashLiteral(const char* str, uint64_t seed = FNV_OFFSET_BASIS)
+{
+	uint64_t hash = seed;
+	for (; *str != '\0'; str++)
+	{
+		hash ^= static_cast<unsigned char>(*str);
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+#endif
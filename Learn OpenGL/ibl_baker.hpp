@@ -0,0 +1,804 @@
+#ifndef IBL_BAKER_H
+#define IBL_BAKER_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gpu_memory.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "mipmap.hpp"
+#include "shader.hpp"
+#include "stb_image.h"
+#include "thread_pool.hpp"
+
+// Image-based lighting baked on the CPU from the skybox, given as its six faces or as one equirectangular
+// image (HDR or not): nine spherical harmonics coefficients for diffuse light, a cube map whose mip levels
+// hold the environment prefiltered with GGX lobes of increasing roughness, and the split-sum BRDF table
+// that turns a prefiltered sample into specular light. Baking needs no GL context, so build machines can
+// run it with --bake-ibl. The result is cached in CACHE_DIRECTORY under the hash of the source files, and
+// at runtime the lighting costs a few texture fetches (see cube.frag).
+namespace IblBaker
+{
+	const char MAGIC[4] = { 'L', 'O', 'I', 'B' };
+	const uint32_t VERSION = 1;
+	const char CACHE_DIRECTORY[] = "ibl_cache";
+	const int MAX_SOURCE_SIZE = 512;	// sources are box filtered down to faces no larger than this
+	const int PREFILTER_SIZE = 128;
+	const int PREFILTER_LEVELS = 6;		// 128 down to 4, roughness 0 to 1
+	const int PREFILTER_SAMPLES = 256;
+	const int SH_SIZE = 64;				// face size the harmonics are projected from
+	const int LUT_SIZE = 128;
+	const int LUT_SAMPLES = 512;
+	const int PREFILTERED_UNIT = 14;	// texture units of the lighting, clear of the material textures
+	const int BRDF_UNIT = 15;
+	const float PI = 3.14159265358979f;
+
+	// Cube map of linear RGBA floats, faces in GL order (+X, -X, +Y, -Y, +Z, -Z) with rows as GL stores them.
+	struct Cube
+	{
+		int size = 0;
+		std::vector<float> texels;
+
+		explicit Cube(int size = 0) : size(size), texels(static_cast<size_t>(6) * size * size * 4, 0.0f)
+		{
+		}
+
+		float *texel(int face, int x, int y)
+		{
+			return texels.data() + ((static_cast<size_t>(face) * size + y) * size + x) * 4;
+		}
+
+		const float *texel(int face, int x, int y) const
+		{
+			return texels.data() + ((static_cast<size_t>(face) * size + y) * size + x) * 4;
+		}
+	};
+
+	struct Environment
+	{
+		uint64_t sourceKey = 0;
+		glm::vec3 sh[9];				// irradiance over pi, so diffuse light is the albedo times their sum
+		std::vector<Cube> prefiltered;	// level 0 is the mirror reflection
+		std::vector<float> brdfLut;		// LUT_SIZE squared (scale, bias) pairs for F0; rows by roughness, columns by N.V
+	};
+
+	// GL side of an uploaded Environment; empty when there is none.
+	struct Lighting
+	{
+		unsigned int prefiltered = 0;
+		unsigned int brdfLut = 0;
+		int levels = 0;
+		glm::vec3 sh[9];
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceKey;
+		uint32_t size;
+		uint32_t levels;
+		uint32_t lutSize;
+		uint32_t reserved;
+		float sh[27];
+	};
+
+	// add weight times an RGBA texel to sum
+	inline void accumulate(float *sum, const float *texel, float weight)
+	{
+#if defined(MIPMAP_SSE2)
+		_mm_storeu_ps(sum, _mm_add_ps(_mm_loadu_ps(sum), _mm_mul_ps(_mm_loadu_ps(texel), _mm_set1_ps(weight))));
+#elif defined(MIPMAP_NEON)
+		vst1q_f32(sum, vmlaq_n_f32(vld1q_f32(sum), vld1q_f32(texel), weight));
+#else
+		for (int c = 0; c < 4; c++)
+			sum[c] += texel[c] * weight;
+#endif
+	}
+
+	// direction through a point of a face, sc and tc in [-1, 1]
+	inline glm::vec3 faceDirection(int face, float sc, float tc)
+	{
+		switch (face)
+		{
+		case 0: return glm::vec3(1.0f, -tc, -sc);
+		case 1: return glm::vec3(-1.0f, -tc, sc);
+		case 2: return glm::vec3(sc, 1.0f, tc);
+		case 3: return glm::vec3(sc, -1.0f, -tc);
+		case 4: return glm::vec3(sc, -tc, 1.0f);
+		default: return glm::vec3(-sc, -tc, -1.0f);
+		}
+	}
+
+	// face a direction points at and where, s and t in [0, 1], by the selection rules of GL cube maps
+	inline int faceOf(const glm::vec3 &direction, float &s, float &t)
+	{
+		const float x = std::abs(direction.x), y = std::abs(direction.y), z = std::abs(direction.z);
+		int face;
+		float sc, tc, major;
+		if (x >= y && x >= z)
+		{
+			major = x;
+			face = direction.x > 0.0f ? 0 : 1;
+			sc = direction.x > 0.0f ? -direction.z : direction.z;
+			tc = -direction.y;
+		}
+		else if (y >= z)
+		{
+			major = y;
+			face = direction.y > 0.0f ? 2 : 3;
+			sc = direction.x;
+			tc = direction.y > 0.0f ? direction.z : -direction.z;
+		}
+		else
+		{
+			major = z;
+			face = direction.z > 0.0f ? 4 : 5;
+			sc = direction.z > 0.0f ? direction.x : -direction.x;
+			tc = -direction.y;
+		}
+		s = 0.5f * (sc / major + 1.0f);
+		t = 0.5f * (tc / major + 1.0f);
+		return face;
+	}
+
+	// bilinear sample within one face, clamped at its edges
+	inline void sampleFace(const Cube &cube, int face, float s, float t, float *out)
+	{
+		const float x = std::min(std::max(s * cube.size - 0.5f, 0.0f), cube.size - 1.0f);
+		const float y = std::min(std::max(t * cube.size - 0.5f, 0.0f), cube.size - 1.0f);
+		const int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+		const int x1 = std::min(x0 + 1, cube.size - 1), y1 = std::min(y0 + 1, cube.size - 1);
+		const float fx = x - x0, fy = y - y0;
+		std::fill(out, out + 4, 0.0f);
+		accumulate(out, cube.texel(face, x0, y0), (1.0f - fx) * (1.0f - fy));
+		accumulate(out, cube.texel(face, x1, y0), fx * (1.0f - fy));
+		accumulate(out, cube.texel(face, x0, y1), (1.0f - fx) * fy);
+		accumulate(out, cube.texel(face, x1, y1), fx * fy);
+	}
+
+	// trilinear sample of a cube map's mip chain
+	inline void sampleChain(const std::vector<Cube> &chain, const glm::vec3 &direction, float mip, float *out)
+	{
+		mip = std::min(std::max(mip, 0.0f), static_cast<float>(chain.size() - 1));
+		const int fine = static_cast<int>(mip);
+		const float blend = mip - fine;
+		float s, t;
+		const int face = faceOf(direction, s, t);
+		sampleFace(chain[fine], face, s, t, out);
+		if (blend > 0.0f && fine + 1 < static_cast<int>(chain.size()))
+		{
+			float coarse[4];
+			sampleFace(chain[fine + 1], face, s, t, coarse);
+			for (int c = 0; c < 4; c++)
+				out[c] += (coarse[c] - out[c]) * blend;
+		}
+	}
+
+	inline Cube downsample(const Cube &cube)
+	{
+		Cube half(std::max(1, cube.size / 2));
+		for (int face = 0; face < 6; face++)
+		{
+			for (int y = 0; y < half.size; y++)
+			{
+				for (int x = 0; x < half.size; x++)
+				{
+					const int x0 = std::min(2 * x, cube.size - 1), x1 = std::min(2 * x + 1, cube.size - 1);
+					const int y0 = std::min(2 * y, cube.size - 1), y1 = std::min(2 * y + 1, cube.size - 1);
+					float *out = half.texel(face, x, y);
+					accumulate(out, cube.texel(face, x0, y0), 0.25f);
+					accumulate(out, cube.texel(face, x1, y0), 0.25f);
+					accumulate(out, cube.texel(face, x0, y1), 0.25f);
+					accumulate(out, cube.texel(face, x1, y1), 0.25f);
+				}
+			}
+		}
+		return half;
+	}
+
+	/*
+	* Decode an image into linear RGBA floats, box filtered by a whole factor until it is no wider than maxWidth.
+	* LDR images are taken to be sRGB. Safe to call from any thread.
+	* @param[in] path
+	* @param[in] maxWidth
+	* @param[out] width
+	* @param[out] height
+	* @param[out] texels
+	* @return false if the image could not be decoded.
+	*/
+	inline bool loadLinear(const std::string &path, int maxWidth, int &width, int &height, std::vector<float> &texels)
+	{
+		stbi_set_flip_vertically_on_load_thread(false);
+		int sourceWidth, sourceHeight, components;
+		const bool hdr = stbi_is_hdr(path.c_str()) != 0;
+		std::unique_ptr<float, void(*)(void*)> floats(nullptr, stbi_image_free);
+		std::unique_ptr<unsigned char, void(*)(void*)> bytes(nullptr, stbi_image_free);
+		if (hdr)
+			floats.reset(stbi_loadf(path.c_str(), &sourceWidth, &sourceHeight, &components, 3));
+		else
+			bytes.reset(stbi_load(path.c_str(), &sourceWidth, &sourceHeight, &components, 3));
+		if (!floats && !bytes)
+		{
+			return false;
+		}
+
+		const int factor = std::max(1, (sourceWidth + maxWidth - 1) / maxWidth);
+		width = std::max(1, sourceWidth / factor);
+		height = std::max(1, sourceHeight / factor);
+		texels.assign(static_cast<size_t>(width) * height * 4, 0.0f);
+		const float *decode = Mipmap::srgbToLinearTable();
+		const float weight = 1.0f / (factor * factor);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				float *out = texels.data() + (static_cast<size_t>(y) * width + x) * 4;
+				for (int dy = 0; dy < factor; dy++)
+				{
+					const size_t row = static_cast<size_t>(std::min(y * factor + dy, sourceHeight - 1)) * sourceWidth;
+					for (int dx = 0; dx < factor; dx++)
+					{
+						const size_t index = (row + std::min(x * factor + dx, sourceWidth - 1)) * 3;
+						for (int c = 0; c < 3; c++)
+							out[c] += (hdr ? floats.get()[index + c] : decode[bytes.get()[index + c]]) * weight;
+					}
+				}
+				out[3] = 1.0f;
+			}
+		}
+		return true;
+	}
+
+	// six square faces of the same size, in GL order, decoded on the worker pool
+	inline bool loadFaces(const std::vector<std::string> &faces, Cube &cube)
+	{
+		struct Face
+		{
+			bool loaded;
+			int width;
+			int height;
+			std::vector<float> texels;
+		};
+		std::vector<std::future<Face>> decoding;
+		for (const std::string &path : faces)
+		{
+			decoding.push_back(ThreadPool::shared().submit([path]
+			{
+				Face face;
+				face.loaded = loadLinear(path, MAX_SOURCE_SIZE, face.width, face.height, face.texels);
+				return face;
+			}));
+		}
+		std::vector<Face> loaded;
+		bool complete = true;
+		for (size_t i = 0; i < decoding.size(); i++)
+		{
+			loaded.push_back(decoding[i].get());
+			if (!loaded[i].loaded)
+			{
+				std::cout << "ERROR::IBL_BAKER::SOURCE_NOT_LOADED: " << faces[i] << std::endl;
+				complete = false;
+			}
+			else if (loaded[i].width != loaded[i].height || loaded[i].width != loaded[0].width)
+			{
+				std::cout << "ERROR::IBL_BAKER::FACE_SIZE_MISMATCH: " << faces[i] << std::endl;
+				complete = false;
+			}
+		}
+		if (!complete)
+		{
+			return false;
+		}
+		cube = Cube(loaded[0].width);
+		for (int face = 0; face < 6; face++)
+		{
+			std::copy(loaded[face].texels.begin(), loaded[face].texels.end(), cube.texel(face, 0, 0));
+		}
+		return true;
+	}
+
+	// resample an equirectangular image, +Y at the top row, into a cube a quarter of its width
+	inline bool loadEquirect(const std::string &path, Cube &cube)
+	{
+		int width, height;
+		std::vector<float> texels;
+		if (!loadLinear(path, 4 * MAX_SOURCE_SIZE, width, height, texels))
+		{
+			std::cout << "ERROR::IBL_BAKER::SOURCE_NOT_LOADED: " << path << std::endl;
+			return false;
+		}
+		cube = Cube(std::max(1, std::min(MAX_SOURCE_SIZE, width / 4)));
+		const int size = cube.size;
+		Mipmap::forRows(6 * size, true, [&](int first, int last)
+		{
+			for (int row = first; row < last; row++)
+			{
+				const int face = row / size, y = row % size;
+				for (int x = 0; x < size; x++)
+				{
+					const glm::vec3 direction = glm::normalize(faceDirection(face, (2.0f * x + 1.0f) / size - 1.0f, (2.0f * y + 1.0f) / size - 1.0f));
+					const float u = (std::atan2(direction.z, direction.x) / (2.0f * PI) + 0.5f) * width - 0.5f;
+					const float v = std::min(std::max(std::acos(std::min(std::max(direction.y, -1.0f), 1.0f)) / PI * height - 0.5f, 0.0f), height - 1.0f);
+					const int u0 = static_cast<int>(std::floor(u)), v0 = static_cast<int>(v);
+					const int v1 = std::min(v0 + 1, height - 1);
+					const float fu = u - u0, fv = v - v0;
+					// columns wrap around the seam
+					const int left = (u0 % width + width) % width, right = (left + 1) % width;
+					float *out = cube.texel(face, x, y);
+					accumulate(out, texels.data() + (static_cast<size_t>(v0) * width + left) * 4, (1.0f - fu) * (1.0f - fv));
+					accumulate(out, texels.data() + (static_cast<size_t>(v0) * width + right) * 4, fu * (1.0f - fv));
+					accumulate(out, texels.data() + (static_cast<size_t>(v1) * width + left) * 4, (1.0f - fu) * fv);
+					accumulate(out, texels.data() + (static_cast<size_t>(v1) * width + right) * 4, fu * fv);
+				}
+			}
+		});
+		return true;
+	}
+
+	/*
+	* Project the environment onto the first nine spherical harmonics and convolve them with the cosine lobe.
+	* @param[in] chain Mip chain of the source cube.
+	* @param[out] sh Irradiance coefficients divided by pi, in the order l0, l1 (y, z, x), l2 (xy, yz, 3z^2 - 1, xz, x^2 - y^2).
+	* @return void
+	*/
+	inline void projectHarmonics(const std::vector<Cube> &chain, glm::vec3 sh[9])
+	{
+		size_t level = 0;
+		while (level + 1 < chain.size() && chain[level].size > SH_SIZE)
+			level++;
+		const Cube &cube = chain[level];
+		double sums[9][3] = {};
+		double totalWeight = 0.0;
+		for (int face = 0; face < 6; face++)
+		{
+			for (int y = 0; y < cube.size; y++)
+			{
+				for (int x = 0; x < cube.size; x++)
+				{
+					const float sc = (2.0f * x + 1.0f) / cube.size - 1.0f, tc = (2.0f * y + 1.0f) / cube.size - 1.0f;
+					const glm::vec3 n = glm::normalize(faceDirection(face, sc, tc));
+					// solid angle of the texel
+					const float weight = 4.0f / (cube.size * cube.size * std::pow(1.0f + sc * sc + tc * tc, 1.5f));
+					const float basis[9] = { 0.282095f, 0.488603f * n.y, 0.488603f * n.z, 0.488603f * n.x,
+						1.092548f * n.x * n.y, 1.092548f * n.y * n.z, 0.315392f * (3.0f * n.z * n.z - 1.0f),
+						1.092548f * n.x * n.z, 0.546274f * (n.x * n.x - n.y * n.y) };
+					const float *texel = cube.texel(face, x, y);
+					for (int i = 0; i < 9; i++)
+						for (int c = 0; c < 3; c++)
+							sums[i][c] += texel[c] * basis[i] * weight;
+					totalWeight += weight;
+				}
+			}
+		}
+		// cosine lobe bands A0 = pi, A1 = 2 pi / 3, A2 = pi / 4, divided by pi; the texel solid angles are
+		// renormalized to the whole sphere
+		const double band[9] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+		const double scale = 4.0 * PI / totalWeight;
+		for (int i = 0; i < 9; i++)
+			sh[i] = glm::vec3(static_cast<float>(sums[i][0] * band[i] * scale), static_cast<float>(sums[i][1] * band[i] * scale),
+				static_cast<float>(sums[i][2] * band[i] * scale));
+	}
+
+	inline glm::vec2 hammersley(uint32_t i, uint32_t count)
+	{
+		uint32_t bits = i;
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return glm::vec2(static_cast<float>(i) / count, bits * 2.3283064365386963e-10f);
+	}
+
+	// GGX half vector around +Z; alpha is roughness squared
+	inline glm::vec3 importanceSampleGgx(const glm::vec2 &xi, float roughness)
+	{
+		const float alpha = roughness * roughness;
+		const float phi = 2.0f * PI * xi.x;
+		const float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+		const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+		return glm::vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+	}
+
+	/*
+	* Prefilter the environment for every roughness level, on the worker pool. Each sample reads the source
+	* mip whose texels cover the solid angle the sample stands for, which keeps few samples free of noise.
+	* @param[in] chain Mip chain of the source cube.
+	* @param[out] levels PREFILTER_LEVELS cubes from PREFILTER_SIZE down.
+	* @return void
+	*/
+	inline void prefilter(const std::vector<Cube> &chain, std::vector<Cube> &levels)
+	{
+		levels.clear();
+		const float sourceTexel = 4.0f * PI / (6.0f * chain[0].size * chain[0].size);
+		for (int level = 0; level < PREFILTER_LEVELS; level++)
+		{
+			Cube cube(std::max(1, PREFILTER_SIZE >> level));
+			const int size = cube.size;
+			const float roughness = static_cast<float>(level) / (PREFILTER_LEVELS - 1);
+
+			// light directions around a +Z normal with N = V, turned into each texel's frame below
+			std::vector<float> sampleX, sampleY, sampleZ, sampleMip;
+			if (level == 0)
+			{
+				sampleX.push_back(0.0f);
+				sampleY.push_back(0.0f);
+				sampleZ.push_back(1.0f);
+				sampleMip.push_back(std::max(0.0f, std::log2(static_cast<float>(chain[0].size) / size)));
+			}
+			else
+			{
+				const float alpha2 = roughness * roughness * roughness * roughness;
+				for (uint32_t i = 0; i < static_cast<uint32_t>(PREFILTER_SAMPLES); i++)
+				{
+					const glm::vec3 h = importanceSampleGgx(hammersley(i, PREFILTER_SAMPLES), roughness);
+					const float lightZ = 2.0f * h.z * h.z - 1.0f;
+					if (lightZ <= 0.0f)
+					{
+						continue;
+					}
+					// pdf of the light direction is D / 4 when N = V
+					const float denominator = h.z * h.z * (alpha2 - 1.0f) + 1.0f;
+					const float pdf = alpha2 / (PI * denominator * denominator) / 4.0f;
+					const float sampleSolidAngle = 1.0f / (PREFILTER_SAMPLES * pdf);
+					sampleX.push_back(2.0f * h.z * h.x);
+					sampleY.push_back(2.0f * h.z * h.y);
+					sampleZ.push_back(lightZ);
+					sampleMip.push_back(std::max(0.0f, 0.5f * std::log2(sampleSolidAngle / sourceTexel) + 1.0f));
+				}
+			}
+			const size_t count = sampleZ.size();
+			float totalWeight = 0.0f;
+			for (float weight : sampleZ)
+				totalWeight += weight;
+
+			Mipmap::forRows(6 * size, true, [&](int first, int last)
+			{
+				std::vector<float> directionX(count), directionY(count), directionZ(count);
+				for (int row = first; row < last; row++)
+				{
+					const int face = row / size, y = row % size;
+					for (int x = 0; x < size; x++)
+					{
+						const glm::vec3 n = glm::normalize(faceDirection(face, (2.0f * x + 1.0f) / size - 1.0f, (2.0f * y + 1.0f) / size - 1.0f));
+						const glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+						const glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+						const glm::vec3 bitangent = glm::cross(n, tangent);
+						// a plain loop over the sample arrays, which the compiler vectorizes
+						for (size_t i = 0; i < count; i++)
+						{
+							directionX[i] = tangent.x * sampleX[i] + bitangent.x * sampleY[i] + n.x * sampleZ[i];
+							directionY[i] = tangent.y * sampleX[i] + bitangent.y * sampleY[i] + n.y * sampleZ[i];
+							directionZ[i] = tangent.z * sampleX[i] + bitangent.z * sampleY[i] + n.z * sampleZ[i];
+						}
+						float sum[4] = {};
+						for (size_t i = 0; i < count; i++)
+						{
+							float radiance[4];
+							sampleChain(chain, glm::vec3(directionX[i], directionY[i], directionZ[i]), sampleMip[i], radiance);
+							accumulate(sum, radiance, sampleZ[i]);
+						}
+						float *out = cube.texel(face, x, y);
+						for (int c = 0; c < 3; c++)
+							out[c] = sum[c] / totalWeight;
+						out[3] = 1.0f;
+					}
+				}
+			});
+			levels.push_back(std::move(cube));
+		}
+	}
+
+	/*
+	* Integrate the split-sum BRDF table: the scale and bias to F0 of GGX specular under uniform white light,
+	* with Smith visibility for image-based lighting (k = roughness^2 / 2). Runs on the worker pool.
+	* @return LUT_SIZE squared (scale, bias) pairs; rows by roughness, columns by N.V.
+	*/
+	inline std::vector<float> integrateBrdf()
+	{
+		std::vector<float> lut(static_cast<size_t>(LUT_SIZE) * LUT_SIZE * 2);
+		Mipmap::forRows(LUT_SIZE, true, [&](int first, int last)
+		{
+			for (int row = first; row < last; row++)
+			{
+				const float roughness = (row + 0.5f) / LUT_SIZE;
+				const float k = roughness * roughness / 2.0f;
+				for (int column = 0; column < LUT_SIZE; column++)
+				{
+					const float NdotV = (column + 0.5f) / LUT_SIZE;
+					const glm::vec3 v(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+					float scale = 0.0f, bias = 0.0f;
+					for (uint32_t i = 0; i < static_cast<uint32_t>(LUT_SAMPLES); i++)
+					{
+						const glm::vec3 h = importanceSampleGgx(hammersley(i, LUT_SAMPLES), roughness);
+						const float VdotH = glm::dot(v, h);
+						const glm::vec3 l = 2.0f * VdotH * h - v;
+						const float NdotL = l.z;
+						if (NdotL <= 0.0f || VdotH <= 0.0f)
+						{
+							continue;
+						}
+						const float visibility = NdotV / (NdotV * (1.0f - k) + k) * NdotL / (NdotL * (1.0f - k) + k);
+						const float weight = visibility * VdotH / (h.z * NdotV);
+						const float fresnel = std::pow(1.0f - VdotH, 5.0f);
+						scale += (1.0f - fresnel) * weight;
+						bias += fresnel * weight;
+					}
+					lut[(static_cast<size_t>(row) * LUT_SIZE + column) * 2] = scale / LUT_SAMPLES;
+					lut[(static_cast<size_t>(row) * LUT_SIZE + column) * 2 + 1] = bias / LUT_SAMPLES;
+				}
+			}
+		});
+		return lut;
+	}
+
+	/*
+	* Hash of the source files together with the bake settings.
+	* @param[in] sources
+	* @param[out] key
+	* @return false if a source cannot be read.
+	*/
+	inline bool sourceKey(const std::vector<std::string> &sources, uint64_t &key)
+	{
+		const int settings[] = { static_cast<int>(VERSION), MAX_SOURCE_SIZE, PREFILTER_SIZE, PREFILTER_LEVELS, PREFILTER_SAMPLES, SH_SIZE, LUT_SIZE, LUT_SAMPLES };
+		key = hashBytes(settings, sizeof(settings));
+		for (const std::string &source : sources)
+		{
+			MappedFile file;
+			if (!file.open(source))
+			{
+				std::cout << "ERROR::IBL_BAKER::SOURCE_NOT_FOUND: " << source << std::endl;
+				return false;
+			}
+			key = hashBytes(file.data(), file.size(), key);
+		}
+		return true;
+	}
+
+	inline std::string cachePathFor(uint64_t key)
+	{
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+		return std::string(CACHE_DIRECTORY) + "/" + name + ".ibl";
+	}
+
+	/*
+	* Read a baked environment.
+	* @param[in] path
+	* @param[in] key Source key it has to have been baked from.
+	* @param[out] environment
+	* @return false if the file is missing, stale or malformed.
+	*/
+	inline bool readCache(const std::string &path, uint64_t key, Environment &environment)
+	{
+		std::error_code error;
+		MappedFile file;
+		if (!std::filesystem::exists(path, error) || !file.open(path) || file.size() < sizeof(Header))
+		{
+			return false;
+		}
+		Header header;
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.sourceKey != key ||
+			header.size != static_cast<uint32_t>(PREFILTER_SIZE) || header.levels != static_cast<uint32_t>(PREFILTER_LEVELS) ||
+			header.lutSize != static_cast<uint32_t>(LUT_SIZE))
+		{
+			return false;
+		}
+		size_t expected = sizeof(Header) + static_cast<size_t>(LUT_SIZE) * LUT_SIZE * 2 * sizeof(float);
+		for (int level = 0; level < PREFILTER_LEVELS; level++)
+			expected += Cube(std::max(1, PREFILTER_SIZE >> level)).texels.size() * sizeof(float);
+		if (file.size() != expected)
+		{
+			return false;
+		}
+
+		const unsigned char *data = file.data() + sizeof(Header);
+		environment.sourceKey = key;
+		for (int i = 0; i < 9; i++)
+			environment.sh[i] = glm::vec3(header.sh[i * 3], header.sh[i * 3 + 1], header.sh[i * 3 + 2]);
+		environment.prefiltered.clear();
+		for (int level = 0; level < PREFILTER_LEVELS; level++)
+		{
+			Cube cube(std::max(1, PREFILTER_SIZE >> level));
+			std::memcpy(cube.texels.data(), data, cube.texels.size() * sizeof(float));
+			data += cube.texels.size() * sizeof(float);
+			environment.prefiltered.push_back(std::move(cube));
+		}
+		environment.brdfLut.resize(static_cast<size_t>(LUT_SIZE) * LUT_SIZE * 2);
+		std::memcpy(environment.brdfLut.data(), data, environment.brdfLut.size() * sizeof(float));
+		return true;
+	}
+
+	inline bool writeCache(const std::string &path, const Environment &environment)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(CACHE_DIRECTORY, error);
+		Header header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.sourceKey = environment.sourceKey;
+		header.size = PREFILTER_SIZE;
+		header.levels = static_cast<uint32_t>(environment.prefiltered.size());
+		header.lutSize = LUT_SIZE;
+		for (int i = 0; i < 9; i++)
+			for (int c = 0; c < 3; c++)
+				header.sh[i * 3 + c] = environment.sh[i][c];
+
+		// written under another name and renamed, so a reader never sees half a file
+		const std::string temporary = path + ".tmp";
+		{
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			for (const Cube &cube : environment.prefiltered)
+				out.write(reinterpret_cast<const char*>(cube.texels.data()), static_cast<std::streamsize>(cube.texels.size() * sizeof(float)));
+			out.write(reinterpret_cast<const char*>(environment.brdfLut.data()), static_cast<std::streamsize>(environment.brdfLut.size() * sizeof(float)));
+			if (!out)
+			{
+				out.close();
+				std::filesystem::remove(temporary, error);
+				std::cout << "ERROR::IBL_BAKER::WRITE_FAILED: " << path << std::endl;
+				return false;
+			}
+		}
+		std::filesystem::rename(temporary, path, error);
+		if (error)
+		{
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+		return true;
+	}
+
+	/*
+	* Bake the lighting of an environment, or read it from the cache when these sources were baked before.
+	* Runs on the worker pool, so do not call from a pool job.
+	* @param[in] sources Six cube faces in GL order, or one equirectangular image.
+	* @param[out] environment
+	* @return false if the sources could not be read.
+	*/
+	inline bool bake(const std::vector<std::string> &sources, Environment &environment)
+	{
+		if (sources.size() != 1 && sources.size() != 6)
+		{
+			std::cout << "ERROR::IBL_BAKER::SOURCE_COUNT: expected six faces or one equirectangular image, got " << sources.size() << std::endl;
+			return false;
+		}
+		uint64_t key;
+		if (!sourceKey(sources, key))
+		{
+			return false;
+		}
+		const std::string cachePath = cachePathFor(key);
+		if (readCache(cachePath, key, environment))
+		{
+			std::cout << "IBL_BAKER::CACHED " << cachePath << std::endl;
+			return true;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		std::vector<Cube> chain(1);
+		if (!(sources.size() == 6 ? loadFaces(sources, chain[0]) : loadEquirect(sources[0], chain[0])))
+		{
+			return false;
+		}
+		while (chain.back().size > 1)
+		{
+			chain.push_back(downsample(chain.back()));
+		}
+		environment.sourceKey = key;
+		projectHarmonics(chain, environment.sh);
+		prefilter(chain, environment.prefiltered);
+		environment.brdfLut = integrateBrdf();
+		writeCache(cachePath, environment);
+		const long long milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "IBL_BAKER::BAKED " << cachePath << " SOURCE " << chain[0].size << " LEVELS " << environment.prefiltered.size()
+			<< " MS " << milliseconds << std::endl;
+		return true;
+	}
+
+	/*
+	* Upload a baked environment. Needs a current GL context.
+	* @param[in] environment
+	* @return Lighting
+	*/
+	inline Lighting upload(const Environment &environment)
+	{
+		Lighting lighting;
+		lighting.levels = static_cast<int>(environment.prefiltered.size());
+		std::copy(environment.sh, environment.sh + 9, lighting.sh);
+
+		glGenTextures(1, &lighting.prefiltered);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, lighting.prefiltered);
+		for (int level = 0; level < lighting.levels; level++)
+		{
+			const Cube &cube = environment.prefiltered[level];
+			for (int face = 0; face < 6; face++)
+			{
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, cube.size, cube.size, 0, GL_RGBA, GL_FLOAT, cube.texel(face, 0, 0));
+			}
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, lighting.levels - 1);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		// the rough levels are only a few texels wide, filter across their edges
+		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+		GpuMemory::shared().trackTexture(lighting.prefiltered, GL_RGB16F, environment.prefiltered[0].size, environment.prefiltered[0].size, 6,
+			lighting.levels, "IblBaker");
+
+		glGenTextures(1, &lighting.brdfLut);
+		glBindTexture(GL_TEXTURE_2D, lighting.brdfLut);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, LUT_SIZE, LUT_SIZE, 0, GL_RG, GL_FLOAT, environment.brdfLut.data());
+		GpuMemory::shared().trackTexture(lighting.brdfLut, GL_RG16F, LUT_SIZE, LUT_SIZE, 1, 1, "IblBaker");
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		return lighting;
+	}
+
+	/*
+	* Bind the lighting to its texture units and point a shader at it. The sampler units are set even
+	* without lighting, since samplers of different types must not share a unit.
+	* @param[in] lighting Empty turns the environment term off.
+	* @param[in] shader Program with the uniforms of cube.frag.
+	* @return void
+	*/
+	inline void apply(const Lighting &lighting, Shader &shader)
+	{
+		shader.use();
+		shader.setInt("prefilteredEnvironment", PREFILTERED_UNIT);
+		shader.setInt("brdfLut", BRDF_UNIT);
+		shader.setBool("environmentLighting", lighting.prefiltered != 0);
+		if (lighting.prefiltered == 0)
+		{
+			return;
+		}
+		for (int i = 0; i < 9; i++)
+		{
+			shader.setVec3("irradianceSH[" + std::to_string(i) + "]", lighting.sh[i]);
+		}
+		shader.setFloat("prefilteredMaxLod", static_cast<float>(lighting.levels - 1));
+		glActiveTexture(GL_TEXTURE0 + PREFILTERED_UNIT);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, lighting.prefiltered);
+		glActiveTexture(GL_TEXTURE0 + BRDF_UNIT);
+		glBindTexture(GL_TEXTURE_2D, lighting.brdfLut);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	/*
+	* Command line front end: bake the given sources into the cache, for machines without a GPU.
+	* @param[in] argc
+	* @param[in] argv Arguments after the --bake-ibl switch: six faces in GL order or one equirectangular image.
+	* @return process exit code.
+	*/
+	inline int run(int argc, char *argv[])
+	{
+		Environment environment;
+		return bake(std::vector<std::string>(argv, argv + argc), environment) ? 0 : 1;
+	}
+}
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "block_compression.hpp"
+#include "mapped_file.hpp"
+
+// Reader and writer for the subset of KTX 2.0 the texture cook produces: one 2D image with a full mip
+// chain in a BCn format, no supercompression. Key/value entries carry the orientation, an optional
+// swizzle and whatever the writer wants to stamp the file with.
+namespace Ktx2
+{
+	const unsigned char IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	struct Header
+	{
+		unsigned char identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+	static_assert(sizeof(Header) == 80, "KTX2 header must match the file layout");
+
+	struct LevelIndex
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	// One mip level of an open file, pointing into the mapping.
+	struct Level
+	{
+		const unsigned char *data;
+		size_t size;
+		int width;
+		int height;
+	};
+
+	// A mapped KTX2 file. The level pointers stay valid across moves, until the image is destroyed.
+	struct Image
+	{
+		MappedFile file;
+		uint32_t vkFormat = 0;
+		int width = 0;
+		int height = 0;
+		std::vector<Level> levels;	// level 0 is the full size image
+		std::map<std::string, std::string> values;
+
+		/*
+		* Map and validate a file.
+		* @param[in] path
+		* @return false if the file is missing or not a plain 2D KTX2 file.
+		*/
+		bool open(const std::string &path)
+		{
+			levels.clear();
+			values.clear();
+			if (!file.open(path) || file.size() < sizeof(Header))
+			{
+				return false;
+			}
+			Header header;
+			std::memcpy(&header, file.data(), sizeof(Header));
+			if (std::memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) != 0 || header.supercompressionScheme != 0 ||
+				header.pixelDepth != 0 || header.layerCount != 0 || header.faceCount != 1 || header.levelCount == 0 ||
+				sizeof(Header) + header.levelCount * sizeof(LevelIndex) > file.size() ||
+				static_cast<uint64_t>(header.kvdByteOffset) + header.kvdByteLength > file.size())
+			{
+				std::cout << "ERROR::KTX2::UNSUPPORTED_FILE: " << path << std::endl;
+				return false;
+			}
+			vkFormat = header.vkFormat;
+			width = static_cast<int>(header.pixelWidth);
+			height = static_cast<int>(header.pixelHeight);
+
+			for (uint32_t i = 0; i < header.levelCount; i++)
+			{
+				LevelIndex index;
+				std::memcpy(&index, file.data() + sizeof(Header) + i * sizeof(LevelIndex), sizeof(LevelIndex));
+				if (index.byteOffset + index.byteLength > file.size())
+				{
+					std::cout << "ERROR::KTX2::TRUNCATED_FILE: " << path << std::endl;
+					levels.clear();
+					return false;
+				}
+				levels.push_back({ file.data() + index.byteOffset, static_cast<size_t>(index.byteLength),
+					std::max(1, width >> i), std::max(1, height >> i) });
+			}
+
+			// entries: length, key, NUL, value, padded to 4 bytes
+			const unsigned char *entry = file.data() + header.kvdByteOffset;
+			const unsigned char *end = entry + header.kvdByteLength;
+			while (entry + 4 <= end)
+			{
+				uint32_t length;
+				std::memcpy(&length, entry, 4);
+				const char *key = reinterpret_cast<const char*>(entry + 4);
+				if (length == 0 || entry + 4 + length > end)
+				{
+					break;
+				}
+				const size_t keyLength = std::find(key, key + length, '\0') - key;
+				if (keyLength < length)
+				{
+					values[std::string(key, keyLength)] = std::string(key + keyLength + 1, length - keyLength - 1);
+				}
+				entry += 4 + (length + 3) / 4 * 4;
+			}
+			return true;
+		}
+
+		/*
+		* Value of a key/value entry, with the terminating NUL of text values stripped.
+		* @param[in] key
+		* @return empty if the entry is missing.
+		*/
+		std::string value(const std::string &key) const
+		{
+			auto found = values.find(key);
+			if (found == values.end())
+			{
+				return std::string();
+			}
+			std::string text = found->second;
+			if (!text.empty() && text.back() == '\0')
+			{
+				text.pop_back();
+			}
+			return text;
+		}
+	};
+
+	inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	/*
+	* Basic data format descriptor for one of the BCn formats, as the KTX2 specification requires.
+	* @param[in] vkFormat
+	* @return the descriptor, starting with its total size.
+	*/
+	inline std::vector<uint32_t> describeFormat(uint32_t vkFormat)
+	{
+		using namespace BlockCompression;
+		const bool srgb = vkFormat == VK_FORMAT_BC1_RGB_SRGB_BLOCK || vkFormat == VK_FORMAT_BC3_SRGB_BLOCK || vkFormat == VK_FORMAT_BC7_SRGB_BLOCK;
+		// colour model, bytes per block and the samples as (channel, first bit) pairs
+		uint32_t model, bytes;
+		std::vector<std::pair<uint32_t, uint32_t>> samples;
+		switch (vkFormat)
+		{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+			model = 128, bytes = 8, samples = { { 0, 0 } };
+			break;
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+			model = 130, bytes = 16, samples = { { 15, 0 }, { 0, 64 } };
+			break;
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+			model = 131, bytes = 8, samples = { { 0, 0 } };
+			break;
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+			model = 132, bytes = 16, samples = { { 0, 0 }, { 1, 64 } };
+			break;
+		default:
+			model = 134, bytes = 16, samples = { { 0, 0 } };
+			break;
+		}
+
+		const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+		std::vector<uint32_t> descriptor;
+		descriptor.push_back(4 + blockSize);
+		descriptor.push_back(0);								// Khronos vendor, basic descriptor type
+		descriptor.push_back(2 | blockSize << 16);				// version 2
+		descriptor.push_back(model | 1 << 8 | (srgb ? 2 : 1) << 16);	// BT.709 primaries, linear or sRGB transfer
+		descriptor.push_back(3 | 3 << 8);						// 4x4x1x1 texel blocks, stored minus one
+		descriptor.push_back(bytes);
+		descriptor.push_back(0);
+		for (const auto &sample : samples)
+		{
+			// an alpha sample stays linear in an sRGB format
+			const uint32_t qualifiers = sample.first == 15 && srgb ? 0x10 : 0;
+			const uint32_t bitLength = (bytes == 8 ? 64 : 128) / static_cast<uint32_t>(samples.size()) - 1;
+			descriptor.push_back(sample.second | bitLength << 16 | (sample.first | qualifiers) << 24);
+			descriptor.push_back(0);
+			descriptor.push_back(0);
+			descriptor.push_back(0xFFFFFFFFu);
+		}
+		return descriptor;
+	}
+
+	/*
+	* Write a 2D block-compressed texture.
+	* @param[in] path
+	* @param[in] vkFormat
+	* @param[in] width Size of level 0.
+	* @param[in] height
+	* @param[in] levels Encoded levels, largest first.
+	* @param[in] values Key/value entries; text values should include their terminating NUL.
+	* @return false if the file could not be written.
+	*/
+	inline bool write(const std::string &path, uint32_t vkFormat, int width, int height,
+		const std::vector<std::vector<unsigned char>> &levels, const std::map<std::string, std::string> &values)
+	{
+		const std::vector<uint32_t> descriptor = describeFormat(vkFormat);
+		std::vector<unsigned char> keyValues;
+		// std::map keeps the keys sorted, which the format requires
+		for (const auto &entry : values)
+		{
+			const uint32_t length = static_cast<uint32_t>(entry.first.size() + 1 + entry.second.size());
+			const size_t start = keyValues.size();
+			keyValues.resize(start + 4 + alignUp(length, 4));
+			std::memcpy(keyValues.data() + start, &length, 4);
+			std::memcpy(keyValues.data() + start + 4, entry.first.c_str(), entry.first.size() + 1);
+			std::memcpy(keyValues.data() + start + 4 + entry.first.size() + 1, entry.second.data(), entry.second.size());
+		}
+
+		Header header = {};
+		std::memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+		header.vkFormat = vkFormat;
+		header.typeSize = 1;
+		header.pixelWidth = static_cast<uint32_t>(width);
+		header.pixelHeight = static_cast<uint32_t>(height);
+		header.faceCount = 1;
+		header.levelCount = static_cast<uint32_t>(levels.size());
+		header.dfdByteOffset = static_cast<uint32_t>(sizeof(Header) + levels.size() * sizeof(LevelIndex));
+		header.dfdByteLength = static_cast<uint32_t>(descriptor.size() * 4);
+		header.kvdByteOffset = keyValues.empty() ? 0 : header.dfdByteOffset + header.dfdByteLength;
+		header.kvdByteLength = static_cast<uint32_t>(keyValues.size());
+
+		// the smallest level comes first in the file, each one aligned to a whole block
+		const uint64_t alignment = vkFormat == BlockCompression::VK_FORMAT_BC1_RGB_UNORM_BLOCK || vkFormat == BlockCompression::VK_FORMAT_BC1_RGB_SRGB_BLOCK ||
+			vkFormat == BlockCompression::VK_FORMAT_BC4_UNORM_BLOCK ? 8 : 16;
+		std::vector<LevelIndex> index(levels.size());
+		uint64_t offset = header.dfdByteOffset + header.dfdByteLength + header.kvdByteLength;
+		for (size_t i = levels.size(); i-- > 0; )
+		{
+			offset = alignUp(offset, alignment);
+			index[i] = { offset, levels[i].size(), levels[i].size() };
+			offset += levels[i].size();
+		}
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			std::cout << "ERROR::KTX2::FILE_NOT_WRITTEN: " << path << std::endl;
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(LevelIndex));
+		out.write(reinterpret_cast<const char*>(descriptor.data()), descriptor.size() * 4);
+		out.write(reinterpret_cast<const char*>(keyValues.data()), keyValues.size());
+		for (size_t i = levels.size(); i-- > 0; )
+		{
+			const std::vector<char> padding(index[i].byteOffset - static_cast<uint64_t>(out.tellp()), 0);
+			out.write(padding.data(), padding.size());
+			out.write(reinterpret_cast<const char*>(levels[i].data()), levels[i].size());
+		}
+		return static_cast<bool>(out);
+	}
+}
+
+#endif
@@ -2,8 +2,12 @@
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// camera state shared by every program, see frame_uniforms.hpp
+layout (std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
 
 void main()
 {
@@ -9,8 +9,17 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "bindless_textures.hpp"
 #include "camera.hpp"
+#include "frame_uniforms.hpp"
+#include "gpu_memory.hpp"
+#include "ibl_baker.hpp"
+#include "mip_streamer.hpp"
 #include "model.hpp"
+#include "model_loader.hpp"
+#include "render_target.hpp"
+#include "shader_permutations.hpp"
+#include "texture_streamer.hpp"
 
 
 #include "shader.hpp"
@@ -41,71 +50,51 @@ float lastFrame = 0.0f;
 // Utils
 unsigned int TextureFromFile(const char *path)
 {
-	std::string filename = std::string(path);
-	filename = path;
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	return TextureCache::shared().acquirePinned(path);
 }
 
 unsigned int loadCubeMap(std::vector<std::string> faces)
 {
+	// decode every face at once on the worker pool; only the uploads happen on this thread. Cooked files
+	// are 2D mip chains, so the faces always come from their source images, or the TexelCache's texels.
+	std::vector<std::future<DecodedImage>> decoded;
+	decoded.reserve(faces.size());
+	for (const std::string &face : faces)
+	{
+		decoded.push_back(ThreadPool::shared().submit([face]
+		{
+			return TextureCache::decodeFile(face, false, nullptr, false);
+		}));
+	}
+
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-	stbi_set_flip_vertically_on_load(false);
-	
-	int width, height, nrChannels;
 	for (unsigned int i = 0; i < faces.size(); i++)
 	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
+		DecodedImage image = decoded[i].get();
+		if (const unsigned char *pixels = image.basePixels())
 		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
+			GLenum format = GL_RGBA;
+			if (image.components == 1)
+				format = GL_RED;
+			else if (image.components == 2)
+				format = GL_RG;
+			else if (image.components == 3)
+				format = GL_RGB;
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			GpuMemory::shared().trackTexture(textureID, format, image.width, image.height, static_cast<int>(faces.size()), 1, "Skybox");
 		}
 		else
 		{
 			std::cout << "Cubemap failed to load at  path: " << faces[i]
 			<< std::endl;
-			stbi_image_free(data);
 		}
 	}
 
-	stbi_set_flip_vertically_on_load(true);
-	
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S,
@@ -120,8 +109,21 @@ unsigned int loadCubeMap(std::vector<std::string> faces)
 }
 
 
-int main()
+int main(int argc, char *argv[])
 {
+	// offline texture cook, no window or GL needed: LearnOpenGL --cook [--srgb] [--bc7] images...
+	if (argc > 1 && std::string(argv[1]) == "--cook")
+	{
+		return TextureCook::run(argc - 2, argv + 2);
+	}
+	// offline lighting bake into ibl_cache/: LearnOpenGL --bake-ibl right left top bottom front back | equirect.hdr
+	if (argc > 1 && std::string(argv[1]) == "--bake-ibl")
+	{
+		return IblBaker::run(argc - 2, argv + 2);
+	}
+	// the backpack's material textures packed into array textures, drawn with the PACKED lit shader: LearnOpenGL --pack-textures
+	const bool packTextures = argc > 1 && std::string(argv[1]) == "--pack-textures";
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -141,6 +143,8 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	// linked program binaries from earlier runs, so the Shaders below skip compiling GLSL
+	ProgramCache::shared().enable("program_cache");
 	glViewport(0, 0, 800, 600);
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_STENCIL_TEST);
@@ -151,10 +155,21 @@ int main()
 	glfwSetScrollCallback(window, scroll_callback);
 
 	
-	Shader ourShader("cube.vert", "cube.frag");
+	// Every program is created here, before any is used: with parallel shader compilation the driver
+	// builds them all in the background, and only the first use of one that is still linking waits.
+	// The lit shader is compiled per set of features a draw asks for; the boxes need the defaults, and the model
+	// needs packed textures only with --pack-textures, so that variant is not compiled otherwise.
+	ShaderPermutations litShaders("cube.vert", "cube.frag");
+	const ShaderFeatures litFeatures;
+	Shader &ourShader = litShaders.get(litFeatures);
+	Shader &modelShader = litShaders.get(packTextures ? litFeatures.with(FEATURE_PACKED) : litFeatures);
 	Shader lightCubeShader("light_cube.vert", "light_cube.frag");
 	Shader shaderSingleColor("cube.vert", "shaderSingleColor.frag");
 	Shader vegetationShader("vegetation.vert", "vegetation.frag");
+	Shader feedbackShader("cube.vert", "mip_feedback.frag");
+	Shader skyboxShader("skybox.vert", "skybox.frag");
+	Shader screenShader("lesson26Shader.vert", "lesson26Shader.frag");
+	Shader containerShader("cube.vert", "cube.frag");
 
 	float vertices[] = {
 		// positions // normals // texture coords
@@ -353,6 +368,7 @@ int main()
 	{
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		GpuMemory::shared().trackTexture(textures[0], GL_RGBA, width, height, 1, Mipmap::levelCount(width, height), "main");
 	}
 	else
 	{
@@ -372,6 +388,7 @@ int main()
 	{
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		GpuMemory::shared().trackTexture(textures[1], GL_RGB, width, height, 1, Mipmap::levelCount(width, height), "main");
 	}
 	else
 	{
@@ -390,6 +407,7 @@ int main()
 	glBindVertexArray(skyboxVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(skyboxVBO, GPU_VERTEX_BUFFERS, sizeof(skyboxVertices), "main");
 
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -404,9 +422,17 @@ int main()
 		
 	};
 	unsigned int cubemapTexture = loadCubeMap(faces);
-	Shader skyboxShader = Shader("skybox.vert", "skybox.frag");
-	skyboxShader.use();
-	skyboxShader.setInt("skybox", 0);
+	// ambient light from the same skybox, baked on the CPU the first time and read from ibl_cache/ after
+	IblBaker::Environment environment;
+	IblBaker::Lighting environmentLighting;
+	if (IblBaker::bake(faces, environment))
+	{
+		environmentLighting = IblBaker::upload(environment);
+	}
+	skyboxShader.whenLinked([&skyboxShader]()
+	{
+		skyboxShader.setInt("skybox", 0);
+	});
 	
 	// Generate buffer objects
 	
@@ -418,6 +444,7 @@ int main()
 
 	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(cubeVBO, GPU_VERTEX_BUFFERS, sizeof(vertices), "main");
 
 	//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	//glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), ind^ices, GL_STATIC_DRAW);
@@ -448,6 +475,7 @@ int main()
 	glBindVertexArray(geoVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, geoVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(points), points, GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(geoVBO, GPU_VERTEX_BUFFERS, sizeof(points), "main");
 	
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
@@ -550,10 +578,12 @@ int main()
 	glBindBuffer(GL_ARRAY_BUFFER, instancingQuadVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, instancesQuadVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * 100, &translations[0], GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(instancesQuadVBO, GPU_VERTEX_BUFFERS, sizeof(glm::vec2) * 100, "main");
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)(0));
 	glEnableVertexAttribArray(2);
 	glBindBuffer(GL_ARRAY_BUFFER, instancingQuadVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(instancingQuadVertices), &instancingQuadVertices, GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(instancingQuadVBO, GPU_VERTEX_BUFFERS, sizeof(instancingQuadVertices), "main");
 
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2*sizeof(float)));
@@ -565,17 +595,11 @@ int main()
 	glEnableVertexAttribArray(2);
 	*/
 
-	// MSAA Off-screen
-	unsigned int MSAAframebuffer;
-	glGenFramebuffers(1, &MSAAframebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, MSAAframebuffer);
-	unsigned int textureColorBufferMultiSampled;
-	glGenTextures(1, &textureColorBufferMultiSampled);
-	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, textureColorBufferMultiSampled);
-	glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGB, SCR_WIDTH, SCR_HEIGHT, GL_TRUE);
-	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, textureColorBufferMultiSampled, 0);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, 4, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
+	// MSAA Off-screen, sized to the window's framebuffer and reallocated when it changes
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	RenderTarget msaaTarget("MSAA", 4);
+	msaaTarget.resize(framebufferWidth, framebufferHeight);
 	
 	
 	// Asteroid field
@@ -610,8 +634,55 @@ int main()
 		modelMatrices[i] = model;
 	}
 
-	Model planet("C:/Users/Danny Le/RiderProjects/Learn-OpenGL/Learn OpenGL/planet/planet.obj");
-	Model rock("C:/Users/Danny Le/RiderProjects/Learn-OpenGL/Learn OpenGL/rock/rock.obj");
+#ifdef NDEBUG
+	const ImportProfile importProfile = IMPORT_SHIPPING;
+#else
+	const ImportProfile importProfile = IMPORT_FAST;
+#endif
+	// decoded textures are kept on disk with their mip chains, so warm starts skip the image decoder
+	TexelCache::shared().enable("texel_cache");
+	// textures loaded from here on are uploaded a few megabytes per frame, mip tail first. Large ones
+	// only keep the levels the feedback pass asks for resident.
+	TextureStreamer textureStreamer;
+	MipStreamer mipStreamer;
+	TextureCache::shared().setUploader([&textureStreamer, &mipStreamer](DecodedImage &&image)
+	{
+		if (mipStreamer.wants(image))
+			return mipStreamer.manage(std::move(image));
+		// cooked files are small enough to upload at once
+		if (!image.pixels && image.texels.levels.empty())
+			return 0u;
+		return textureStreamer.enqueue(std::move(image));
+	});
+	// everything above is tracked; over budget, unused textures go first, then streamed levels, which
+	// the streamer loads again once the total is back under budget
+	const GpuMemory::DriverMemory driverMemory = GpuMemory::shared().queryDriver();
+	GpuMemory::shared().setBudget(driverMemory.totalBytes > 0 ? driverMemory.totalBytes / 10 * 8 : static_cast<size_t>(1) << 30);
+	GpuMemory::shared().addEvictionCallback([](size_t)
+	{
+		TextureCache::shared().collectGarbage();
+	});
+	GpuMemory::shared().addEvictionCallback([&mipStreamer](size_t bytes)
+	{
+		mipStreamer.shrink(bytes);
+	});
+	GpuMemory::shared().addReliefCallback([&mipStreamer](size_t bytes)
+	{
+		mipStreamer.relieve(bytes);
+	});
+	// model meshes read their textures through bindless handles where the driver allows it
+	if (BindlessTextures::shared().enable())
+	{
+		BindlessTextures::shared().setReadyCheck([&textureStreamer, &mipStreamer](unsigned int texture)
+		{
+			return !textureStreamer.streaming(texture) && !mipStreamer.manages(texture);
+		});
+	}
+
+	// models stream in while the render loop runs
+	ModelLoader modelLoader;
+	std::shared_ptr<AsyncModel> planet = modelLoader.load("C:/Users/Danny Le/RiderProjects/Learn-OpenGL/Learn OpenGL/planet/planet.obj", importProfile);
+	std::shared_ptr<AsyncModel> rock = modelLoader.load("C:/Users/Danny Le/RiderProjects/Learn-OpenGL/Learn OpenGL/rock/rock.obj", importProfile);
 	
 	unsigned int quadVBO, quadVAO, windingCubeVBO, windingCubeVAO;
 	glGenBuffers(1, &quadVBO);
@@ -622,6 +693,7 @@ int main()
 	glBindVertexArray(windingCubeVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, windingCubeVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(windingCubeVertices), &windingCubeVertices, GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(windingCubeVBO, GPU_VERTEX_BUFFERS, sizeof(windingCubeVertices), "main");
 	
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -632,6 +704,7 @@ int main()
 	glBindVertexArray(quadVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quadVerticies), quadVerticies, GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(quadVBO, GPU_VERTEX_BUFFERS, sizeof(quadVerticies), "main");
 	
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -641,33 +714,12 @@ int main()
 
 	// Lesson 26
 	
-	unsigned int framebuffer;
-	glGenFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-
-	unsigned int textureColorBuffer;
-	glGenTextures(1, &textureColorBuffer);
-	glBindTexture(GL_TEXTURE_2D, textureColorBuffer);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureColorBuffer, 0);
+	RenderTarget offscreenTarget("Offscreen");
+	offscreenTarget.resize(framebufferWidth, framebufferHeight);
 	
 	//glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, FBOTexture, 0);
 	
 	//FBOTexture = TextureFromFile("container2.png");	
-	unsigned int rbo;
-	glGenRenderbuffers(1, &rbo);
-	glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-	{
-		std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-	}
-	//glBindRenderbuffer(GL_RENDERBUFFER, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	//glDeleteFramebuffers(1, &FBO);
 
 	unsigned int quad2DVAO, quad2DVBO;
 	glGenVertexArrays(1, &quad2DVAO);
@@ -675,6 +727,7 @@ int main()
 	glBindVertexArray(quad2DVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, quad2DVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quad2DVertices), &quad2DVertices, GL_STATIC_DRAW);
+	GpuMemory::shared().trackBuffer(quad2DVBO, GPU_VERTEX_BUFFERS, sizeof(quad2DVertices), "main");
 
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -682,21 +735,28 @@ int main()
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(sizeof(float)*2));
 	glEnableVertexAttribArray(1);
 
-	Shader screenShader("lesson26Shader.vert", "lesson26Shader.frag");
 	
 	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
 	
-	// Setting textures
-	ourShader.use();
-	ourShader.setInt("material.diffuse", 0);
-	ourShader.setInt("material.specular", 1);
+	// Setting textures, for every variant of the lit shader once it has linked
+	litShaders.onCreate([&environmentLighting](Shader &shader)
+	{
+		shader.whenLinked([&shader, &environmentLighting]()
+		{
+			shader.setInt("material.diffuse", 0);
+			shader.setInt("material.specular", 1);
+			shader.setInt("material.normal", 2);
+			IblBaker::apply(environmentLighting, shader);
+		});
+	});
 	//vegetationShader.use();
 	//vegetationShader.setInt("texture1", 2);
-	screenShader.use();
-	screenShader.setInt("screenTexture", 0);
+	screenShader.whenLinked([&screenShader]()
+	{
+		screenShader.setInt("screenTexture", 0);
+	});
 
 	// Lesson 37
-	Shader containerShader = Shader("cube.vert", "cube.frag");
 	
 	unsigned int MirrorVAO, MirrorVBO;
 	
@@ -705,12 +765,52 @@ int main()
 
 	//Shader ourShader("light_cube.vert", "light_cube.frag");
 	
-	Model ourModel("C:/Users/Danny Le/RiderProjects/Learn-OpenGL/Learn OpenGL/backpack/backpack.obj");
+	std::shared_ptr<AsyncModel> ourModel = modelLoader.load("C:/Users/Danny Le/RiderProjects/Learn-OpenGL/Learn OpenGL/backpack/backpack.obj", importProfile, VERTEX_FULL, true,
+		nullptr, packTextures);
 
 	// Wooden Floor
 	//glBindTexture(GL_TEXTURE_2D, textures[0]);
 	textures[0] = TextureFromFile("C:/Users/Danny Le/RiderProjects/Learn-OpenGL/Learn OpenGL/assets/wood.png");
 	
+	// camera and lights reach every program through the FrameData and LightData blocks, written once a frame
+	FrameUniforms frameUniforms;
+	litShaders.onCreate([&frameUniforms](Shader &shader)
+	{
+		frameUniforms.attach(shader);
+	});
+	for (Shader *shader : { &lightCubeShader, &shaderSingleColor, &vegetationShader, &feedbackShader, &skyboxShader, &containerShader })
+	{
+		frameUniforms.attach(*shader);
+	}
+	LightData &lights = frameUniforms.lights;
+	for (int i = 0; i < LightData::POINT_LIGHTS; i++)
+	{
+		PointLightStd140 &light = lights.pointLights[i];
+		light.position = pointLightPositions[i];
+		light.constant = 1.0f;
+		light.linear = 0.09f;
+		light.quadratic = 0.032f;
+		light.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+		light.diffuse = glm::vec3(1.0f, 0.0f, 0.0f);
+		light.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+	}
+	lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+	lights.dirLight.ambient = glm::vec3(0.2f, 0.2f, 0.2f);
+	lights.dirLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.dirLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+	lights.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+	lights.spotLight.outerCutOff = glm::cos(glm::radians(17.5f));
+	lights.spotLight.constant = 1.0f;
+	lights.spotLight.linear = 0.09f;
+	lights.spotLight.quadratic = 0.032f;
+	lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+	lights.spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.spotLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+
+	// uniforms set every draw, resolved once
+	const UniformHandle<glm::mat4> modelUniform = ourShader.uniform<glm::mat4>(UniformNames::MODEL);
+	const UniformHandle<float> shininessUniform = ourShader.uniform<float>(UniformNames::SHININESS);
+
 	// Render loop
 	while (!glfwWindowShouldClose(window))
 	{
@@ -720,6 +820,51 @@ int main()
 		// input
 		processInput(window);
 
+		textureStreamer.update();
+		mipStreamer.update();
+		GpuMemory::shared().update();
+		// programs that finished linking in the background, drawn with or not
+		ProgramCache::shared().update();
+		// upload finished model imports for at most 4ms a frame
+		if (!modelLoader.idle())
+		{
+			modelLoader.update(0.004);
+			if (modelLoader.idle())
+			{
+				const GeometryArena::Stats arenaStats = Mesh::arenaFor(VERTEX_FULL, GL_UNSIGNED_INT).stats();
+				std::cout << "GEOMETRY_ARENA::MESHES " << arenaStats.allocations
+					<< " VERTICES " << arenaStats.verticesLive << "/" << arenaStats.vertexCapacity
+					<< " INDICES " << arenaStats.indicesLive << "/" << arenaStats.indexCapacity << std::endl;
+				const TextureCache::Stats textureStats = TextureCache::shared().stats();
+				std::cout << "TEXTURE_CACHE::TEXTURES " << textureStats.textures << " BYTES " << textureStats.bytes
+					<< " HITS " << textureStats.pathHits << " CONTENT_HITS " << textureStats.contentHits
+					<< " MISSES " << textureStats.misses << " COMPRESSED " << textureStats.compressed
+					<< " FAILURES " << textureStats.failures << std::endl;
+				const TexelCache::Stats texelStats = TexelCache::shared().stats();
+				std::cout << "TEXEL_CACHE::HITS " << texelStats.hits << " MISSES " << texelStats.misses
+					<< " WRITES " << texelStats.writes << " EVICTIONS " << texelStats.evictions
+					<< " FILES " << texelStats.files << " BYTES " << texelStats.bytes << "/" << texelStats.limitBytes << std::endl;
+				if (BindlessTextures::shared().enabled())
+				{
+					const BindlessTextures::Stats bindlessStats = BindlessTextures::shared().stats();
+					std::cout << "BINDLESS_TEXTURES::MATERIALS " << bindlessStats.materials << " RESIDENT " << bindlessStats.resident
+						<< "/" << bindlessStats.textures << " BYTES " << bindlessStats.residentBytes << "/" << bindlessStats.budgetBytes
+						<< " EVICTED " << bindlessStats.evicted << std::endl;
+				}
+				for (const MipStreamer::TextureStats &texture : mipStreamer.textureStats())
+				{
+					std::cout << "MIP_STREAMER::TEXTURE " << texture.id << " " << texture.width << "x" << texture.height
+						<< " RESIDENT_MIP " << texture.residentMip << " REQUESTED_MIP " << texture.requestedMip
+						<< " BYTES " << texture.residentBytes << std::endl;
+				}
+				const ProgramCache::Stats programStats = ProgramCache::shared().stats();
+				std::cout << "PROGRAM_CACHE::SHARED " << programStats.shared << " LOADED " << programStats.loaded
+					<< " REJECTED " << programStats.rejected << " COMPILED " << programStats.compiled
+					<< " WRITTEN " << programStats.written << std::endl;
+				GpuMemory::shared().printReport();
+			}
+		}
+
 		// Rendering commands here
 		//glEnable(GL_DEPTH_TEST);
 		//glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
@@ -732,86 +877,60 @@ int main()
 		//glStencilMask(0x00);
 
 		// MSAA
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, MSAAframebuffer);
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+		msaaTarget.resize(framebufferWidth, framebufferHeight);
+		offscreenTarget.resize(framebufferWidth, framebufferHeight);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, msaaTarget.framebuffer);
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-		glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		
-		// Lighting
+		glBlitFramebuffer(0, 0, msaaTarget.width, msaaTarget.height, 0, 0, msaaTarget.width, msaaTarget.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 		
+		// Camera and lighting, for every program at once
+		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		glm::mat4 view = camera.GetViewMatrix();
+		frameUniforms.frame.projection = projection;
+		frameUniforms.frame.view = view;
+		frameUniforms.frame.viewPos = camera.Position;
+		lights.spotLight.position = camera.Position;
+		lights.spotLight.direction = camera.Front;
+		frameUniforms.upload();
+
 		ourShader.use();
-		ourShader.setVec3("viewPos", camera.Position);
-		
-		for (unsigned int i = 0; i < 4; i++)
-		{
-			std::string name = "pointLights[" + std::to_string(i) + "].";
-			ourShader.setVec3(name + "position", pointLightPositions[i]);
-			ourShader.setFloat(name + "constant", 1.0f);
-			ourShader.setFloat(name + "linear", 0.09f);
-			ourShader.setFloat(name + "quadratic", 0.032f);
-			ourShader.setVec3(name + "ambient", 0.0f, 0.0f, 0.0f);
-			ourShader.setVec3(name + "diffuse", 1.0f, 0.0f, 0.0f);
-			ourShader.setVec3(name + "specular", 0.5f, 0.5f, 0.5f);
-		}
-		ourShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		ourShader.setVec3("dirLight.ambient", 0.2f, 0.2f, 0.2f);
-		ourShader.setVec3("dirLight.diffuse", 1.0f, 1.0f, 1.0f);
-		ourShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);	
-
-		ourShader.setVec3("spotLight.position", camera.Position);
-		ourShader.setVec3("spotLight.direction", camera.Front);
-		ourShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-		ourShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(17.5f)));
-		ourShader.setFloat("spotLight.constant", 1.0f);
-		ourShader.setFloat("spotLight.linear", 0.09f);
-		ourShader.setFloat("spotLight.quadratic", 0.032f);
-		ourShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-		ourShader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-		ourShader.setVec3("spotLight.specular", 0.5f, 0.5f, 0.5f);
-		
 		ourShader.setVec3("material.ambient", 0.0f, 0.0f, 0.0f);
 		ourShader.setVec3("material.diffuse", 1.0f, 0.5f, 0.31f);
 		ourShader.setVec3("material.specular", 0.5f, 0.5f, 0.5f);
-		ourShader.setFloat("material.shininess", 32.0f);
-		
-		
-		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 view = camera.GetViewMatrix();
-		ourShader.setMat4("projection", projection);
-		ourShader.setMat4("view", view);
-		lightCubeShader.use();
-		lightCubeShader.setMat4("projection", projection);
-		lightCubeShader.setMat4("view", view);
-		ourShader.use();
+		ourShader.setFloat(UniformNames::SHININESS, 32.0f);
 		
 		
 		glm::mat4 model = glm::mat4(1.0f);
-		ourShader.setMat4("model", model);
+		ourShader.setMat4(UniformNames::MODEL, model);
 		
 		{
-			glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-			glm::mat4 view = camera.GetViewMatrix();
-
 			// render the loaded model
 			glm::mat4 model = glm::mat4(1.0f);
 			model = glm::translate(model, glm::vec3(0.0f, 0.0f, -4.0f)); // translate it down so it's at the center
 			//of the scene
 			model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));	// it's a bit too big for our scene, so scale
 			//it down
-			ourShader.use();
-			ourShader.setMat4("projection", projection);
-			ourShader.setMat4("view", view);
-			ourShader.setMat4("model", model);
-			ourModel.Draw(ourShader);
+			// record which mip levels of its textures the model needs
+			if (mipStreamer.beginFeedback(SCR_WIDTH, SCR_HEIGHT))
+			{
+				feedbackShader.use();
+				feedbackShader.setMat4(UniformNames::MODEL, model);
+				feedbackShader.setFloat(UniformNames::FEEDBACK_SCALE, 1.0f / MipStreamer::FEEDBACK_DIVISOR);
+				ourModel->Draw(feedbackShader, model, projection * view, camera, (float)SCR_HEIGHT);
+				mipStreamer.endFeedback();
+			}
+			modelShader.use();
+			modelShader.setFloat(UniformNames::SHININESS, 32.0f);
+			modelShader.setMat4(UniformNames::MODEL, model);
+			ourModel->Draw(modelShader, model, projection * view, camera, (float)SCR_HEIGHT);
 		}
 		
 		// Containers
 		/**
 		containerShader.use();
-		containerShader.setMat4("model", model);
-		containerShader.setMat4("view", view);
-		containerShader.setMat4("projection", projection);
+		containerShader.setMat4(UniformNames::MODEL, model);
 		//containerShader.setInt("skybox", 0);
-		containerShader.setVec3("cameraPos", camera.Position);
 		**/
 
 		// Boxes
@@ -831,9 +950,9 @@ int main()
 			float angle = 20.0f * i;
 			model = glm::rotate(model, glm::radians( angle ),
 										glm::vec3(1.0f, 0.3f, 0.5f));
-			//containerShader.setMat4("model", model);
-			ourShader.setFloat("material.shininess", 512.0f);
-			ourShader.setMat4("model", model);
+			//containerShader.setMat4(UniformNames::MODEL, model);
+			ourShader.set(shininessUniform, 512.0f);
+			ourShader.set(modelUniform, model);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
 		}
 		
@@ -841,17 +960,20 @@ int main()
 		// Wooden floor
 		
 		/**
-		// Draw an asteroid belt
-		ourShader.use();
+		// Draw an asteroid belt with the lit shader's default variant. Each rock picks the level of detail
+		// its distance from the camera allows.
+		Shader &asteroidShader = litShaders.get(litFeatures);
+		asteroidShader.use();
+		asteroidShader.setFloat(UniformNames::SHININESS, 32.0f);
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, glm::vec3(0.0f, -3.0f, 0.0f));
 		model = glm::scale(model, glm::vec3(4.0f, 4.0f, 4.0f));
-		ourShader.setMat4("model", model);
-		planet.Draw(ourShader);
+		asteroidShader.setMat4(UniformNames::MODEL, model);
+		planet->Draw(asteroidShader, model, projection * view, camera, (float)SCR_HEIGHT);
 		for (unsigned int i = 0; i < amount; i++)
 		{
-			ourShader.setMat4("model", modelMatrices[i]);
-			rock.Draw(ourShader);
+			asteroidShader.setMat4(UniformNames::MODEL, modelMatrices[i]);
+			rock->Draw(asteroidShader, modelMatrices[i], projection * view, camera, (float)SCR_HEIGHT);
 		}
 		**/
 		
@@ -860,9 +982,6 @@ int main()
 		/*
 		glDepthFunc(GL_LEQUAL);
 		skyboxShader.use();
-		view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-		skyboxShader.setMat4("view", view);
-		skyboxShader.setMat4("projection", projection);
 
 		glBindVertexArray(skyboxVAO);
 		glActiveTexture(GL_TEXTURE0);
@@ -884,9 +1003,13 @@ int main()
 		
 		// check and call events and swap the buffers
 		glfwSwapBuffers(window);
+		frameUniforms.endFrame();
+		BindlessTextures::shared().endFrame();
 		glfwPollEvents();
 	}
 
+	msaaTarget.release();
+	offscreenTarget.release();
 	glfwTerminate();
 	return 0;
 }
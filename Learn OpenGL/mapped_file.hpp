@@ -0,0 +1,129 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Read-only view of a whole file mapped into the address space. The bytes stay valid until close()
+// or destruction, and pages are only faulted in when they are touched.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other)
+		{
+			close();
+			bytes = other.bytes;
+			length = other.length;
+			other.bytes = nullptr;
+			other.length = 0;
+		}
+		return *this;
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	/*
+	* Map a file for reading.
+	* @param[in] path File path to map.
+	* @return true if the file exists, is non-empty and was mapped.
+	*/
+	bool open(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (!mapping)
+			return false;
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		// the view keeps the mapping alive
+		CloseHandle(mapping);
+		if (!view)
+			return false;
+		bytes = static_cast<const unsigned char*>(view);
+		length = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (view == MAP_FAILED)
+			return false;
+		bytes = static_cast<const unsigned char*>(view);
+		length = static_cast<size_t>(st.st_size);
+#endif
+		return true;
+	}
+
+	void close()
+	{
+		if (!bytes)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(bytes);
+#else
+		munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+		bytes = nullptr;
+		length = 0;
+	}
+
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+	bool isOpen() const { return bytes != nullptr; }
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+};
+
+#endif
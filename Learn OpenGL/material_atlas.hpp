@@ -0,0 +1,412 @@
+#ifndef MATERIAL_ATLAS_H
+#define MATERIAL_ATLAS_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "gpu_memory.hpp"
+#include "mesh.hpp"
+#include "mipmap.hpp"
+#include "texture_cache.hpp"
+#include "thread_pool.hpp"
+
+// Where a packed material texture ended up: a layer of one of the atlas's array textures, and the scale
+// (xy) and offset (zw) that map the mesh's texture coordinates onto its rectangle in that layer.
+struct PackedTexture
+{
+	int array;
+	int layer;
+	glm::vec4 transform;
+};
+
+// The material textures of one model packed into GL_TEXTURE_2D_ARRAY textures, so meshes refer to a
+// layer instead of a texture of their own and consecutive meshes draw without rebinding. Textures of
+// the same size and channel count become the layers of one array. Small textures whose meshes keep
+// their texture coordinates inside [0, 1] share atlas pages instead, each surrounded by a gutter of
+// copied edge texels so filtering and the first mip levels do not bleed between neighbours.
+// build() decodes and packs on the CPU and may run on any thread; upload() belongs to the GL thread.
+class MaterialAtlas
+{
+public:
+	static const int SMALL_TEXTURE = 256;	// largest side that goes into atlas pages
+	static const int PAGE_SIZE = 1024;
+	static const int GUTTER = 8;			// edge copy around each page entry, also the placement alignment
+	static const int PAGE_LEVELS = 4;		// levels kept on pages, so the gutter is still a texel wide in the last
+
+	struct Report
+	{
+		size_t textures;		// distinct textures packed
+		size_t atlased;			// of those, the ones placed on atlas pages
+		size_t arrays;
+		size_t layers;
+		size_t usedBytes;		// level 0 bytes of the packed images
+		size_t allocatedBytes;	// level 0 bytes of the arrays holding them
+	};
+
+	bool empty() const
+	{
+		return arrays.empty();
+	}
+
+	/*
+	* Decode and pack the textures of a model. Decodes on the worker pool, so do not call from a pool job.
+	* Textures that fail to decode are packed as a white texel, so every texture of the model is an array
+	* layer and the PACKED shader never meets a plain 2D texture.
+	* @param[in] directory Directory the texture paths are relative to.
+	* @param[in] meshes
+	* @return void
+	*/
+	void build(const std::string &directory, const std::vector<MeshData> &meshes)
+	{
+		// every distinct path, and whether all meshes using it stay inside the unit square; a map keeps
+		// the packing order, and with it the layout, the same from run to run
+		std::map<std::string, bool> unitSquare;
+		for (const MeshData &mesh : meshes)
+		{
+			if (mesh.textures.empty())
+			{
+				continue;
+			}
+			const bool inside = insideUnitSquare(mesh.vertices);
+			for (const TextureRef &ref : mesh.textures)
+			{
+				auto found = unitSquare.emplace(ref.path, inside);
+				found.first->second = found.first->second && inside;
+			}
+		}
+
+		ThreadPool &pool = ThreadPool::shared();
+		std::vector<std::future<DecodedImage>> decoding;
+		decoding.reserve(unitSquare.size());
+		for (const auto &entry : unitSquare)
+		{
+			const std::string path = directory + '/' + entry.first;
+			// the packer needs pixels, so cooked block-compressed files are not used
+			decoding.push_back(pool.submit([path]
+			{
+				return TextureCache::decodeFile(path, true, nullptr, false);
+			}));
+		}
+
+		std::vector<Source> sources;
+		sources.reserve(unitSquare.size());
+		size_t next = 0;
+		for (const auto &entry : unitSquare)
+		{
+			DecodedImage image = decoding[next++].get();
+			if (!image.basePixels())
+			{
+				std::cout << "ERROR::MATERIAL_ATLAS::DECODE_FAILED: " << directory << '/' << entry.first << std::endl;
+				image = placeholder();
+			}
+			const bool small = entry.second && std::max(image.width, image.height) <= SMALL_TEXTURE;
+			sources.push_back({ entry.first, std::move(image), small });
+		}
+
+		std::map<std::tuple<int, int, int>, std::vector<Source*>> bySize;
+		std::map<int, std::vector<Source*>> byComponents;
+		for (Source &source : sources)
+		{
+			const DecodedImage &image = source.image;
+			if (source.small)
+				byComponents[image.components].push_back(&source);
+			else
+				bySize[std::make_tuple(image.width, image.height, image.components)].push_back(&source);
+		}
+		for (auto &group : bySize)
+		{
+			addLayers(group.second);
+		}
+		for (auto &group : byComponents)
+		{
+			addPages(group.second, group.first);
+		}
+
+		stats.textures = sources.size();
+		stats.arrays = arrays.size();
+		for (const Array &array : arrays)
+		{
+			stats.layers += array.layerCount;
+			stats.allocatedBytes += static_cast<size_t>(array.width) * array.height * array.components * array.layerCount;
+		}
+	}
+
+	/*
+	* Create the array textures and drop the CPU copies. Must run on the GL thread.
+	* @return void
+	*/
+	void upload()
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (Array &array : arrays)
+		{
+			GLenum format = GL_RGBA;
+			if (array.components == 1)
+				format = GL_RED;
+			else if (array.components == 2)
+				format = GL_RG;
+			else if (array.components == 3)
+				format = GL_RGB;
+
+			const GLsizei layers = static_cast<GLsizei>(array.layers.size());
+			const size_t levels = array.layers[0].size();
+			glGenTextures(1, &array.id);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, array.id);
+			for (size_t level = 0; level < levels; level++)
+			{
+				const MipLevel &size = array.layers[0][level];
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level), format, size.width, size.height, layers, 0, format, GL_UNSIGNED_BYTE, nullptr);
+				for (GLsizei layer = 0; layer < layers; layer++)
+				{
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level), 0, 0, layer, size.width, size.height, 1,
+						format, GL_UNSIGNED_BYTE, array.layers[layer][level].pixels.data());
+				}
+			}
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels - 1));
+			GpuMemory::shared().trackTexture(array.id, format, array.layers[0][0].width, array.layers[0][0].height, layers,
+				static_cast<int>(levels), "MaterialAtlas");
+			// page entries rely on their gutters, and tiling coordinates never reach a page
+			const GLint wrap = array.atlas ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			array.layers.clear();
+			array.layers.shrink_to_fit();
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	/*
+	* Placement of a texture.
+	* @param[in] path Path as the mesh's TextureRef has it.
+	* @return nullptr if the texture was not packed.
+	*/
+	const PackedTexture *find(const std::string &path) const
+	{
+		auto found = placements.find(path);
+		return found == placements.end() ? nullptr : &found->second;
+	}
+
+	// GL name of an array, zero before upload()
+	unsigned int arrayId(int array) const
+	{
+		return arrays[array].id;
+	}
+
+	Report report() const
+	{
+		return stats;
+	}
+
+	// print one line per array and a summary of the space lost to padding and empty page area
+	void printReport() const
+	{
+		static const char *const channels[] = { "", "R", "RG", "RGB", "RGBA" };
+		for (size_t i = 0; i < arrays.size(); i++)
+		{
+			const Array &array = arrays[i];
+			const size_t allocated = static_cast<size_t>(array.width) * array.height * array.layerCount;
+			std::cout << "MATERIAL_ATLAS::" << (array.atlas ? "PAGES " : "ARRAY ") << i << " " << array.width << "x" << array.height
+				<< " " << channels[array.components] << " LAYERS " << array.layerCount
+				<< " USED " << (allocated ? 100.0 * array.usedTexels / allocated : 0.0) << "%" << std::endl;
+		}
+		const size_t wasted = stats.allocatedBytes - stats.usedBytes;
+		std::cout << "MATERIAL_ATLAS::TEXTURES " << stats.textures << " ATLASED " << stats.atlased
+			<< " ARRAYS " << stats.arrays << " LAYERS " << stats.layers << " WASTED BYTES " << wasted
+			<< " (" << (stats.allocatedBytes ? 100.0 * wasted / stats.allocatedBytes : 0.0) << "%)" << std::endl;
+	}
+
+private:
+	struct Source
+	{
+		std::string path;
+		DecodedImage image;
+		bool small;
+	};
+
+	struct Array
+	{
+		int width;
+		int height;
+		int components;
+		bool atlas;
+		std::vector<std::vector<MipLevel>> layers;	// every level of every layer, level 0 first, until upload()
+		size_t layerCount;
+		size_t usedTexels;
+		unsigned int id;
+	};
+
+	std::vector<Array> arrays;
+	std::unordered_map<std::string, PackedTexture> placements;
+	Report stats = {};
+
+	static bool insideUnitSquare(const std::vector<Vertex> &vertices)
+	{
+		const float epsilon = 1e-4f;
+		for (const Vertex &vertex : vertices)
+		{
+			if (vertex.TexCoords.x < -epsilon || vertex.TexCoords.x > 1.0f + epsilon ||
+				vertex.TexCoords.y < -epsilon || vertex.TexCoords.y > 1.0f + epsilon)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static int alignUp(int value, int alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// one opaque white RGBA texel, freed like stb_image's pixels
+	static DecodedImage placeholder()
+	{
+		DecodedImage image;
+		image.width = 1;
+		image.height = 1;
+		image.components = 4;
+		image.pixels.reset(static_cast<unsigned char*>(std::malloc(4)));
+		std::memset(image.pixels.get(), 0xFF, 4);
+		return image;
+	}
+
+	// base level and the full chain below it
+	static std::vector<MipLevel> chain(std::vector<unsigned char> pixels, int width, int height, int components, size_t maxLevels)
+	{
+		MipSettings settings = Mipmap::runtimeSettings(components);
+		settings.parallel = true;
+		std::vector<MipLevel> levels;
+		std::vector<MipLevel> below = Mipmap::generate(pixels.data(), width, height, components, settings);
+		levels.reserve(below.size() + 1);
+		levels.push_back({ width, height, std::move(pixels) });
+		for (MipLevel &level : below)
+		{
+			if (levels.size() >= maxLevels)
+			{
+				break;
+			}
+			levels.push_back(std::move(level));
+		}
+		return levels;
+	}
+
+	// one array with a layer per texture, all of the same size and channel count
+	void addLayers(const std::vector<Source*> &group)
+	{
+		const DecodedImage &first = group[0]->image;
+		Array array = { first.width, first.height, first.components, false, {}, group.size(), 0, 0 };
+		const size_t bytes = static_cast<size_t>(first.width) * first.height * first.components;
+		for (Source *source : group)
+		{
+			const unsigned char *pixels = source->image.basePixels();
+			placements[source->path] = { static_cast<int>(arrays.size()), static_cast<int>(array.layers.size()), glm::vec4(1.0f, 1.0f, 0.0f, 0.0f) };
+			array.layers.push_back(chain(std::vector<unsigned char>(pixels, pixels + bytes), first.width, first.height, first.components, SIZE_MAX));
+			array.usedTexels += static_cast<size_t>(first.width) * first.height;
+			stats.usedBytes += bytes;
+			source->image.pixels.reset();
+			source->image.texels = MappedTexels();
+		}
+		arrays.push_back(std::move(array));
+	}
+
+	// shelf pack small textures of one channel count into pages, tallest first
+	void addPages(std::vector<Source*> &group, int components)
+	{
+		std::sort(group.begin(), group.end(), [](const Source *a, const Source *b)
+		{
+			return std::make_pair(a->image.height, a->image.width) > std::make_pair(b->image.height, b->image.width);
+		});
+
+		struct Cell
+		{
+			const Source *source;
+			int page;
+			int x;
+			int y;
+		};
+		std::vector<Cell> cells;
+		cells.reserve(group.size());
+		int page = 0, x = 0, y = 0, shelfHeight = 0, usedWidth = 0;
+		for (const Source *source : group)
+		{
+			const int width = alignUp(source->image.width + 2 * GUTTER, GUTTER);
+			const int height = alignUp(source->image.height + 2 * GUTTER, GUTTER);
+			if (x + width > PAGE_SIZE)
+			{
+				y += shelfHeight;
+				x = 0;
+				shelfHeight = 0;
+			}
+			if (y + height > PAGE_SIZE)
+			{
+				page++;
+				y = 0;
+			}
+			cells.push_back({ source, page, x, y });
+			x += width;
+			shelfHeight = std::max(shelfHeight, height);
+			usedWidth = std::max(usedWidth, x);
+		}
+		// a single page is trimmed to what it holds; page sizes stay multiples of the gutter so every
+		// kept level still divides evenly
+		const int pageWidth = page == 0 ? usedWidth : PAGE_SIZE;
+		const int pageHeight = page == 0 ? y + shelfHeight : PAGE_SIZE;
+
+		const size_t pageBytes = static_cast<size_t>(pageWidth) * pageHeight * components;
+		std::vector<std::vector<unsigned char>> pages(page + 1, std::vector<unsigned char>(pageBytes, 0));
+		const int index = static_cast<int>(arrays.size());
+		Array array = { pageWidth, pageHeight, components, true, {}, pages.size(), 0, 0 };
+		for (const Cell &cell : cells)
+		{
+			const DecodedImage &image = cell.source->image;
+			const int width = alignUp(image.width + 2 * GUTTER, GUTTER);
+			const int height = alignUp(image.height + 2 * GUTTER, GUTTER);
+			unsigned char *target = pages[cell.page].data();
+			// the whole cell, with texels outside the image clamped to its edge
+			for (int row = 0; row < height; row++)
+			{
+				const int sourceRow = std::min(std::max(row - GUTTER, 0), image.height - 1);
+				const unsigned char *sourceLine = image.basePixels() + static_cast<size_t>(sourceRow) * image.width * components;
+				unsigned char *targetLine = target + (static_cast<size_t>(cell.y + row) * pageWidth + cell.x) * components;
+				for (int column = 0; column < width; column++)
+				{
+					const int sourceColumn = std::min(std::max(column - GUTTER, 0), image.width - 1);
+					std::memcpy(targetLine + column * components, sourceLine + sourceColumn * components, components);
+				}
+			}
+			placements[cell.source->path] = { index, cell.page, glm::vec4(
+				static_cast<float>(image.width) / pageWidth, static_cast<float>(image.height) / pageHeight,
+				static_cast<float>(cell.x + GUTTER) / pageWidth, static_cast<float>(cell.y + GUTTER) / pageHeight) };
+			array.usedTexels += static_cast<size_t>(image.width) * image.height;
+			stats.usedBytes += static_cast<size_t>(image.width) * image.height * components;
+			stats.atlased++;
+		}
+		for (std::vector<unsigned char> &pixels : pages)
+		{
+			array.layers.push_back(chain(std::move(pixels), pageWidth, pageHeight, components, PAGE_LEVELS));
+		}
+		for (Source *source : group)
+		{
+			source->image.pixels.reset();
+			source->image.texels = MappedTexels();
+		}
+		arrays.push_back(std::move(array));
+	}
+};
+
+#endif
@@ -2,9 +2,18 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
+#include "bindless_textures.hpp"
+#include "geometry_arena.hpp"
+#include "mip_streamer.hpp"
 #include "shader.hpp"
+#include "texture_cache.hpp"
 
 struct Vertex
 {
@@ -13,11 +22,101 @@ struct Vertex
 	glm::vec2 TexCoords;
 };
 
+// Layout of the vertex buffer a Mesh uploads. The CPU copy in Mesh::vertices is always full precision.
+enum VertexFormat
+{
+	VERTEX_FULL,	// Vertex as is, 32 bytes, 32-bit indices
+	VERTEX_COMPACT	// CompactVertex, 16 bytes, 16-bit indices when the mesh has at most 65536 vertices
+};
+
+// Quantized vertex: positions are 16-bit unorm inside the mesh bounds and are mapped back by the
+// positionScale/positionOffset uniforms, normals are octahedral encoded snorm and texture coordinates
+// are half floats.
+struct CompactVertex
+{
+	uint16_t Position[4];
+	int16_t Normal[2];
+	uint16_t TexCoords[2];
+};
+
+// One level of detail: a range of the mesh's index buffer and its distance from the full surface.
+struct MeshLod
+{
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	float error;
+};
+
+// A small cluster of triangles (see meshlet.hpp): a contiguous range of the first level of detail.
+struct Meshlet
+{
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	unsigned int vertexCount;
+};
+
+// Culling bounds of every meshlet of a mesh, stored as separate arrays so four meshlets can be tested at
+// once. Each array is padded to a multiple of four. A meshlet's triangles all face away from any
+// viewer inside its normal cone, given by the cone axis and the sine of its half angle (`cutoff`).
+struct MeshletBounds
+{
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> axisX, axisY, axisZ, cutoff;
+};
+
+// A material texture of a mesh that has not been loaded yet.
+struct TextureRef
+{
+	std::string type;
+	std::string path;
+};
+
+// CPU-side geometry of one mesh, produced by the importer before any GL objects exist. `indices` holds
+// all levels of detail back to back as described by `lods`; an empty `lods` means one level. `meshlets`
+// is empty unless the importer was asked to build them.
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+	MeshletBounds meshletBounds;
+	std::vector<TextureRef> textures;
+};
+
+// Bounding sphere centered on the bounding box of the vertices.
+inline void computeBounds(const std::vector<Vertex> &vertices, glm::vec3 &center, float &radius)
+{
+	center = glm::vec3(0.0f);
+	radius = 0.0f;
+	if (vertices.empty())
+	{
+		return;
+	}
+	glm::vec3 minimum = vertices[0].Position, maximum = vertices[0].Position;
+	for (const Vertex &vertex : vertices)
+	{
+		minimum = glm::min(minimum, vertex.Position);
+		maximum = glm::max(maximum, vertex.Position);
+	}
+	center = (minimum + maximum) * 0.5f;
+	for (const Vertex &vertex : vertices)
+	{
+		radius = std::max(radius, glm::length(vertex.Position - center));
+	}
+}
+
 struct Texture
 {
 	unsigned int id;
 	std::string type;
 	std::string path;
+	// keeps the texture alive in the TextureCache
+	TextureHandle handle;
+	// packed textures (see material_atlas.hpp): id names a GL_TEXTURE_2D_ARRAY, and the texture is the
+	// rectangle of this layer that transform maps the texture coordinates onto
+	int layer = -1;
+	glm::vec4 transform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
 };
 
 
@@ -28,64 +127,336 @@ public:
 	std::vector<Vertex> vertices;
 	std::vector<unsigned int> indices;
 	std::vector<Texture> textures;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+	MeshletBounds meshletBounds;
+	VertexFormat format;
+	glm::vec3 boundsCenter;
+	float boundsRadius;
+	// maps quantized positions back to model space, identity for VERTEX_FULL
+	glm::vec3 positionScale = glm::vec3(1.0f);
+	glm::vec3 positionOffset = glm::vec3(0.0f);
 	
-	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+	// takes ownership of the arrays; pass rvalues to avoid copying the geometry
+	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, VertexFormat format = VERTEX_FULL, std::vector<MeshLod> lods = {})
+		: vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), lods(std::move(lods)), format(format)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-
+		if (this->lods.empty())
+		{
+			this->lods.push_back({ 0, static_cast<unsigned int>(this->indices.size()), 0.0f });
+		}
+		computeBounds(this->vertices, boundsCenter, boundsRadius);
 		setupMesh();
 	};
 
+	Mesh(MeshData &&data, std::vector<Texture> textures, VertexFormat format = VERTEX_FULL)
+		: Mesh(std::move(data.vertices), std::move(data.indices), std::move(textures), format, std::move(data.lods))
+	{
+		meshlets = std::move(data.meshlets);
+		meshletBounds = std::move(data.meshletBounds);
+	};
+
+
+	/*
+	* Draw one level of detail of the mesh.
+	* @param shader
+	* @param lod Index into lods, clamped to the coarsest level.
+	* @return void
+	*/
+	void Draw(Shader &shader, unsigned int lod = 0)
+	{
+		batch.clear();
+		appendLod(lod, batch);
+		DrawBatched(shader, batch);
+	}
+
+	/*
+	* Draw the full detail mesh, skipping culled meshlets. Neighbouring visible meshlets are merged so the
+	* whole set goes out in one multi-draw.
+	* @param shader
+	* @param visible One flag per meshlet, as filled in by Meshlets::cull.
+	* @return void
+	*/
+	void DrawMeshlets(Shader &shader, const std::vector<unsigned char> &visible)
+	{
+		batch.clear();
+		appendMeshlets(visible, batch);
+		DrawBatched(shader, batch);
+	}
+
+	/*
+	* Draw ranges gathered from this mesh and any meshes that canBatchWith it, using this mesh's material.
+	* @param shader
+	* @param batch
+	* @param bindTextures False when the last mesh drawn sharesTexturesWith this one, so its textures are still bound.
+	* @return void
+	*/
+	void DrawBatched(Shader &shader, const DrawBatch &batch, bool bindTextures = true)
+	{
+		if (batch.counts.empty())
+		{
+			return;
+		}
+		beginDraw(shader, bindTextures);
+		geometry.owner()->draw(batch);
+		endDraw(shader);
+	}
+
+	// Add one level of detail to a batch.
+	void appendLod(unsigned int lod, DrawBatch &batch) const
+	{
+		const GeometryArena::Range &range = geometry.range();
+		const size_t indexSize = geometry.owner()->indexSize();
+		const MeshLod &level = lods[std::min<size_t>(lod, lods.size() - 1)];
+		batch.add(level.indexCount, (range.firstIndex + level.indexOffset) * indexSize, range.baseVertex, indexSize);
+	}
+
+	// Add the visible meshlets to a batch.
+	void appendMeshlets(const std::vector<unsigned char> &visible, DrawBatch &batch) const
+	{
+		const GeometryArena::Range &range = geometry.range();
+		const size_t indexSize = geometry.owner()->indexSize();
+		for (size_t i = 0; i < meshlets.size(); i++)
+		{
+			if (visible[i])
+			{
+				batch.add(meshlets[i].indexCount, (range.firstIndex + meshlets[i].indexOffset) * indexSize, range.baseVertex, indexSize);
+			}
+		}
+	}
+
+	// True when both meshes live in the same arena and draw with identical state, so their ranges can
+	// share one multi-draw. Compact meshes carry their own dequantization uniforms and never batch.
+	bool canBatchWith(const Mesh &other) const
+	{
+		if (geometry.owner() != other.geometry.owner() || format != VERTEX_FULL || other.format != VERTEX_FULL ||
+			textures.size() != other.textures.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			if (textures[i].id != other.textures[i].id || textures[i].type != other.textures[i].type ||
+				textures[i].layer != other.textures[i].layer || textures[i].transform != other.textures[i].transform)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// True when both meshes bind the same textures to the same units, which for packed textures holds
+	// across different layers of the same arrays.
+	bool sharesTexturesWith(const Mesh &other) const
+	{
+		if (textures.size() != other.textures.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			if (textures[i].id != other.textures[i].id || (textures[i].layer >= 0) != (other.textures[i].layer >= 0))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+	* Shared arena holding all meshes of one vertex format and index type.
+	* @param format
+	* @param indexType GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+	* @return GeometryArena&
+	*/
+	static GeometryArena &arenaFor(VertexFormat format, GLenum indexType)
+	{
+		static GeometryArena full(sizeof(Vertex), GL_UNSIGNED_INT, setupFullAttributes);
+		static GeometryArena compactShort(sizeof(CompactVertex), GL_UNSIGNED_SHORT, setupCompactAttributes);
+		static GeometryArena compactInt(sizeof(CompactVertex), GL_UNSIGNED_INT, setupCompactAttributes);
+		if (format == VERTEX_FULL)
+		{
+			return full;
+		}
+		return indexType == GL_UNSIGNED_SHORT ? compactShort : compactInt;
+	}
+	
+private:
+	GeometryArena::Handle geometry;
+	// scratch for Draw and DrawMeshlets, kept to avoid allocating every frame
+	DrawBatch batch;
+	// slot of the textures in the bindless Materials block, -1 while they are bound the usual way
+	int material = -1;
+
+	// names of the uniforms each texture is bound through, hashed once rather than built every draw
+	struct TextureUniforms
+	{
+		UniformName sampler;
+		UniformName array;
+		UniformName layer;
+		UniformName transform;
+	};
+	std::vector<TextureUniforms> textureUniforms;
 
-	void Draw(Shader &shader)
+	void nameTextureUniforms()
 	{
 		unsigned int diffuseNr = 1;
 		unsigned int specularNr = 1;
-		shader.use();
-		for (unsigned int i = 0; i < textures.size(); i++)
+		textureUniforms.clear();
+		for (const Texture &texture : textures)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
 			std::string number;
-			std::string name = textures[i].type;
-			if (name == "texture_diffuse")
+			if (texture.type == "texture_diffuse")
 			{
 				number = std::to_string(diffuseNr++);
 			}
-			else if (name == "texture_specular")
+			else if (texture.type == "texture_specular")
 			{
 				number = std::to_string(specularNr++);
 			}
-			shader.setFloat(("material." + name + number).c_str(), i);
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			const std::string uniform = "material." + texture.type + number;
+			textureUniforms.push_back({ uniform, uniform + ".array", uniform + ".layer", uniform + ".transform" });
+		}
+	}
+
+	// Look up the bindless slot of the first diffuse and specular texture. Packed textures are arrays,
+	// which the Materials block does not hold, so those meshes keep binding.
+	bool bindlessMaterial(BindlessTextures &bindless)
+	{
+		if (material >= 0)
+		{
+			return true;
+		}
+		unsigned int diffuse = 0, specular = 0;
+		for (const Texture &texture : textures)
+		{
+			if (texture.layer >= 0)
+			{
+				return false;
+			}
+			if (texture.type == "texture_diffuse" && diffuse == 0)
+				diffuse = texture.id;
+			else if (texture.type == "texture_specular" && specular == 0)
+				specular = texture.id;
+		}
+		material = bindless.material(diffuse, specular);
+		return material >= 0;
+	}
+
+	// bind the material and the vertex array
+	void beginDraw(Shader &shader, bool bindTextures)
+	{
+		shader.use();
+		// with bindless textures the shader reads the handles from the material's slot instead
+		BindlessTextures &bindless = BindlessTextures::shared();
+		const bool bindlessDraw = bindless.enabled() && bindlessMaterial(bindless);
+		if (bindless.enabled())
+		{
+			bindless.attach(shader.ID);
+			shader.setInt(UniformNames::MATERIAL_INDEX, bindlessDraw ? material : -1);
+		}
+		if (bindlessDraw)
+		{
+			bindless.use(material);
+		}
+		// the feedback pass records which textures cover each pixel
+		if (MipStreamer *feedback = MipStreamer::recording())
+		{
+			std::vector<unsigned int> ids;
+			for (const Texture &texture : textures)
+			{
+				ids.push_back(texture.id);
+			}
+			shader.setInt(UniformNames::FEEDBACK_SLOT, feedback->feedbackSlot(ids));
+		}
+		if (textureUniforms.size() != textures.size())
+		{
+			nameTextureUniforms();
+		}
+		for (unsigned int i = 0; i < textures.size() && !bindlessDraw; i++)
+		{
+			const TextureUniforms &uniform = textureUniforms[i];
+			if (textures[i].layer >= 0)
+			{
+				// packed: the shader samples a sampler2DArray and remaps its coordinates
+				const glm::vec4 &transform = textures[i].transform;
+				shader.setInt(uniform.array, i);
+				shader.setFloat(uniform.layer, static_cast<float>(textures[i].layer));
+				shader.setVec4(uniform.transform, transform.x, transform.y, transform.z, transform.w);
+			}
+			else
+			{
+				shader.setInt(uniform.sampler, i);
+			}
+			if (bindTextures)
+			{
+				glActiveTexture(GL_TEXTURE0 + i);
+				glBindTexture(textures[i].layer >= 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, textures[i].id);
+			}
 		}
 		
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-		
+		// compact meshes need their dequantization uniforms, and put the defaults back afterwards so
+		// full precision geometry drawn with the same program is not affected
+		if (format == VERTEX_COMPACT)
+		{
+			shader.setVec3(UniformNames::POSITION_SCALE, positionScale);
+			shader.setVec3(UniformNames::POSITION_OFFSET, positionOffset);
+			shader.setBool(UniformNames::OCTAHEDRAL_NORMALS, true);
+		}
+
+		glBindVertexArray(geometry.owner()->vertexArray());
+	}
+
+	void endDraw(Shader &shader)
+	{
 		glBindVertexArray(0);
 		glActiveTexture(GL_TEXTURE0);
+		// objects drawn with their own bound textures and the same program must not pick up the slot
+		if (BindlessTextures::shared().enabled())
+		{
+			shader.setInt(UniformNames::MATERIAL_INDEX, -1);
+		}
+
+		if (format == VERTEX_COMPACT)
+		{
+			shader.setVec3(UniformNames::POSITION_SCALE, glm::vec3(1.0f));
+			shader.setVec3(UniformNames::POSITION_OFFSET, glm::vec3(0.0f));
+			shader.setBool(UniformNames::OCTAHEDRAL_NORMALS, false);
+		}
 	}
-	
-private:
-	unsigned int VAO, VBO, EBO;
 
 	void setupMesh()
 	{
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-		
-		glBindVertexArray(VAO);
-
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		if (format == VERTEX_COMPACT)
+		{
+			setupCompact();
+		}
+		else
+		{
+			geometry = arenaFor(VERTEX_FULL, GL_UNSIGNED_INT).allocate(vertices.data(), static_cast<unsigned int>(vertices.size()),
+				indices.data(), static_cast<unsigned int>(indices.size()));
+		}
+	}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	void setupCompact()
+	{
+		std::vector<CompactVertex> packed = packVertices();
+		const unsigned int vertexCount = static_cast<unsigned int>(packed.size());
+		const unsigned int indexCount = static_cast<unsigned int>(indices.size());
+		if (vertices.size() <= 65536)
+		{
+			std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+			geometry = arenaFor(VERTEX_COMPACT, GL_UNSIGNED_SHORT).allocate(packed.data(), vertexCount, shortIndices.data(), indexCount);
+		}
+		else
+		{
+			geometry = arenaFor(VERTEX_COMPACT, GL_UNSIGNED_INT).allocate(packed.data(), vertexCount, indices.data(), indexCount);
+		}
+	}
 
+	// attribute layouts, called by the arenas with their vertex buffer bound
+	static void setupFullAttributes()
+	{
 		// vertex positions
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -95,7 +466,70 @@ private:
 
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+	}
 
-		glBindVertexArray(0);
+	static void setupCompactAttributes()
+	{
+		// vertex positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Position));
+
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Normal));
+
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, TexCoords));
+	}
+
+	// Quantize the vertices and set positionScale/positionOffset to the mesh bounds.
+	std::vector<CompactVertex> packVertices()
+	{
+		glm::vec3 minimum(0.0f), maximum(0.0f);
+		if (!vertices.empty())
+		{
+			minimum = maximum = vertices[0].Position;
+		}
+		for (const Vertex &vertex : vertices)
+		{
+			minimum = glm::min(minimum, vertex.Position);
+			maximum = glm::max(maximum, vertex.Position);
+		}
+		const glm::vec3 extent = maximum - minimum;
+		positionOffset = minimum;
+		positionScale = glm::vec3(extent.x > 0.0f ? extent.x : 1.0f, extent.y > 0.0f ? extent.y : 1.0f, extent.z > 0.0f ? extent.z : 1.0f);
+
+		std::vector<CompactVertex> packed(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const glm::vec3 normalized = (vertices[i].Position - positionOffset) / positionScale;
+			packed[i].Position[0] = glm::packUnorm1x16(normalized.x);
+			packed[i].Position[1] = glm::packUnorm1x16(normalized.y);
+			packed[i].Position[2] = glm::packUnorm1x16(normalized.z);
+			packed[i].Position[3] = 0;
+			const glm::vec2 octahedral = encodeOctahedral(vertices[i].Normal);
+			packed[i].Normal[0] = static_cast<int16_t>(glm::packSnorm1x16(octahedral.x));
+			packed[i].Normal[1] = static_cast<int16_t>(glm::packSnorm1x16(octahedral.y));
+			packed[i].TexCoords[0] = glm::packHalf1x16(vertices[i].TexCoords.x);
+			packed[i].TexCoords[1] = glm::packHalf1x16(vertices[i].TexCoords.y);
+		}
+		return packed;
+	}
+
+	// Map a unit vector onto the octahedron and unfold it into [-1, 1]^2.
+	static glm::vec2 encodeOctahedral(glm::vec3 normal)
+	{
+		const float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		if (length == 0.0f)
+		{
+			return glm::vec2(0.0f);
+		}
+		normal /= length;
+		glm::vec2 encoded(normal.x, normal.y);
+		if (normal.z < 0.0f)
+		{
+			encoded.x = (1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+			encoded.y = (1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return encoded;
 	}
 };
\ No newline at end of file
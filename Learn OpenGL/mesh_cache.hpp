@@ -0,0 +1,326 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+
+// Cooked meshes are the final Vertex/index/LOD arrays written straight to disk, so a warm start maps one file
+// and hands the arrays to Mesh instead of running Assimp. Bump the version whenever Vertex or the
+// layout below changes.
+namespace MeshCache
+{
+	const char MAGIC[4] = { 'L', 'O', 'M', 'C' };
+	const uint32_t VERSION = 3;
+	const size_t DATA_ALIGNMENT = 16;
+
+	// Identifies the source a cooked file was built from. A cooked file is only used when all fields match.
+	struct Key
+	{
+		uint64_t sourceMtime = 0;
+		uint64_t sourceSize = 0;
+		uint64_t pathHash = 0;
+		uint32_t importFlags = 0;
+		uint32_t importProfile = 0;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t importFlags;
+		uint32_t meshCount;
+		uint64_t sourceMtime;
+		uint64_t sourceSize;
+		uint64_t pathHash;
+		uint32_t vertexSize;
+		uint32_t textureCount;
+		uint32_t importProfile;
+		uint32_t reserved;
+		uint64_t stringsOffset;
+		uint64_t stringsSize;
+	};
+
+	struct MeshRecord
+	{
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint64_t lodOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t lodCount;
+		uint32_t firstTexture;
+		uint32_t textureCount;
+		uint32_t reserved;
+	};
+
+	struct TextureRecord
+	{
+		uint32_t typeOffset;
+		uint32_t typeLength;
+		uint32_t pathOffset;
+		uint32_t pathLength;
+	};
+
+	// Views into the mapped file; only valid while the owning CookedModel is alive.
+	struct CookedMesh
+	{
+		const Vertex* vertices;
+		uint32_t vertexCount;
+		const unsigned int* indices;
+		uint32_t indexCount;
+		const MeshLod* lods;
+		uint32_t lodCount;
+		std::vector<TextureRef> textures;
+	};
+
+	/*
+	* Build the cache key for a source asset.
+	* @param[in] sourcePath Path of the model file.
+	* @param[in] importFlags Assimp post-process flags the model is imported with.
+	* @param[in] importProfile Optimization profile the meshes are processed with.
+	* @param[out] key
+	* @return false if the source does not exist.
+	*/
+	inline bool makeKey(const std::string& sourcePath, uint32_t importFlags, uint32_t importProfile, Key& key)
+	{
+		std::error_code error;
+		const auto mtime = std::filesystem::last_write_time(sourcePath, error);
+		if (error)
+			return false;
+		const auto size = std::filesystem::file_size(sourcePath, error);
+		if (error)
+			return false;
+		key.sourceMtime = static_cast<uint64_t>(mtime.time_since_epoch().count());
+		key.sourceSize = static_cast<uint64_t>(size);
+		key.pathHash = hashString(sourcePath);
+		key.importFlags = importFlags;
+		key.importProfile = importProfile;
+		return true;
+	}
+
+	inline std::string cachePathFor(const std::string& sourcePath)
+	{
+		return sourcePath + ".cooked";
+	}
+
+	inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	class CookedModel
+	{
+	public:
+		std::vector<CookedMesh> meshes;
+
+		/*
+		* Map a cooked file and validate it against the key.
+		* @param[in] cachePath
+		* @param[in] key Key of the current source asset.
+		* @return false if the file is missing, stale or malformed.
+		*/
+		bool open(const std::string& cachePath, const Key& key)
+		{
+			meshes.clear();
+			if (!file.open(cachePath))
+				return false;
+
+			const unsigned char* base = file.data();
+			const size_t size = file.size();
+			if (size < sizeof(Header))
+				return fail();
+			Header header;
+			std::memcpy(&header, base, sizeof(Header));
+			if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+				header.vertexSize != sizeof(Vertex) || header.importFlags != key.importFlags ||
+				header.importProfile != key.importProfile ||
+				header.sourceMtime != key.sourceMtime || header.sourceSize != key.sourceSize ||
+				header.pathHash != key.pathHash)
+				return fail();
+
+			const uint64_t recordsEnd = sizeof(Header) + uint64_t(header.meshCount) * sizeof(MeshRecord) +
+				uint64_t(header.textureCount) * sizeof(TextureRecord);
+			if (recordsEnd > size || header.stringsOffset + header.stringsSize > size)
+				return fail();
+
+			const MeshRecord* meshRecords = reinterpret_cast<const MeshRecord*>(base + sizeof(Header));
+			const TextureRecord* textureRecords = reinterpret_cast<const TextureRecord*>(meshRecords + header.meshCount);
+			const char* strings = reinterpret_cast<const char*>(base + header.stringsOffset);
+
+			meshes.reserve(header.meshCount);
+			for (uint32_t i = 0; i < header.meshCount; i++)
+			{
+				const MeshRecord& record = meshRecords[i];
+				if (record.vertexOffset + uint64_t(record.vertexCount) * sizeof(Vertex) > size ||
+					record.indexOffset + uint64_t(record.indexCount) * sizeof(unsigned int) > size ||
+					record.lodOffset + uint64_t(record.lodCount) * sizeof(MeshLod) > size ||
+					uint64_t(record.firstTexture) + record.textureCount > header.textureCount)
+					return fail();
+				// every level of detail must draw from the mesh's own indices
+				const MeshLod* lods = reinterpret_cast<const MeshLod*>(base + record.lodOffset);
+				for (uint32_t l = 0; l < record.lodCount; l++)
+				{
+					if (uint64_t(lods[l].indexOffset) + lods[l].indexCount > record.indexCount)
+						return fail();
+				}
+
+				CookedMesh mesh;
+				mesh.vertices = reinterpret_cast<const Vertex*>(base + record.vertexOffset);
+				mesh.vertexCount = record.vertexCount;
+				mesh.indices = reinterpret_cast<const unsigned int*>(base + record.indexOffset);
+				mesh.indexCount = record.indexCount;
+				mesh.lods = lods;
+				mesh.lodCount = record.lodCount;
+				for (uint32_t t = 0; t < record.textureCount; t++)
+				{
+					const TextureRecord& texture = textureRecords[record.firstTexture + t];
+					if (uint64_t(texture.typeOffset) + texture.typeLength > header.stringsSize ||
+						uint64_t(texture.pathOffset) + texture.pathLength > header.stringsSize)
+						return fail();
+					mesh.textures.push_back({ std::string(strings + texture.typeOffset, texture.typeLength),
+						std::string(strings + texture.pathOffset, texture.pathLength) });
+				}
+				meshes.push_back(std::move(mesh));
+			}
+			return true;
+		}
+
+	private:
+		MappedFile file;
+
+		bool fail()
+		{
+			meshes.clear();
+			file.close();
+			return false;
+		}
+	};
+
+	/*
+	* Write the final meshes of a model to a cooked file. The file is written next to its final name and
+	* renamed into place so a crash never leaves a truncated cache behind.
+	* @param[in] cachePath
+	* @param[in] key Key of the source the meshes were imported from.
+	* @param[in] meshes Imported meshes with their texture references.
+	* @return true on success.
+	*/
+	inline bool write(const std::string& cachePath, const Key& key, const std::vector<MeshData>& meshes)
+	{
+		std::vector<MeshRecord> meshRecords(meshes.size());
+		std::vector<TextureRecord> textureRecords;
+		std::string strings;
+
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			meshRecords[i].firstTexture = static_cast<uint32_t>(textureRecords.size());
+			meshRecords[i].textureCount = static_cast<uint32_t>(meshes[i].textures.size());
+			for (const TextureRef& texture : meshes[i].textures)
+			{
+				TextureRecord record;
+				record.typeOffset = static_cast<uint32_t>(strings.size());
+				record.typeLength = static_cast<uint32_t>(texture.type.size());
+				strings += texture.type;
+				record.pathOffset = static_cast<uint32_t>(strings.size());
+				record.pathLength = static_cast<uint32_t>(texture.path.size());
+				strings += texture.path;
+				textureRecords.push_back(record);
+			}
+		}
+
+		Header header;
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.importFlags = key.importFlags;
+		header.meshCount = static_cast<uint32_t>(meshes.size());
+		header.sourceMtime = key.sourceMtime;
+		header.sourceSize = key.sourceSize;
+		header.pathHash = key.pathHash;
+		header.vertexSize = sizeof(Vertex);
+		header.textureCount = static_cast<uint32_t>(textureRecords.size());
+		header.importProfile = key.importProfile;
+		header.reserved = 0;
+		header.stringsOffset = sizeof(Header) + meshRecords.size() * sizeof(MeshRecord) + textureRecords.size() * sizeof(TextureRecord);
+		header.stringsSize = strings.size();
+
+		// vertex and index arrays follow the strings, each aligned so they can be read in place
+		uint64_t offset = header.stringsOffset + header.stringsSize;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			offset = alignUp(offset, DATA_ALIGNMENT);
+			meshRecords[i].vertexOffset = offset;
+			meshRecords[i].vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+			offset += meshes[i].vertices.size() * sizeof(Vertex);
+			offset = alignUp(offset, DATA_ALIGNMENT);
+			meshRecords[i].indexOffset = offset;
+			meshRecords[i].indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+			offset += meshes[i].indices.size() * sizeof(unsigned int);
+			offset = alignUp(offset, DATA_ALIGNMENT);
+			meshRecords[i].lodOffset = offset;
+			meshRecords[i].lodCount = static_cast<uint32_t>(meshes[i].lods.size());
+			meshRecords[i].reserved = 0;
+			offset += meshes[i].lods.size() * sizeof(MeshLod);
+		}
+
+		const std::string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				std::cout << "ERROR::MESH_CACHE::FILE_NOT_WRITABLE " << tempPath << std::endl;
+				return false;
+			}
+			uint64_t written = 0;
+			auto put = [&](const void* data, size_t size)
+			{
+				out.write(static_cast<const char*>(data), size);
+				written += size;
+			};
+			auto pad = [&](uint64_t target)
+			{
+				static const char zeros[DATA_ALIGNMENT] = {};
+				put(zeros, static_cast<size_t>(target - written));
+			};
+
+			put(&header, sizeof(Header));
+			put(meshRecords.data(), meshRecords.size() * sizeof(MeshRecord));
+			put(textureRecords.data(), textureRecords.size() * sizeof(TextureRecord));
+			put(strings.data(), strings.size());
+			for (size_t i = 0; i < meshes.size(); i++)
+			{
+				pad(meshRecords[i].vertexOffset);
+				put(meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+				pad(meshRecords[i].indexOffset);
+				put(meshes[i].indices.data(), meshes[i].indices.size() * sizeof(unsigned int));
+				pad(meshRecords[i].lodOffset);
+				put(meshes[i].lods.data(), meshes[i].lods.size() * sizeof(MeshLod));
+			}
+			if (!out)
+			{
+				std::cout << "ERROR::MESH_CACHE::WRITE_FAILED " << tempPath << std::endl;
+				return false;
+			}
+		}
+
+		std::remove(cachePath.c_str());
+		if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+		{
+			std::cout << "ERROR::MESH_CACHE::RENAME_FAILED " << cachePath << std::endl;
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+#endif
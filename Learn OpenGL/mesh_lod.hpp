@@ -0,0 +1,327 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+#include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+
+// Level of detail generation by quadric error edge collapse (Garland and Heckbert, "Surface Simplification
+// Using Quadric Error Metrics"). Every level is an index buffer into the unchanged vertex buffer, so the
+// levels of a mesh share one VBO. Vertices on open borders and on attribute seams (several vertices at the
+// same position) never move, which keeps UV seams and holes intact.
+namespace MeshLodGenerator
+{
+	// levels including the full resolution one
+	const unsigned int MAX_LODS = 4;
+	// stop the chain when a level keeps more than this fraction of the previous level's triangles
+	const float MIN_REDUCTION = 0.85f;
+	// largest allowed simplification error as a fraction of the mesh bounding radius
+	const float MAX_ERROR_FRACTION = 0.1f;
+
+	// Symmetric 4x4 error matrix plus the summed triangle area it was built from.
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+		double a11 = 0, a12 = 0, a13 = 0;
+		double a22 = 0, a23 = 0;
+		double a33 = 0;
+		double weight = 0;
+
+		void addPlane(const glm::dvec3& n, double d, double w)
+		{
+			a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+			a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+			a22 += w * n.z * n.z; a23 += w * n.z * d;
+			a33 += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+			a11 += q.a11; a12 += q.a12; a13 += q.a13;
+			a22 += q.a22; a23 += q.a23;
+			a33 += q.a33;
+			weight += q.weight;
+		}
+
+		// area weighted sum of squared distances to the planes
+		double evaluate(const glm::dvec3& p) const
+		{
+			const double result =
+				a00 * p.x * p.x + 2.0 * a01 * p.x * p.y + 2.0 * a02 * p.x * p.z + 2.0 * a03 * p.x +
+				a11 * p.y * p.y + 2.0 * a12 * p.y * p.z + 2.0 * a13 * p.y +
+				a22 * p.z * p.z + 2.0 * a23 * p.z +
+				a33;
+			return result > 0.0 ? result : 0.0;
+		}
+	};
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		double cost;
+	};
+
+	inline uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+	}
+
+	// vertices that must not move: open border vertices and vertices sharing their position with another one
+	inline std::vector<char> findLockedVertices(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+	{
+		std::vector<char> locked(vertices.size(), 0);
+
+		struct PositionHasher
+		{
+			size_t operator()(const glm::vec3& p) const { return static_cast<size_t>(hashBytes(&p, sizeof(p))); }
+		};
+		struct PositionEqual
+		{
+			bool operator()(const glm::vec3& a, const glm::vec3& b) const { return std::memcmp(&a, &b, sizeof(a)) == 0; }
+		};
+		std::unordered_map<glm::vec3, unsigned int, PositionHasher, PositionEqual> positions;
+		positions.reserve(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			auto inserted = positions.emplace(vertices[v].Position, static_cast<unsigned int>(v));
+			if (!inserted.second)
+			{
+				locked[v] = 1;
+				locked[inserted.first->second] = 1;
+			}
+		}
+
+		std::unordered_map<uint64_t, unsigned int> edges;
+		edges.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				edges[edgeKey(indices[i + k], indices[i + (k + 1) % 3])]++;
+			}
+		}
+		for (const auto& edge : edges)
+		{
+			if (edge.second == 1)
+			{
+				locked[edge.first >> 32] = 1;
+				locked[edge.first & 0xffffffffu] = 1;
+			}
+		}
+		return locked;
+	}
+
+	// Would moving `from` onto `to` turn any surviving triangle around `from` over?
+	inline bool flipsTriangle(const Collapse& collapse, const std::vector<glm::dvec3>& positions, const std::vector<unsigned int>& indices,
+		const std::vector<unsigned int>& triangleOffsets, const std::vector<unsigned int>& vertexTriangles)
+	{
+		for (unsigned int i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++)
+		{
+			const unsigned int* triangle = &indices[size_t(vertexTriangles[i]) * 3];
+			if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				continue;
+			glm::dvec3 corners[3];
+			glm::dvec3 moved[3];
+			for (int k = 0; k < 3; k++)
+			{
+				corners[k] = positions[triangle[k]];
+				moved[k] = triangle[k] == collapse.from ? positions[collapse.to] : corners[k];
+			}
+			const glm::dvec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			const glm::dvec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+			if (glm::dot(before, after) <= 0.0)
+				return true;
+		}
+		return false;
+	}
+
+	/*
+	* Simplify a triangle list by collapsing edges until it has at most targetIndexCount indices or the next
+	* collapse would exceed maxError.
+	* @param[in] vertices
+	* @param[in] indices Triangle list to simplify.
+	* @param[in] targetIndexCount
+	* @param[in] maxError Largest allowed distance from the original surface, in model units.
+	* @param[out] resultError Error of the returned triangle list.
+	* @return simplified triangle list referring to the same vertices.
+	*/
+	inline std::vector<unsigned int> simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+		size_t targetIndexCount, float maxError, float& resultError)
+	{
+		resultError = 0.0f;
+		std::vector<unsigned int> result(indices.begin(), indices.begin() + indices.size() / 3 * 3);
+		const size_t vertexCount = vertices.size();
+		if (result.size() <= targetIndexCount || vertexCount == 0)
+			return result;
+
+		const std::vector<char> locked = findLockedVertices(vertices, result);
+
+		std::vector<glm::dvec3> positions(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			positions[v] = glm::dvec3(vertices[v].Position);
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			const glm::dvec3& p0 = positions[result[i]];
+			const glm::dvec3 normal = glm::cross(positions[result[i + 1]] - p0, positions[result[i + 2]] - p0);
+			const double length = glm::length(normal);
+			if (length <= 0.0)
+				continue;
+			const glm::dvec3 n = normal / length;
+			const double area = length * 0.5;
+			for (int k = 0; k < 3; k++)
+			{
+				quadrics[result[i + k]].addPlane(n, -glm::dot(n, p0), area);
+			}
+		}
+
+		const double maxErrorSq = double(maxError) * double(maxError);
+		double usedErrorSq = 0.0;
+		std::vector<unsigned int> remap(vertexCount);
+		std::vector<char> touched(vertexCount);
+		std::vector<unsigned int> triangleOffsets(vertexCount + 1);
+		std::vector<unsigned int> vertexTriangles;
+		std::vector<Collapse> collapses;
+
+		while (result.size() > targetIndexCount)
+		{
+			const size_t triangleCount = result.size() / 3;
+
+			// triangles around each vertex, for the flip test
+			std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+			for (unsigned int index : result)
+			{
+				triangleOffsets[index + 1]++;
+			}
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				triangleOffsets[v + 1] += triangleOffsets[v];
+			}
+			vertexTriangles.resize(result.size());
+			{
+				std::vector<unsigned int> cursor(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (size_t i = 0; i < result.size(); i++)
+				{
+					vertexTriangles[cursor[result[i]]++] = static_cast<unsigned int>(i / 3);
+				}
+			}
+
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					const unsigned int a = result[i + k];
+					const unsigned int b = result[i + (k + 1) % 3];
+					Quadric q = quadrics[a];
+					q.add(quadrics[b]);
+					const double weight = q.weight > 0.0 ? q.weight : 1.0;
+					if (!locked[a])
+						collapses.push_back({ a, b, q.evaluate(positions[b]) / weight });
+					if (!locked[b])
+						collapses.push_back({ b, a, q.evaluate(positions[a]) / weight });
+				}
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				remap[v] = static_cast<unsigned int>(v);
+			}
+			std::fill(touched.begin(), touched.end(), 0);
+
+			// an interior collapse removes two triangles
+			const size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+			size_t removed = 0;
+			size_t performed = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (collapse.cost > maxErrorSq || removed >= trianglesToRemove)
+					break;
+				if (touched[collapse.from] || touched[collapse.to])
+					continue;
+				if (flipsTriangle(collapse, positions, result, triangleOffsets, vertexTriangles))
+					continue;
+
+				remap[collapse.from] = collapse.to;
+				touched[collapse.from] = 1;
+				touched[collapse.to] = 1;
+				quadrics[collapse.to].add(quadrics[collapse.from]);
+				usedErrorSq = std::max(usedErrorSq, collapse.cost);
+				removed += 2;
+				performed++;
+			}
+			if (performed == 0)
+				break;
+
+			size_t write = 0;
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				const unsigned int a = remap[result[t * 3]];
+				const unsigned int b = remap[result[t * 3 + 1]];
+				const unsigned int c = remap[result[t * 3 + 2]];
+				if (a == b || b == c || a == c)
+					continue;
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		resultError = static_cast<float>(std::sqrt(usedErrorSq));
+		return result;
+	}
+
+	/*
+	* Append a chain of simplified levels to the mesh. LOD 0 is the existing index list; each further level
+	* aims for half the triangles of the previous one and is itself ordered for the vertex cache.
+	* @param[in,out] data Mesh whose indices become the concatenated levels described by data.lods.
+	* @return void
+	*/
+	inline void generate(MeshData& data)
+	{
+		data.lods.clear();
+		data.lods.push_back({ 0, static_cast<unsigned int>(data.indices.size()), 0.0f });
+		if (data.indices.size() < 3 * 64)
+			return;
+
+		glm::vec3 center;
+		float radius;
+		computeBounds(data.vertices, center, radius);
+		const float maxError = radius * MAX_ERROR_FRACTION;
+
+		std::vector<unsigned int> previous = data.indices;
+		float error = 0.0f;
+		for (unsigned int level = 1; level < MAX_LODS; level++)
+		{
+			float levelError = 0.0f;
+			std::vector<unsigned int> simplified = simplify(data.vertices, previous, previous.size() / 6 * 3, maxError, levelError);
+			if (simplified.empty() || float(simplified.size()) > float(previous.size()) * MIN_REDUCTION)
+				break;
+			MeshOptimizer::optimizeVertexCache(simplified, data.vertices.size());
+
+			// each level is simplified from the previous one, so their errors add up
+			error += levelError;
+			data.lods.push_back({ static_cast<unsigned int>(data.indices.size()), static_cast<unsigned int>(simplified.size()), error });
+			data.indices.insert(data.indices.end(), simplified.begin(), simplified.end());
+			previous.swap(simplified);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+#include "hash.hpp"
+#include "mesh.hpp"
+
+// Import-time passes that make indexed triangle lists cheaper to draw. None of them touch GL, so they
+// run on the import workers next to the Assimp conversion.
+namespace MeshOptimizer
+{
+	// size of the FIFO cache the statistics are simulated against
+	const unsigned int ANALYZE_CACHE_SIZE = 16;
+	// size of the LRU cache the reordering optimizes for
+	const int OPTIMIZE_CACHE_SIZE = 32;
+	// triangles per overdraw cluster before a cache restart is allowed to start a new one
+	const size_t MIN_CLUSTER_TRIANGLES = 32;
+
+	struct VertexCacheStats
+	{
+		float acmr = 0.0f; // average cache misses per triangle, 0.5 is the best case for a regular grid
+		float atvr = 0.0f; // average transformations per referenced vertex, 1.0 is the best case
+	};
+
+	struct Report
+	{
+		VertexCacheStats before;
+		VertexCacheStats after;
+		size_t verticesBefore = 0;
+		size_t verticesAfter = 0;
+	};
+
+	/*
+	* Simulate a FIFO post-transform cache over an index buffer.
+	* @param[in] indices Triangle list.
+	* @param[in] vertexCount Number of vertices the indices refer to.
+	* @param[in] cacheSize Number of cache entries.
+	* @return VertexCacheStats
+	*/
+	inline VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = ANALYZE_CACHE_SIZE)
+	{
+		VertexCacheStats stats;
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return stats;
+
+		// a vertex is in the cache while fewer than cacheSize misses happened since it was last loaded
+		std::vector<unsigned int> timestamps(vertexCount, 0);
+		unsigned int time = cacheSize + 1;
+		size_t misses = 0;
+		size_t referenced = 0;
+		for (unsigned int index : indices)
+		{
+			if (timestamps[index] == 0)
+				referenced++;
+			if (time - timestamps[index] > cacheSize)
+			{
+				timestamps[index] = time++;
+				misses++;
+			}
+		}
+		stats.acmr = float(misses) / float(triangleCount);
+		stats.atvr = float(misses) / float(referenced);
+		return stats;
+	}
+
+	struct VertexHasher
+	{
+		size_t operator()(const Vertex& vertex) const
+		{
+			return static_cast<size_t>(hashBytes(&vertex, sizeof(Vertex)));
+		}
+	};
+
+	struct VertexEqual
+	{
+		bool operator()(const Vertex& a, const Vertex& b) const
+		{
+			return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+
+	/*
+	* Merge bitwise identical vertices and remap the indices onto the survivors.
+	* @param[in,out] data
+	* @return void
+	*/
+	inline void weldVertices(MeshData& data)
+	{
+		static_assert(sizeof(Vertex) == 8 * sizeof(float), "Vertex must not contain padding to be compared bytewise");
+		std::unordered_map<Vertex, unsigned int, VertexHasher, VertexEqual> unique;
+		unique.reserve(data.vertices.size());
+		std::vector<unsigned int> remap(data.vertices.size());
+		std::vector<Vertex> welded;
+		welded.reserve(data.vertices.size());
+		for (size_t i = 0; i < data.vertices.size(); i++)
+		{
+			auto inserted = unique.emplace(data.vertices[i], static_cast<unsigned int>(welded.size()));
+			if (inserted.second)
+				welded.push_back(data.vertices[i]);
+			remap[i] = inserted.first->second;
+		}
+		for (unsigned int& index : data.indices)
+		{
+			index = remap[index];
+		}
+		data.vertices = std::move(welded);
+	}
+
+	// Forsyth's vertex score: recently used vertices and vertices with few remaining triangles score higher.
+	inline float scoreVertex(int cachePosition, unsigned int remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+			return -1.0f;
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// the last triangle's vertices get a fixed score so the next triangle does not just reuse its edge
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.0f - float(cachePosition - 3) / float(OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+		}
+		return score + 2.0f / std::sqrt(float(remainingTriangles));
+	}
+
+	/*
+	* Reorder triangles for post-transform cache hits (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation").
+	* @param[in,out] indices Triangle list.
+	* @param[in] vertexCount
+	* @return void
+	*/
+	inline void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		// per-vertex lists of the triangles that still have to be emitted
+		std::vector<unsigned int> remaining(vertexCount, 0);
+		for (unsigned int index : indices)
+		{
+			remaining[index]++;
+		}
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] = offsets[v] + remaining[v];
+		}
+		std::vector<unsigned int> adjacency(indices.size());
+		{
+			std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					adjacency[cursor[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+				}
+			}
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			vertexScore[v] = scoreVertex(-1, remaining[v]);
+		}
+
+		std::vector<char> emitted(triangleCount, 0);
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		std::vector<unsigned int> cache, nextCache;
+		cache.reserve(OPTIMIZE_CACHE_SIZE + 3);
+		nextCache.reserve(OPTIMIZE_CACHE_SIZE + 3);
+
+		size_t scanCursor = 0;
+		long long best = -1;
+		for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+		{
+			if (best < 0)
+			{
+				// nothing adjacent to the cache is left, restart from the next triangle in input order
+				while (emitted[scanCursor])
+					scanCursor++;
+				best = static_cast<long long>(scanCursor);
+			}
+			const unsigned int* triangle = &indices[static_cast<size_t>(best) * 3];
+			emitted[best] = 1;
+
+			nextCache.clear();
+			for (int k = 0; k < 3; k++)
+			{
+				const unsigned int v = triangle[k];
+				result.push_back(v);
+				nextCache.push_back(v);
+				// drop the triangle from the vertex's live list
+				unsigned int* list = &adjacency[offsets[v]];
+				for (unsigned int a = 0; a < remaining[v]; a++)
+				{
+					if (list[a] == static_cast<unsigned int>(best))
+					{
+						list[a] = list[remaining[v] - 1];
+						break;
+					}
+				}
+				remaining[v]--;
+			}
+			for (unsigned int v : cache)
+			{
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+					nextCache.push_back(v);
+			}
+
+			// rescore everything that was in the cache, including vertices that just fell out of it
+			for (size_t p = 0; p < nextCache.size(); p++)
+			{
+				const unsigned int v = nextCache[p];
+				cachePosition[v] = p < size_t(OPTIMIZE_CACHE_SIZE) ? static_cast<int>(p) : -1;
+				vertexScore[v] = scoreVertex(cachePosition[v], remaining[v]);
+			}
+			best = -1;
+			float bestScore = -1.0f;
+			for (unsigned int v : nextCache)
+			{
+				const unsigned int* list = &adjacency[offsets[v]];
+				for (unsigned int a = 0; a < remaining[v]; a++)
+				{
+					const unsigned int t = list[a];
+					const float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+					if (score > bestScore)
+					{
+						bestScore = score;
+						best = t;
+					}
+				}
+			}
+			if (nextCache.size() > size_t(OPTIMIZE_CACHE_SIZE))
+				nextCache.resize(OPTIMIZE_CACHE_SIZE);
+			cache.swap(nextCache);
+		}
+		indices.swap(result);
+	}
+
+	/*
+	* Reorder clusters of triangles so that outward facing parts are drawn first, which lets the depth test
+	* reject more of what is behind them. Clusters only break where the cache order already restarts,
+	* so the vertex cache efficiency is mostly kept (Sander et al., "Fast Triangle Reordering for Vertex
+	* Locality and Reduced Overdraw").
+	* @param[in,out] indices Triangle list, already optimized for the vertex cache.
+	* @param[in] vertices
+	* @return void
+	*/
+	inline void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount <= MIN_CLUSTER_TRIANGLES)
+			return;
+
+		// a cluster starts at a triangle whose three vertices all miss the cache
+		std::vector<size_t> clusterStarts;
+		std::vector<unsigned int> timestamps(vertices.size(), 0);
+		unsigned int time = ANALYZE_CACHE_SIZE + 1;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				const unsigned int v = indices[t * 3 + k];
+				if (time - timestamps[v] > ANALYZE_CACHE_SIZE)
+				{
+					timestamps[v] = time++;
+					misses++;
+				}
+			}
+			if (t == 0 || (misses == 3 && t - clusterStarts.back() >= MIN_CLUSTER_TRIANGLES))
+				clusterStarts.push_back(t);
+		}
+		if (clusterStarts.size() < 2)
+			return;
+		clusterStarts.push_back(triangleCount);
+
+		glm::vec3 meshCentroid(0.0f);
+		for (const Vertex& vertex : vertices)
+		{
+			meshCentroid += vertex.Position;
+		}
+		meshCentroid /= float(vertices.size());
+
+		const size_t clusterCount = clusterStarts.size() - 1;
+		std::vector<float> sortKeys(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			glm::vec3 centroid(0.0f);
+			glm::vec3 normal(0.0f);
+			float area = 0.0f;
+			for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+			{
+				const glm::vec3& a = vertices[indices[t * 3]].Position;
+				const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3& c2 = vertices[indices[t * 3 + 2]].Position;
+				const glm::vec3 n = glm::cross(b - a, c2 - a);
+				const float triangleArea = glm::length(n);
+				centroid += (a + b + c2) * (triangleArea / 3.0f);
+				normal += n;
+				area += triangleArea;
+			}
+			const float normalLength = glm::length(normal);
+			if (area > 0.0f && normalLength > 0.0f)
+				sortKeys[c] = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+			else
+				sortKeys[c] = 0.0f;
+		}
+
+		std::vector<size_t> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			order[c] = c;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		for (size_t c : order)
+		{
+			result.insert(result.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+		}
+		indices.swap(result);
+	}
+
+	/*
+	* Reorder vertices by first use in the index buffer so vertex fetch walks memory linearly. Vertices no
+	* triangle refers to are dropped.
+	* @param[in,out] data
+	* @return void
+	*/
+	inline void optimizeVertexFetch(MeshData& data)
+	{
+		const unsigned int unused = ~0u;
+		std::vector<unsigned int> remap(data.vertices.size(), unused);
+		std::vector<Vertex> ordered;
+		ordered.reserve(data.vertices.size());
+		for (unsigned int& index : data.indices)
+		{
+			if (remap[index] == unused)
+			{
+				remap[index] = static_cast<unsigned int>(ordered.size());
+				ordered.push_back(data.vertices[index]);
+			}
+			index = remap[index];
+		}
+		data.vertices = std::move(ordered);
+	}
+
+	/*
+	* Run the full pass: weld, vertex cache order, overdraw order, vertex fetch order.
+	* @param[in,out] data
+	* @return Report with the cache statistics before and after.
+	*/
+	inline Report optimize(MeshData& data)
+	{
+		Report report;
+		report.verticesBefore = data.vertices.size();
+		report.before = analyzeVertexCache(data.indices, data.vertices.size());
+
+		weldVertices(data);
+		optimizeVertexCache(data.indices, data.vertices.size());
+		optimizeOverdraw(data.indices, data.vertices);
+		optimizeVertexFetch(data);
+
+		report.verticesAfter = data.vertices.size();
+		report.after = analyzeVertexCache(data.indices, data.vertices.size());
+		return report;
+	}
+}
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <vector>
+#include <glm/glm.hpp>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MESHLET_SSE2
+#endif
+#include "mesh.hpp"
+
+// Splits a mesh into small clusters of triangles so whole clusters that are outside the view frustum or
+// face away from the camera can be dropped before they are submitted. Meshlets are cut greedily along
+// the index order, so every meshlet is a contiguous range of the index buffer and no second index
+// buffer is needed; run it after the vertex cache optimization so the clusters are spatially tight.
+// Culling runs on the CPU, four meshlets per SSE2 operation with a scalar fallback.
+namespace Meshlets
+{
+	const unsigned int MAX_VERTICES = 64;
+	const unsigned int MAX_TRIANGLES = 124;
+
+	// Frustum planes and camera position brought into the mesh's model space.
+	struct View
+	{
+		glm::vec4 planes[6];	// dot(plane, vec4(p, 1)) is the world space distance of model space point p
+		glm::vec3 position;		// camera position in model space
+		float scale;			// largest scale of the model matrix, turns model space radii into world space
+	};
+
+	inline void appendBounds(MeshletBounds &bounds, const glm::vec3 &center, float radius, const glm::vec3 &axis, float cutoff)
+	{
+		bounds.centerX.push_back(center.x);
+		bounds.centerY.push_back(center.y);
+		bounds.centerZ.push_back(center.z);
+		bounds.radius.push_back(radius);
+		bounds.axisX.push_back(axis.x);
+		bounds.axisY.push_back(axis.y);
+		bounds.axisZ.push_back(axis.z);
+		bounds.cutoff.push_back(cutoff);
+	}
+
+	/*
+	* Compute the bounding sphere and normal cone of the triangles in a range of the index buffer.
+	* @param[in] vertices
+	* @param[in] indices First index of the meshlet.
+	* @param[in] indexCount
+	* @param[in] localVertices Distinct vertices used by the meshlet.
+	* @param[out] bounds Receives one entry.
+	* @return void
+	*/
+	inline void computeMeshletBounds(const std::vector<Vertex> &vertices, const unsigned int *indices, unsigned int indexCount,
+		const std::vector<unsigned int> &localVertices, MeshletBounds &bounds)
+	{
+		glm::vec3 minimum = vertices[localVertices[0]].Position, maximum = minimum;
+		for (unsigned int vertex : localVertices)
+		{
+			minimum = glm::min(minimum, vertices[vertex].Position);
+			maximum = glm::max(maximum, vertices[vertex].Position);
+		}
+		const glm::vec3 center = (minimum + maximum) * 0.5f;
+		float radius = 0.0f;
+		for (unsigned int vertex : localVertices)
+		{
+			radius = std::max(radius, glm::length(vertices[vertex].Position - center));
+		}
+
+		// the cone axis is the average face normal; its half angle is set by the normal furthest from it
+		glm::vec3 normalSum(0.0f);
+		for (unsigned int i = 0; i < indexCount; i += 3)
+		{
+			const glm::vec3 &a = vertices[indices[i]].Position;
+			const glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - a, vertices[indices[i + 2]].Position - a);
+			const float length = glm::length(normal);
+			if (length > 0.0f)
+			{
+				normalSum += normal / length;
+			}
+		}
+		const float sumLength = glm::length(normalSum);
+		glm::vec3 axis(0.0f, 0.0f, 1.0f);
+		// a cutoff of 1 can never pass the culling test, used when the normals spread over a hemisphere
+		float cutoff = 1.0f;
+		if (sumLength > 0.0f)
+		{
+			axis = normalSum / sumLength;
+			float minimumDot = 1.0f;
+			for (unsigned int i = 0; i < indexCount; i += 3)
+			{
+				const glm::vec3 &a = vertices[indices[i]].Position;
+				const glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - a, vertices[indices[i + 2]].Position - a);
+				const float length = glm::length(normal);
+				if (length > 0.0f)
+				{
+					minimumDot = std::min(minimumDot, glm::dot(normal / length, axis));
+				}
+			}
+			if (minimumDot > 0.0f)
+			{
+				cutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+			}
+		}
+		appendBounds(bounds, center, radius, axis, cutoff);
+	}
+
+	/*
+	* Split the first level of detail of a mesh into meshlets of at most MAX_VERTICES distinct vertices and
+	* MAX_TRIANGLES triangles.
+	* @param[in,out] data Receives meshlets and meshletBounds.
+	* @return void
+	*/
+	inline void build(MeshData &data)
+	{
+		data.meshlets.clear();
+		data.meshletBounds = MeshletBounds();
+		const unsigned int indexCount = data.lods.empty() ? static_cast<unsigned int>(data.indices.size()) : data.lods[0].indexCount;
+		const unsigned int firstIndex = data.lods.empty() ? 0 : data.lods[0].indexOffset;
+		if (indexCount < 3)
+		{
+			return;
+		}
+
+		// stamp of the meshlet each vertex was last added to, so membership is one lookup
+		std::vector<unsigned int> stamp(data.vertices.size(), ~0u);
+		std::vector<unsigned int> localVertices;
+		localVertices.reserve(MAX_VERTICES);
+		data.meshlets.reserve(indexCount / 3 / MAX_TRIANGLES + 1);
+
+		const unsigned int *indices = data.indices.data() + firstIndex;
+		Meshlet current = { firstIndex, 0, 0 };
+		auto finish = [&]()
+		{
+			current.vertexCount = static_cast<unsigned int>(localVertices.size());
+			computeMeshletBounds(data.vertices, data.indices.data() + current.indexOffset, current.indexCount, localVertices, data.meshletBounds);
+			data.meshlets.push_back(current);
+			current = { current.indexOffset + current.indexCount, 0, 0 };
+			localVertices.clear();
+		};
+
+		for (unsigned int i = 0; i + 2 < indexCount; i += 3)
+		{
+			const unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+			const unsigned int meshletId = static_cast<unsigned int>(data.meshlets.size());
+			// a vertex repeated inside the triangle only counts once
+			const unsigned int newVertices = (stamp[a] != meshletId) + (stamp[b] != meshletId && b != a) +
+				(stamp[c] != meshletId && c != a && c != b);
+			if (localVertices.size() + newVertices > MAX_VERTICES || current.indexCount / 3 == MAX_TRIANGLES)
+			{
+				finish();
+			}
+			const unsigned int id = static_cast<unsigned int>(data.meshlets.size());
+			for (unsigned int vertex : { a, b, c })
+			{
+				if (stamp[vertex] != id)
+				{
+					stamp[vertex] = id;
+					localVertices.push_back(vertex);
+				}
+			}
+			current.indexCount += 3;
+		}
+		if (current.indexCount > 0)
+		{
+			finish();
+		}
+
+		// pad to whole groups of four with meshlets that are never visible
+		MeshletBounds &bounds = data.meshletBounds;
+		while (bounds.centerX.size() % 4 != 0)
+		{
+			appendBounds(bounds, glm::vec3(0.0f), -1.0f, glm::vec3(0.0f, 0.0f, 1.0f), 1.0f);
+		}
+	}
+
+	/*
+	* Bring the camera into a mesh's model space. The cone test assumes the model matrix scales uniformly.
+	* @param[in] model Model matrix the mesh is drawn with.
+	* @param[in] viewProjection Projection times view matrix.
+	* @param[in] cameraPosition World space camera position.
+	* @return View
+	*/
+	inline View makeView(const glm::mat4 &model, const glm::mat4 &viewProjection, const glm::vec3 &cameraPosition)
+	{
+		View view;
+		// Gribb-Hartmann: the planes are sums and differences of the rows of the clip matrix
+		const glm::mat4 rows = glm::transpose(viewProjection);
+		const glm::vec4 worldPlanes[6] = {
+			rows[3] + rows[0], rows[3] - rows[0],
+			rows[3] + rows[1], rows[3] - rows[1],
+			rows[3] + rows[2], rows[3] - rows[2]
+		};
+		// a plane maps back to model space through the transpose of the model matrix
+		const glm::mat4 toModel = glm::transpose(model);
+		for (int i = 0; i < 6; i++)
+		{
+			const glm::vec4 plane = worldPlanes[i] / glm::length(glm::vec3(worldPlanes[i]));
+			view.planes[i] = toModel * plane;
+		}
+		view.position = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+		view.scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		return view;
+	}
+
+	/*
+	* Cull meshlets against the frustum and their normal cones.
+	* @param[in] bounds
+	* @param[in] meshletCount
+	* @param[in] view
+	* @param[out] visible One flag per meshlet, resized to the padded count.
+	* @return number of visible meshlets.
+	*/
+	inline size_t cull(const MeshletBounds &bounds, size_t meshletCount, const View &view, std::vector<unsigned char> &visible)
+	{
+		const size_t count = bounds.centerX.size();
+		visible.resize(count);
+		size_t i = 0;
+#ifdef MESHLET_SSE2
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 scale = _mm_set1_ps(view.scale);
+		const __m128 viewX = _mm_set1_ps(view.position.x);
+		const __m128 viewY = _mm_set1_ps(view.position.y);
+		const __m128 viewZ = _mm_set1_ps(view.position.z);
+		for (; i < count; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(&bounds.centerX[i]);
+			const __m128 y = _mm_loadu_ps(&bounds.centerY[i]);
+			const __m128 z = _mm_loadu_ps(&bounds.centerZ[i]);
+			const __m128 radius = _mm_loadu_ps(&bounds.radius[i]);
+			// padding has a negative radius
+			__m128 inside = _mm_cmpge_ps(radius, zero);
+			const __m128 worldRadius = _mm_sub_ps(zero, _mm_mul_ps(radius, scale));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &plane = view.planes[p];
+				__m128 distance = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y)));
+				distance = _mm_add_ps(distance, _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, worldRadius));
+			}
+
+			const __m128 dx = _mm_sub_ps(x, viewX);
+			const __m128 dy = _mm_sub_ps(y, viewY);
+			const __m128 dz = _mm_sub_ps(z, viewZ);
+			const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+			__m128 along = _mm_mul_ps(dx, _mm_loadu_ps(&bounds.axisX[i]));
+			along = _mm_add_ps(along, _mm_mul_ps(dy, _mm_loadu_ps(&bounds.axisY[i])));
+			along = _mm_add_ps(along, _mm_mul_ps(dz, _mm_loadu_ps(&bounds.axisZ[i])));
+			const __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&bounds.cutoff[i]), length), radius);
+			const __m128 backfacing = _mm_cmpge_ps(along, limit);
+
+			const int mask = _mm_movemask_ps(_mm_andnot_ps(backfacing, inside));
+			visible[i] = mask & 1;
+			visible[i + 1] = (mask >> 1) & 1;
+			visible[i + 2] = (mask >> 2) & 1;
+			visible[i + 3] = (mask >> 3) & 1;
+		}
+#endif
+		for (; i < count; i++)
+		{
+			const glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+			const float radius = bounds.radius[i];
+			bool inside = radius >= 0.0f;
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				inside = glm::dot(glm::vec3(view.planes[p]), center) + view.planes[p].w >= -radius * view.scale;
+			}
+			// conservative cone test: every triangle faces away from any point of the bounding sphere
+			const glm::vec3 toCenter = center - view.position;
+			const glm::vec3 axis(bounds.axisX[i], bounds.axisY[i], bounds.axisZ[i]);
+			const bool backfacing = glm::dot(toCenter, axis) >= bounds.cutoff[i] * glm::length(toCenter) + radius;
+			visible[i] = inside && !backfacing;
+		}
+
+		size_t visibleCount = 0;
+		for (size_t m = 0; m < meshletCount; m++)
+		{
+			visibleCount += visible[m];
+		}
+		return visibleCount;
+	}
+}
+
+#endif
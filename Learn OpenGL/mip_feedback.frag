@@ -0,0 +1,18 @@
+#version 330 core
+// Feedback pass of MipStreamer (see mip_streamer.hpp): which texture set covers the pixel, and log2 of
+// the texture coordinate units one full resolution pixel spans, in 8.8 fixed point biased by 32768
+in vec2 TexCoords;
+out uvec2 Feedback;
+
+uniform int feedbackSlot;
+// the pass is drawn smaller than the view, so derivatives are scaled back to full resolution
+uniform float feedbackScale;
+
+void main()
+{
+	vec2 dx = dFdx(TexCoords);
+	vec2 dy = dFdy(TexCoords);
+	float footprint = max(length(dx), length(dy)) * feedbackScale;
+	float density = clamp(log2(max(footprint, 1e-20)) * 256.0 + 32768.0, 1.0, 65535.0);
+	Feedback = uvec2(uint(feedbackSlot), uint(density));
+}
@@ -0,0 +1,659 @@
+#ifndef MIP_STREAMER_H
+#define MIP_STREAMER_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "block_compression.hpp"
+#include "gpu_memory.hpp"
+#include "ktx2.hpp"
+#include "mipmap.hpp"
+#include "texture_cache.hpp"
+#include "thread_pool.hpp"
+
+// Keeps large textures resident only down to the finest mip level the screen asks for. Every few frames
+// the scene is drawn into a small integer target with mip_feedback.frag, which records for each pixel
+// which set of textures covers it and how many texture coordinate units one full resolution pixel
+// spans. The target is read back through a pixel pack buffer a few frames later without stalling, and
+// each texture's requested level follows from that density and its size.
+//
+// Residency is partial without sparse textures: every source level keeps its own GL level, and
+// GL_TEXTURE_BASE_LEVEL points at the finest resident one. Loading a level uploads just that level and
+// lowers the base; evicting raises it and respecifies the levels above as 0x0 so the driver frees them.
+// Finer levels are loaded one per texture per update within an upload budget, and dropped
+// again once no readback asked for them for a while or when the total goes over the memory budget.
+// Textures no feedback pass has drawn have nothing to go by, so readbacks ask for their whole chain,
+// which the memory budget still limits.
+// Cooked KTX2 textures and texels from the TexelCache page their levels in from the mapped file; other
+// images keep their mip chain, built on the worker pool, in system memory.
+class MipStreamer
+{
+public:
+	static const int LARGE_TEXTURE = 2048;		// textures with a side at least this long are managed
+	static const int TAIL_SIZE = 128;			// levels no larger than this always stay resident
+	static const int FEEDBACK_DIVISOR = 8;		// the feedback target is the viewport divided by this
+	static const int FEEDBACK_INTERVAL = 4;		// frames between feedback passes
+	static const int EVICT_DELAY = 120;			// frames a level stays after the last readback that needed it
+	static const int RELIEF_DELAY = 60;			// frames under the memory budget before a shrunk budget grows
+
+	struct TextureStats
+	{
+		unsigned int id;
+		int width;
+		int height;
+		int levels;
+		int residentMip;	// finest level in video memory
+		int requestedMip;	// finest level the last readback asked for
+		size_t residentBytes;
+	};
+
+	struct Stats
+	{
+		size_t textures;
+		size_t residentBytes;
+		size_t budgetBytes;
+		size_t bytesLastFrame;
+		size_t loads;			// levels loaded since construction
+		size_t evictions;
+		bool overBudget;		// the requested levels did not all fit the last time targets were chosen
+	};
+
+	/*
+	* Constructor for the streamer. Needs a current GL context.
+	* @param[in] budgetBytes Video memory all managed textures may take together.
+	* @param[in] bytesPerFrame Upload budget; at least one level is loaded per update when one is wanted.
+	* @return MipStreamer
+	*/
+	explicit MipStreamer(size_t budgetBytes = static_cast<size_t>(256) << 20, size_t bytesPerFrame = static_cast<size_t>(8) << 20)
+		: configuredBudget(budgetBytes), budget(budgetBytes), bytesPerFrame(bytesPerFrame)
+	{
+		for (Readback &readback : readbacks)
+		{
+			glGenBuffers(1, &readback.buffer);
+		}
+		slotTextures.emplace_back();
+		TextureCache::shared().addDeleteListener([this](unsigned int texture)
+		{
+			forget(texture);
+		});
+	}
+
+	~MipStreamer()
+	{
+		// mip chains still being built point at the base levels owned here
+		for (auto &entry : textures)
+		{
+			if (entry.second.chain.valid())
+			{
+				entry.second.chain.wait();
+			}
+		}
+	}
+
+	MipStreamer(const MipStreamer&) = delete;
+	MipStreamer &operator=(const MipStreamer&) = delete;
+
+	// The streamer whose feedback pass is being drawn, so meshes know to set their feedback slot.
+	static MipStreamer *&recording()
+	{
+		static MipStreamer *current = nullptr;
+		return current;
+	}
+
+	// True for images large enough to be worth streaming.
+	bool wants(const DecodedImage &image) const
+	{
+		return std::max(image.width, image.height) >= LARGE_TEXTURE && (image.pixels || !image.texels.levels.empty() || image.compressed.levels.size() > 1);
+	}
+
+	/*
+	* Take over a large texture. Only the levels up to TAIL_SIZE are uploaded at first.
+	* @param[in] image Decoded pixels, or cached texels or a cooked file with its whole mip chain.
+	* @return GL name of the texture.
+	*/
+	unsigned int manage(DecodedImage &&image)
+	{
+		Managed managed;
+		managed.width = image.width;
+		managed.height = image.height;
+		managed.levels = Mipmap::levelCount(image.width, image.height);
+		glGenTextures(1, &managed.id);
+		glBindTexture(GL_TEXTURE_2D, managed.id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		if (!image.compressed.levels.empty())
+		{
+			managed.compressed = true;
+			managed.format = BlockCompression::glFormat(image.compressed.vkFormat);
+			managed.levels = static_cast<int>(image.compressed.levels.size());
+			TextureCache::applySwizzle(image.compressed.value("KTXswizzle"));
+			managed.file = std::move(image.compressed);
+		}
+		else
+		{
+			managed.format = GL_RGBA;
+			if (image.components == 1)
+				managed.format = GL_RED;
+			else if (image.components == 2)
+				managed.format = GL_RG;
+			else if (image.components == 3)
+				managed.format = GL_RGB;
+			managed.components = image.components;
+			if (!image.texels.levels.empty())
+			{
+				// cached texels come with their chain
+				managed.texels = std::move(image.texels);
+			}
+			else
+			{
+				managed.base = std::move(image.pixels);
+				const unsigned char *pixels = managed.base.get();
+				const int width = image.width, height = image.height, components = image.components;
+				managed.chain = ThreadPool::shared().submit([pixels, width, height, components]
+				{
+					return Mipmap::buildChain(pixels, width, height, components);
+				});
+			}
+		}
+		managed.tailMip = 0;
+		while (managed.tailMip < managed.levels - 1 &&
+			std::max(managed.width >> managed.tailMip, managed.height >> managed.tailMip) > TAIL_SIZE)
+		{
+			managed.tailMip++;
+		}
+		managed.residentMip = managed.requestedMip = managed.tailMip;
+
+		const unsigned int id = managed.id;
+		Managed &stored = textures[id] = std::move(managed);
+		if (stored.compressed || !stored.texels.levels.empty())
+		{
+			respecify(stored, stored.tailMip);
+		}
+		return id;
+	}
+
+	bool manages(unsigned int texture) const
+	{
+		return textures.count(texture) != 0;
+	}
+
+	/*
+	* Start drawing the feedback pass, every FEEDBACK_INTERVAL frames and only while a readback buffer is
+	* free. Draw the scene with mip_feedback.frag between this and endFeedback.
+	* @param[in] viewportWidth Size of the view the scene is normally drawn to.
+	* @param[in] viewportHeight
+	* @return false if no pass is due.
+	*/
+	bool beginFeedback(int viewportWidth, int viewportHeight)
+	{
+		if (textures.empty() || feedbackFrame++ % FEEDBACK_INTERVAL != 0 || readbacks[nextReadback].fence)
+		{
+			return false;
+		}
+		const int width = std::max(1, viewportWidth / FEEDBACK_DIVISOR);
+		const int height = std::max(1, viewportHeight / FEEDBACK_DIVISOR);
+		if (width != feedbackWidth || height != feedbackHeight)
+		{
+			createTarget(width, height);
+		}
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGetIntegerv(GL_VIEWPORT, previousViewport);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+		const GLuint empty[4] = { 0, 0, 0, 0 };
+		glClearBufferuiv(GL_COLOR, 0, empty);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		recording() = this;
+		return true;
+	}
+
+	// Queue the readback of the pass and restore the framebuffer and viewport.
+	void endFeedback()
+	{
+		Readback &readback = readbacks[nextReadback];
+		const GLsizeiptr size = static_cast<GLsizeiptr>(feedbackWidth) * feedbackHeight * 2 * sizeof(uint16_t);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		if (readback.size != size)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+			GpuMemory::shared().trackBuffer(readback.buffer, GPU_STAGING_BUFFERS, static_cast<size_t>(size), "MipStreamer");
+			readback.size = size;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RG_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nextReadback = (nextReadback + 1) % READBACKS;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(previousFramebuffer));
+		glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+		recording() = nullptr;
+	}
+
+	/*
+	* Feedback slot of a mesh's textures, for the feedbackSlot uniform of the feedback pass.
+	* @param[in] textureIds GL names of every texture the mesh samples with its texture coordinates.
+	* @return slot, 0 if none of them is managed.
+	*/
+	int feedbackSlot(const std::vector<unsigned int> &textureIds)
+	{
+		std::vector<unsigned int> managed;
+		for (unsigned int id : textureIds)
+		{
+			auto found = textures.find(id);
+			if (found != textures.end())
+			{
+				found->second.recorded = true;
+				managed.push_back(id);
+			}
+		}
+		if (managed.empty())
+		{
+			return 0;
+		}
+		std::sort(managed.begin(), managed.end());
+		auto found = slots.find(managed);
+		if (found != slots.end())
+		{
+			return found->second;
+		}
+		if (slotTextures.size() > 0xFFFF)
+		{
+			return 0;
+		}
+		const int slot = static_cast<int>(slotTextures.size());
+		slotTextures.push_back(managed);
+		slots[managed] = slot;
+		return slot;
+	}
+
+	/*
+	* Take in finished readbacks and load or evict levels. Call once per frame on the GL thread.
+	* @return void
+	*/
+	void update()
+	{
+		frame++;
+		lastFrameBytes = 0;
+		for (auto &entry : textures)
+		{
+			Managed &texture = entry.second;
+			if (texture.chain.valid() && texture.chain.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			{
+				texture.chain.get().swap(texture.chainLevels);
+				respecify(texture, texture.tailMip);
+			}
+		}
+		for (Readback &readback : readbacks)
+		{
+			if (readback.fence && glClientWaitSync(readback.fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+			{
+				glDeleteSync(readback.fence);
+				readback.fence = nullptr;
+				readFeedback(readback);
+			}
+		}
+		stream();
+	}
+
+	/*
+	* Drop a texture that is about to be deleted.
+	* @param[in] texture GL name.
+	* @return void
+	*/
+	void forget(unsigned int texture)
+	{
+		auto found = textures.find(texture);
+		if (found == textures.end())
+		{
+			return;
+		}
+		if (found->second.chain.valid())
+		{
+			found->second.chain.wait();
+		}
+		residentTotal -= found->second.residentBytes;
+		textures.erase(found);
+	}
+
+	/*
+	* Lower the budget so the next updates drop levels worth some bytes. Calling it again before they are
+	* dropped asks for the same bytes, not more. The budget stays lowered until relieve() raises it.
+	* @param[in] bytes
+	* @return void
+	*/
+	void shrink(size_t bytes)
+	{
+		budget = std::min(budget, residentTotal > bytes ? residentTotal - bytes : 0);
+		reliefFrames = 0;
+	}
+
+	/*
+	* Grow a budget that shrink() lowered into the memory that is free, up to the one the streamer was
+	* constructed with. Call every frame the total is under budget: only after RELIEF_DELAY such frames
+	* since the last shrink() does the budget grow, and then to what is resident plus the free memory, which stays the
+	* same while the levels it makes room for load, so the loads do not raise it further.
+	* @param[in] bytes Memory free under the total budget.
+	* @return void
+	*/
+	void relieve(size_t bytes)
+	{
+		if (budget == configuredBudget || ++reliefFrames < RELIEF_DELAY)
+		{
+			return;
+		}
+		const size_t room = bytes >= configuredBudget - std::min(residentTotal, configuredBudget) ? configuredBudget : residentTotal + bytes;
+		budget = std::max(budget, room);
+	}
+
+	Stats stats() const
+	{
+		return { textures.size(), residentTotal, budget, lastFrameBytes, loads, evictions, overBudget };
+	}
+
+	std::vector<TextureStats> textureStats() const
+	{
+		std::vector<TextureStats> result;
+		result.reserve(textures.size());
+		for (const auto &entry : textures)
+		{
+			const Managed &texture = entry.second;
+			result.push_back({ texture.id, texture.width, texture.height, texture.levels, texture.residentMip, texture.requestedMip, texture.residentBytes });
+		}
+		return result;
+	}
+
+private:
+	static const int READBACKS = 3;
+
+	struct Managed
+	{
+		unsigned int id = 0;
+		int width = 0;
+		int height = 0;
+		int levels = 0;
+		GLenum format = GL_RGBA;
+		int components = 4;
+		bool compressed = false;
+		Ktx2::Image file;											// compressed levels, mapped
+		MappedTexels texels;										// uncompressed levels, mapped
+		std::unique_ptr<unsigned char, void(*)(void*)> base{ nullptr, stbi_image_free };
+		std::future<std::vector<MipLevel>> chain;
+		std::vector<MipLevel> chainLevels;							// 1 .. levels - 1
+		int tailMip = 0;
+		int residentMip = 0;
+		int requestedMip = 0;
+		int targetMip = 0;
+		size_t residentBytes = 0;
+		uint64_t coarserSince = 0;	// first frame the requests stayed coarser than what is resident
+		int readbackRequest = 0;	// scratch for readFeedback
+		bool recorded = false;		// drawn in a feedback pass, so readbacks decide its level
+	};
+
+	struct Readback
+	{
+		unsigned int buffer = 0;
+		GLsizeiptr size = 0;
+		GLsync fence = nullptr;
+	};
+
+	size_t configuredBudget;
+	size_t budget;				// lower than configuredBudget while shrunk
+	int reliefFrames = 0;		// frames under the memory budget since the last shrink
+	size_t bytesPerFrame;
+	std::unordered_map<unsigned int, Managed> textures;
+	size_t residentTotal = 0;
+	size_t lastFrameBytes = 0;
+	size_t loads = 0;
+	size_t evictions = 0;
+	bool overBudget = false;
+	uint64_t frame = 0;
+
+	// feedback target and readbacks
+	unsigned int framebuffer = 0;
+	unsigned int colorBuffer = 0;
+	unsigned int depthBuffer = 0;
+	int feedbackWidth = 0;
+	int feedbackHeight = 0;
+	uint64_t feedbackFrame = 0;
+	GLint previousFramebuffer = 0;
+	GLint previousViewport[4] = {};
+	Readback readbacks[READBACKS];
+	int nextReadback = 0;
+	std::map<std::vector<unsigned int>, int> slots;
+	std::vector<std::vector<unsigned int>> slotTextures;	// slot 0 is no managed texture
+
+	void createTarget(int width, int height)
+	{
+		if (framebuffer == 0)
+		{
+			glGenFramebuffers(1, &framebuffer);
+			glGenRenderbuffers(1, &colorBuffer);
+			glGenRenderbuffers(1, &depthBuffer);
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RG16UI, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		GpuMemory::shared().trackRenderbuffer(colorBuffer, GL_RG16UI, width, height, 0, "MipStreamer");
+		GpuMemory::shared().trackRenderbuffer(depthBuffer, GL_DEPTH_COMPONENT24, width, height, 0, "MipStreamer");
+
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::MIP_STREAMER::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(previous));
+		feedbackWidth = width;
+		feedbackHeight = height;
+	}
+
+	// turn a readback into requested levels: the densest sample of each slot decides for its textures
+	void readFeedback(Readback &readback)
+	{
+		std::vector<uint16_t> densest(slotTextures.size(), 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		const uint16_t *texels = static_cast<const uint16_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.size, GL_MAP_READ_BIT));
+		if (texels)
+		{
+			const size_t count = static_cast<size_t>(readback.size) / (2 * sizeof(uint16_t));
+			for (size_t i = 0; i < count; i++)
+			{
+				const uint16_t slot = texels[2 * i];
+				const uint16_t density = texels[2 * i + 1];
+				// the finest level comes from the smallest footprint, so keep the lowest density value
+				if (slot != 0 && slot < densest.size() && (densest[slot] == 0 || density < densest[slot]))
+				{
+					densest[slot] = density;
+				}
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		for (auto &entry : textures)
+		{
+			entry.second.readbackRequest = entry.second.recorded ? entry.second.tailMip : 0;
+		}
+		for (size_t slot = 1; slot < densest.size(); slot++)
+		{
+			if (densest[slot] == 0)
+			{
+				continue;
+			}
+			// 8.8 fixed point log2 of texture coordinate units per pixel, biased by 32768
+			const float footprint = (static_cast<float>(densest[slot]) - 32768.0f) / 256.0f;
+			for (unsigned int id : slotTextures[slot])
+			{
+				auto found = textures.find(id);
+				if (found == textures.end())
+				{
+					continue;
+				}
+				Managed &texture = found->second;
+				const float lod = footprint + std::log2(static_cast<float>(std::max(texture.width, texture.height)));
+				const int mip = std::min(std::max(static_cast<int>(std::floor(lod)), 0), texture.tailMip);
+				texture.readbackRequest = std::min(texture.readbackRequest, mip);
+			}
+		}
+		for (auto &entry : textures)
+		{
+			Managed &texture = entry.second;
+			texture.requestedMip = texture.readbackRequest;
+			if (texture.requestedMip <= texture.residentMip)
+			{
+				texture.coarserSince = 0;
+			}
+			else if (texture.coarserSince == 0)
+			{
+				texture.coarserSince = frame;
+			}
+		}
+	}
+
+	// bytes of the chain from a level down
+	size_t chainBytes(const Managed &texture, int mip) const
+	{
+		size_t bytes = 0;
+		for (int level = mip; level < texture.levels; level++)
+		{
+			if (texture.compressed)
+				bytes += texture.file.levels[level].size;
+			else
+				bytes += static_cast<size_t>(std::max(1, texture.width >> level)) * std::max(1, texture.height >> level) * texture.components;
+		}
+		return bytes;
+	}
+
+	// choose targets that fit the budget, then move each texture one step towards its target
+	void stream()
+	{
+		std::vector<Managed*> ready;
+		size_t wanted = 0;
+		for (auto &entry : textures)
+		{
+			Managed &texture = entry.second;
+			if (texture.chain.valid())
+			{
+				continue;
+			}
+			texture.targetMip = texture.requestedMip;
+			wanted += chainBytes(texture, texture.targetMip);
+			ready.push_back(&texture);
+		}
+		// over budget: coarsen whichever target is largest until the set fits
+		overBudget = false;
+		while (wanted > budget)
+		{
+			Managed *largest = nullptr;
+			for (Managed *texture : ready)
+			{
+				if (texture->targetMip < texture->tailMip &&
+					(!largest || chainBytes(*texture, texture->targetMip) > chainBytes(*largest, largest->targetMip)))
+				{
+					largest = texture;
+				}
+			}
+			if (!largest)
+			{
+				break;
+			}
+			wanted -= chainBytes(*largest, largest->targetMip) - chainBytes(*largest, largest->targetMip + 1);
+			largest->targetMip++;
+			overBudget = true;
+		}
+
+		// evictions first so their memory is free for the loads
+		for (Managed *texture : ready)
+		{
+			if (texture->targetMip > texture->residentMip &&
+				(overBudget || (texture->coarserSince != 0 && frame - texture->coarserSince >= EVICT_DELAY)))
+			{
+				respecify(*texture, texture->targetMip);
+				evictions++;
+			}
+		}
+		// the textures furthest from their target load first
+		std::sort(ready.begin(), ready.end(), [](const Managed *a, const Managed *b)
+		{
+			return a->residentMip - a->targetMip > b->residentMip - b->targetMip;
+		});
+		for (Managed *texture : ready)
+		{
+			if (texture->targetMip >= texture->residentMip)
+			{
+				break;
+			}
+			const size_t resident = chainBytes(*texture, texture->residentMip - 1);
+			const size_t cost = resident - texture->residentBytes;
+			if ((lastFrameBytes > 0 && lastFrameBytes + cost > bytesPerFrame) || residentTotal - texture->residentBytes + resident > budget)
+			{
+				continue;
+			}
+			respecify(*texture, texture->residentMip - 1);
+			loads++;
+		}
+	}
+
+	// make a source level the base of the texture: upload the levels from it to the resident ones, or
+	// free the resident ones finer than it. The first call uploads the chain from mip down.
+	void respecify(Managed &texture, int mip)
+	{
+		glBindTexture(GL_TEXTURE_2D, texture.id);
+		const int uploadEnd = texture.residentBytes == 0 ? texture.levels : std::min(texture.residentMip, texture.levels);
+		size_t uploaded = 0;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int level = mip; level < uploadEnd; level++)
+		{
+			if (texture.compressed)
+			{
+				const Ktx2::Level &data = texture.file.levels[level];
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.format, data.width, data.height, 0, static_cast<GLsizei>(data.size), data.data);
+				uploaded += data.size;
+			}
+			else
+			{
+				const int width = std::max(1, texture.width >> level), height = std::max(1, texture.height >> level);
+				const unsigned char *pixels = !texture.texels.levels.empty() ? texture.texels.levels[level].data :
+					level == 0 ? texture.base.get() : texture.chainLevels[level - 1].pixels.data();
+				glTexImage2D(GL_TEXTURE_2D, level, texture.format, width, height, 0, texture.format, GL_UNSIGNED_BYTE, pixels);
+				uploaded += static_cast<size_t>(width) * height * texture.components;
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, mip);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+		// levels below the base are left out of sampling and completeness, so empty ones free their memory
+		for (int level = texture.residentBytes == 0 ? mip : texture.residentMip; level < mip; level++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+		GpuMemory::shared().trackTexture(texture.id, texture.format, std::max(1, texture.width >> mip), std::max(1, texture.height >> mip),
+			1, texture.levels - mip, "MipStreamer");
+		const size_t bytes = chainBytes(texture, mip);
+		residentTotal = residentTotal - texture.residentBytes + bytes;
+		texture.residentBytes = bytes;
+		texture.residentMip = mip;
+		lastFrameBytes += uploaded;
+	}
+};
+
+#endif
@@ -0,0 +1,439 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <vector>
+#include "thread_pool.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAP_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MIPMAP_NEON
+#endif
+
+// One level of a mip chain, tightly packed rows of 8-bit channels.
+struct MipLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+};
+
+enum MipFilter
+{
+	MIP_BOX,	// average of the texels each target texel covers
+	MIP_KAISER	// Kaiser windowed sinc, sharper mips with less aliasing
+};
+
+struct MipSettings
+{
+	MipFilter filter = MIP_BOX;
+	bool srgb = false;			// color channels are sRGB encoded and get filtered in linear light
+	float alphaCutoff = 0.0f;	// alpha test reference whose coverage every level keeps, 0 leaves alpha alone
+	bool parallel = false;		// split each level across the worker pool; not from inside a pool job
+};
+
+// CPU mip generation, so textures can be uploaded or cooked level by level without glGenerateMipmap.
+// Levels are filtered in float from the previous level, one RGBA texel per SSE2/NEON register, with
+// separable filters whose taps are worked out once per row and column, which also covers odd sizes.
+namespace Mipmap
+{
+	const int MAX_TAPS = 16;
+	const float KAISER_RADIUS = 2.0f;	// in target texels
+	const float KAISER_ALPHA = 4.0f;
+
+	// source texels and weights that make up one target texel along one axis
+	struct Tap
+	{
+		int count;
+		int index[MAX_TAPS];
+		float weight[MAX_TAPS];
+	};
+
+	/*
+	* Number of levels in a full chain down to 1x1.
+	* @param[in] width
+	* @param[in] height
+	* @return int
+	*/
+	inline int levelCount(int width, int height)
+	{
+		int levels = 1;
+		for (int size = std::max(width, height); size > 1; size >>= 1)
+		{
+			levels++;
+		}
+		return levels;
+	}
+
+	// zeroth order modified Bessel function, for the Kaiser window
+	inline float besselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 16; k++)
+		{
+			term *= (x / (2.0f * k)) * (x / (2.0f * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	inline float kaiser(float x)
+	{
+		const float t = x / KAISER_RADIUS;
+		if (t * t >= 1.0f)
+			return 0.0f;
+		const float sinc = std::fabs(x) < 1e-6f ? 1.0f : std::sin(3.14159265f * x) / (3.14159265f * x);
+		return sinc * besselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / besselI0(KAISER_ALPHA);
+	}
+
+	/*
+	* Taps for shrinking one axis. Texels past the edges are clamped to the last one.
+	* @param[in] sourceSize
+	* @param[in] targetSize
+	* @param[in] filter
+	* @return one Tap per target texel, weights summing to 1.
+	*/
+	inline std::vector<Tap> makeTaps(int sourceSize, int targetSize, MipFilter filter)
+	{
+		std::vector<Tap> taps(targetSize);
+		const float scale = static_cast<float>(sourceSize) / targetSize;
+		for (int t = 0; t < targetSize; t++)
+		{
+			Tap &tap = taps[t];
+			tap.count = 0;
+			const float center = (t + 0.5f) * scale;
+			float low, high;
+			if (filter == MIP_BOX || scale <= 1.0f)
+			{
+				low = center - scale * 0.5f;
+				high = center + scale * 0.5f;
+			}
+			else
+			{
+				low = center - KAISER_RADIUS * scale;
+				high = center + KAISER_RADIUS * scale;
+			}
+
+			float total = 0.0f;
+			for (int i = static_cast<int>(std::floor(low)); i < static_cast<int>(std::ceil(high)) && tap.count < MAX_TAPS; i++)
+			{
+				float weight;
+				if (filter == MIP_BOX || scale <= 1.0f)
+					weight = std::min(high, i + 1.0f) - std::max(low, static_cast<float>(i));
+				else
+					weight = kaiser((i + 0.5f - center) / scale);
+				if (weight == 0.0f)
+					continue;
+				tap.index[tap.count] = std::min(std::max(i, 0), sourceSize - 1);
+				tap.weight[tap.count] = weight;
+				tap.count++;
+				total += weight;
+			}
+			for (int k = 0; k < tap.count; k++)
+				tap.weight[k] /= total;
+		}
+		return taps;
+	}
+
+	/*
+	* Weighted sum of RGBA texels.
+	* @param[in] source First texel of the row or column.
+	* @param[in] stride Floats between neighbouring texels.
+	* @param[in] tap
+	* @param[out] out 4 floats.
+	* @return void
+	*/
+	inline void filterTexel(const float *source, size_t stride, const Tap &tap, float *out)
+	{
+#if defined(MIPMAP_SSE2)
+		__m128 sum = _mm_setzero_ps();
+		for (int k = 0; k < tap.count; k++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(source + tap.index[k] * stride), _mm_set1_ps(tap.weight[k])));
+		_mm_storeu_ps(out, sum);
+#elif defined(MIPMAP_NEON)
+		float32x4_t sum = vdupq_n_f32(0.0f);
+		for (int k = 0; k < tap.count; k++)
+			sum = vmlaq_n_f32(sum, vld1q_f32(source + tap.index[k] * stride), tap.weight[k]);
+		vst1q_f32(out, sum);
+#else
+		float sum[4] = {};
+		for (int k = 0; k < tap.count; k++)
+			for (int c = 0; c < 4; c++)
+				sum[c] += source[tap.index[k] * stride + c] * tap.weight[k];
+		std::copy(sum, sum + 4, out);
+#endif
+	}
+
+	// clamp a row of RGBA floats to [0, 1], the Kaiser lobes overshoot at hard edges
+	inline void saturate(float *values, size_t count)
+	{
+		size_t i = 0;
+#if defined(MIPMAP_SSE2)
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(values + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i), zero), one));
+#elif defined(MIPMAP_NEON)
+		const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f);
+		for (; i + 4 <= count; i += 4)
+			vst1q_f32(values + i, vminq_f32(vmaxq_f32(vld1q_f32(values + i), zero), one));
+#endif
+		for (; i < count; i++)
+			values[i] = std::min(std::max(values[i], 0.0f), 1.0f);
+	}
+
+	inline const float *srgbToLinearTable()
+	{
+		static const std::vector<float> table = []
+		{
+			std::vector<float> values(256);
+			for (int i = 0; i < 256; i++)
+			{
+				const float c = i / 255.0f;
+				values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	// indexed by linear value * 4095; fine enough that every 8-bit sRGB value round trips
+	inline const unsigned char *linearToSrgbTable()
+	{
+		static const std::vector<unsigned char> table = []
+		{
+			std::vector<unsigned char> values(4096);
+			for (int i = 0; i < 4096; i++)
+			{
+				const float c = i / 4095.0f;
+				const float encoded = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+				values[i] = static_cast<unsigned char>(encoded * 255.0f + 0.5f);
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	// channels that hold color, as opposed to alpha; gray plus alpha keeps its alpha second
+	inline int colorChannels(int components)
+	{
+		return components == 4 ? 3 : components == 2 ? 1 : components;
+	}
+
+	inline int alphaChannel(int components)
+	{
+		return components == 4 ? 3 : components == 2 ? 1 : -1;
+	}
+
+	/*
+	* Run body over row bands, on the worker pool when asked to.
+	* @param[in] rows
+	* @param[in] parallel
+	* @param[in] body Called with a half-open range of rows.
+	* @return void
+	*/
+	template<typename F>
+	void forRows(int rows, bool parallel, const F &body)
+	{
+		if (!parallel || rows < 16)
+		{
+			body(0, rows);
+			return;
+		}
+		ThreadPool &pool = ThreadPool::shared();
+		const int band = std::max(4, rows / static_cast<int>(pool.size() * 4));
+		std::vector<std::future<void>> jobs;
+		for (int first = 0; first < rows; first += band)
+		{
+			const int last = std::min(rows, first + band);
+			jobs.push_back(pool.submit([&body, first, last] { body(first, last); }));
+		}
+		for (std::future<void> &job : jobs)
+		{
+			job.get();
+		}
+	}
+
+	// fraction of texels whose alpha, scaled, passes the cutoff
+	inline float coverage(const float *rgba, size_t count, float cutoff, float scale)
+	{
+		size_t passed = 0;
+		for (size_t i = 0; i < count; i++)
+			passed += rgba[i * 4 + 3] * scale > cutoff;
+		return static_cast<float>(passed) / count;
+	}
+
+	// alpha scale that brings a level's coverage closest to the base level's
+	inline float coverageScale(const float *rgba, size_t count, float cutoff, float target)
+	{
+		float low = 0.0f, high = 4.0f, best = 1.0f, bestError = 2.0f;
+		for (int step = 0; step < 12; step++)
+		{
+			const float scale = 0.5f * (low + high);
+			const float current = coverage(rgba, count, cutoff, scale);
+			if (std::fabs(current - target) < bestError)
+			{
+				best = scale;
+				bestError = std::fabs(current - target);
+			}
+			if (current < target)
+				low = scale;
+			else
+				high = scale;
+		}
+		return best;
+	}
+
+	/*
+	* Expand 8-bit texels to linear RGBA floats.
+	* @param[in] pixels
+	* @param[in] count Number of texels.
+	* @param[in] components
+	* @param[in] srgb Decode the color channels from sRGB.
+	* @param[out] rgba 4 floats per texel; channels the image lacks are 0.
+	* @return void
+	*/
+	inline void toFloat(const unsigned char *pixels, size_t count, int components, bool srgb, float *rgba)
+	{
+		const float *decode = srgbToLinearTable();
+		const int color = colorChannels(components);
+		const int alpha = alphaChannel(components);
+		for (size_t i = 0; i < count; i++)
+		{
+			const unsigned char *texel = pixels + i * components;
+			float *out = rgba + i * 4;
+			out[0] = out[1] = out[2] = out[3] = 0.0f;
+			for (int c = 0; c < color; c++)
+				out[c] = srgb ? decode[texel[c]] : texel[c] / 255.0f;
+			if (alpha >= 0)
+				out[3] = texel[alpha] / 255.0f;
+		}
+	}
+
+	/*
+	* Pack linear RGBA floats back into 8-bit texels.
+	* @param[in] rgba
+	* @param[in] count
+	* @param[in] components
+	* @param[in] srgb Encode the color channels to sRGB.
+	* @param[in] alphaScale Applied to alpha before packing.
+	* @param[out] pixels
+	* @return void
+	*/
+	inline void toBytes(const float *rgba, size_t count, int components, bool srgb, float alphaScale, unsigned char *pixels)
+	{
+		const unsigned char *encode = linearToSrgbTable();
+		const int color = colorChannels(components);
+		const int alpha = alphaChannel(components);
+		for (size_t i = 0; i < count; i++)
+		{
+			const float *texel = rgba + i * 4;
+			unsigned char *out = pixels + i * components;
+			for (int c = 0; c < color; c++)
+				out[c] = srgb ? encode[static_cast<int>(texel[c] * 4095.0f + 0.5f)] : static_cast<unsigned char>(texel[c] * 255.0f + 0.5f);
+			if (alpha >= 0)
+				out[alpha] = static_cast<unsigned char>(std::min(1.0f, texel[3] * alphaScale) * 255.0f + 0.5f);
+		}
+	}
+
+	/*
+	* Build every level below the base image.
+	* @param[in] pixels Base level.
+	* @param[in] width
+	* @param[in] height
+	* @param[in] components
+	* @param[in] settings
+	* @return levels 1 to levelCount - 1.
+	*/
+	inline std::vector<MipLevel> generate(const unsigned char *pixels, int width, int height, int components, const MipSettings &settings)
+	{
+		std::vector<MipLevel> levels(levelCount(width, height) - 1);
+		std::vector<float> current(static_cast<size_t>(width) * height * 4);
+		toFloat(pixels, static_cast<size_t>(width) * height, components, settings.srgb, current.data());
+
+		const bool keepCoverage = settings.alphaCutoff > 0.0f && alphaChannel(components) >= 0;
+		const float targetCoverage = keepCoverage ? coverage(current.data(), static_cast<size_t>(width) * height, settings.alphaCutoff, 1.0f) : 0.0f;
+
+		std::vector<float> horizontal, next;
+		for (MipLevel &level : levels)
+		{
+			level.width = std::max(1, width / 2);
+			level.height = std::max(1, height / 2);
+			const std::vector<Tap> columns = makeTaps(width, level.width, settings.filter);
+			const std::vector<Tap> rows = makeTaps(height, level.height, settings.filter);
+
+			// shrink the rows first, then the columns of the result
+			horizontal.resize(static_cast<size_t>(level.width) * height * 4);
+			forRows(height, settings.parallel, [&](int first, int last)
+			{
+				for (int y = first; y < last; y++)
+				{
+					const float *source = current.data() + static_cast<size_t>(y) * width * 4;
+					float *target = horizontal.data() + static_cast<size_t>(y) * level.width * 4;
+					for (int x = 0; x < level.width; x++)
+						filterTexel(source, 4, columns[x], target + x * 4);
+				}
+			});
+			next.resize(static_cast<size_t>(level.width) * level.height * 4);
+			forRows(level.height, settings.parallel, [&](int first, int last)
+			{
+				for (int y = first; y < last; y++)
+				{
+					float *target = next.data() + static_cast<size_t>(y) * level.width * 4;
+					for (int x = 0; x < level.width; x++)
+						filterTexel(horizontal.data() + x * 4, static_cast<size_t>(level.width) * 4, rows[y], target + x * 4);
+					saturate(target, static_cast<size_t>(level.width) * 4);
+				}
+			});
+
+			// the chain carries on from the unscaled alpha; only the stored level is rescaled
+			const size_t count = static_cast<size_t>(level.width) * level.height;
+			const float alphaScale = keepCoverage ? coverageScale(next.data(), count, settings.alphaCutoff, targetCoverage) : 1.0f;
+			level.pixels.resize(count * components);
+			toBytes(next.data(), count, components, settings.srgb, alphaScale, level.pixels.data());
+
+			current.swap(next);
+			width = level.width;
+			height = level.height;
+		}
+		return levels;
+	}
+
+	/*
+	* Settings for an image loaded at run time, which comes without a word on what its channels mean: the
+	* Kaiser filter, three and four channel images taken as sRGB color, and the alpha test coverage of the
+	* default 0.5 reference kept. Opaque alpha keeps a coverage of one, so it is left as it is.
+	* @param[in] components
+	* @return MipSettings
+	*/
+	inline MipSettings runtimeSettings(int components)
+	{
+		MipSettings settings;
+		settings.filter = MIP_KAISER;
+		settings.srgb = components >= 3;
+		settings.alphaCutoff = alphaChannel(components) >= 0 ? 0.5f : 0.0f;
+		return settings;
+	}
+
+	/*
+	* Build every level below the base image with the runtime settings. Runs on the calling thread, so it
+	* is fine inside pool jobs.
+	* @param[in] pixels Base level.
+	* @param[in] width
+	* @param[in] height
+	* @param[in] components
+	* @return levels 1 to levelCount - 1.
+	*/
+	inline std::vector<MipLevel> buildChain(const unsigned char *pixels, int width, int height, int components)
+	{
+		return generate(pixels, width, height, components, runtimeSettings(components));
+	}
+}
+
+#endif
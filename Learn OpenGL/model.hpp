@@ -2,14 +2,50 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <unordered_set>
 #include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+#include "alloc_counter.hpp"
+#include "camera.hpp"
+#include "material_atlas.hpp"
 #include "shader.hpp"
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_lod.hpp"
+#include "mesh_optimizer.hpp"
+#include "meshlet.hpp"
 #include "stb_image.h"
+#include "texture_cache.hpp"
+#include "thread_pool.hpp"
 
 
 unsigned int TextureFromFile(const char* path, std::string &directory);
 
+// CPU-side result of importing a model file. Model::import builds it without touching GL, so it can run
+// on any thread; Model::uploadNext then turns it into meshes on the GL thread one mesh at a time.
+struct ImportedModel
+{
+	std::string directory;
+	std::vector<MeshData> meshes;
+	// material textures packed into arrays, when the import asked for it
+	MaterialAtlas atlas;
+	size_t uploaded = 0;
+	bool valid = false;
+};
+
+// Import profiles. Fast skips the optimization passes to keep debug loads quick; Shipping welds and
+// reorders every mesh (see mesh_optimizer.hpp), builds its LOD chain (see mesh_lod.hpp) and the result
+// is kept in the cooked cache.
+enum ImportProfile
+{
+	IMPORT_FAST,
+	IMPORT_SHIPPING
+};
 
 class Model
 {
@@ -17,180 +53,463 @@ public:
 	std::vector<Texture> textures_loaded;
 	std::vector<Mesh> meshes;
 	std::string directory;
+	ImportProfile profile;
+	VertexFormat vertexFormat;
+	// split meshes into meshlets (see meshlet.hpp) so the culled Draw can skip hidden clusters
+	bool buildMeshlets;
+	// pack the material textures into array textures (see material_atlas.hpp); draw with a shader that
+	// samples them, such as cube.frag compiled with PACKED
+	bool packTextures;
+	// arrays the packed textures live in. Like the geometry arenas, they are left to the context.
+	MaterialAtlas atlas;
+	// meshlets submitted and considered by the last culled Draw
+	size_t meshletsDrawn = 0;
+	size_t meshletsTotal = 0;
+	// draw calls issued by the last Draw
+	size_t drawCalls = 0;
 	
-	Model(const std::string &path)
+	Model(const std::string &path, ImportProfile profile = IMPORT_FAST, VertexFormat vertexFormat = VERTEX_FULL, bool buildMeshlets = false,
+		bool packTextures = false)
+		: profile(profile), vertexFormat(vertexFormat), buildMeshlets(buildMeshlets), packTextures(packTextures)
 	{
-		loadModel(path);
+		ImportedModel imported = import(path, profile, buildMeshlets, packTextures);
+		while (uploadNext(imported))
+		{
+		}
 	}
+
+	// Empty model that is filled in by uploadNext, used by the asynchronous loader (see model_loader.hpp).
+	Model(ImportProfile profile, VertexFormat vertexFormat, bool buildMeshlets, bool packTextures = false)
+		: profile(profile), vertexFormat(vertexFormat), buildMeshlets(buildMeshlets), packTextures(packTextures)
+	{
+	}
+
+	/*
+	* Read a model file into CPU-side meshes, from the cooked cache when it is up to date. Touches no GL
+	* state and may run on any thread.
+	* @param[in] path
+	* @param[in] profile
+	* @param[in] buildMeshlets
+	* @param[in] packTextures Decode the material textures here and pack them, printing a packing report.
+	* @return ImportedModel, not valid if the file could not be read.
+	*/
+	static ImportedModel import(const std::string &path, ImportProfile profile, bool buildMeshlets, bool packTextures = false)
+	{
+		const unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals;
+		ImportedModel imported;
+		imported.directory = path.substr(0, path.find_last_of('/'));
+
+		// warm start: use the cooked meshes if they were built from this exact source and flags
+		MeshCache::Key key;
+		const bool cacheable = MeshCache::makeKey(path, importFlags, profile, key);
+		const std::string cachePath = MeshCache::cachePathFor(path);
+		if (cacheable && loadCooked(cachePath, key, buildMeshlets, imported))
+		{
+			prepareTextures(imported, packTextures);
+			return imported;
+		}
+
+		Assimp::Importer impoter;
+		const aiScene *scene = impoter.ReadFile(path, importFlags);
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+		{
+			std::cout << "ERROR:ASSIMP::" << impoter.GetErrorString() << std::endl;
+			return imported;
+		}
+
+		std::vector<aiMesh*> work;
+		processNode(scene->mRootNode, scene, work);
+		processMeshes(work, scene, profile, buildMeshlets, imported.meshes);
+		imported.valid = true;
+		prepareTextures(imported, packTextures);
+
+		if (cacheable)
+		{
+			MeshCache::write(cachePath, key, imported.meshes);
+		}
+		return imported;
+	}
+
+	/*
+	* Load the textures of the next imported mesh and upload it. Must run on the GL thread.
+	* @param[in,out] imported
+	* @return false once every mesh has been uploaded.
+	*/
+	bool uploadNext(ImportedModel &imported)
+	{
+		if (imported.uploaded >= imported.meshes.size())
+		{
+			return false;
+		}
+		if (imported.uploaded == 0)
+		{
+			directory = imported.directory;
+			meshes.reserve(meshes.size() + imported.meshes.size());
+			if (!imported.atlas.empty())
+			{
+				imported.atlas.upload();
+				atlas = std::move(imported.atlas);
+			}
+		}
+		MeshData &data = imported.meshes[imported.uploaded++];
+		std::vector<Texture> textures;
+		textures.reserve(data.textures.size());
+		for (const TextureRef &ref : data.textures)
+		{
+			const PackedTexture *packed = atlas.find(ref.path);
+			textures.push_back(packed ? packedTexture(*packed, ref) : loadTexture(ref.path.c_str(), ref.type));
+		}
+		meshes.emplace_back(std::move(data), std::move(textures), vertexFormat);
+		return imported.uploaded < imported.meshes.size();
+	}
+	// Draw every mesh at full detail. Meshes sharing an arena and a material go out in one multi-draw.
+	// With packed textures, consecutive meshes also keep the arrays bound and only change layers.
 	void Draw(Shader &shader)
 	{
-		for (unsigned int i = 0; i < meshes.size(); i++)
+		drawBatched(shader, [](Mesh &mesh, DrawBatch &batch)
+		{
+			mesh.appendLod(0, batch);
+		});
+	}
+
+	/*
+	* Draw every mesh at the coarsest level of detail whose error stays below a pixel threshold on screen.
+	* Meshes drawn at full detail that have meshlets only submit the meshlets inside the frustum that do
+	* not face away from the camera.
+	* @param shader
+	* @param model Model matrix the meshes are drawn with.
+	* @param viewProjection Projection times view matrix.
+	* @param camera Camera the scene is viewed from; its Zoom is the vertical field of view.
+	* @param viewportHeight Height of the viewport in pixels.
+	* @param pixelThreshold Largest allowed projected error in pixels.
+	* @return void
+	*/
+	void Draw(Shader &shader, const glm::mat4 &model, const glm::mat4 &viewProjection, const Camera &camera, float viewportHeight, float pixelThreshold = 1.0f)
+	{
+		// pixels covered by one world unit at distance 1
+		const float pixelsPerUnit = viewportHeight / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
+		const float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		const Meshlets::View view = Meshlets::makeView(model, viewProjection, camera.Position);
+		meshletsDrawn = 0;
+		meshletsTotal = 0;
+		drawBatched(shader, [&](Mesh &mesh, DrawBatch &batch)
+		{
+			const unsigned int lod = selectLod(mesh, model, scale, camera.Position, pixelsPerUnit, pixelThreshold);
+			if (lod == 0 && !mesh.meshlets.empty())
+			{
+				meshletsDrawn += Meshlets::cull(mesh.meshletBounds, mesh.meshlets.size(), view, meshletVisibility);
+				meshletsTotal += mesh.meshlets.size();
+				mesh.appendMeshlets(meshletVisibility, batch);
+			}
+			else
+			{
+				mesh.appendLod(lod, batch);
+			}
+		});
+	}
+	static unsigned int selectLod(const Mesh &mesh, const glm::mat4 &model, float scale, const glm::vec3 &viewPosition, float pixelsPerUnit, float pixelThreshold)
+	{
+		// project each level's error from the point of the bounding sphere nearest to the camera
+		const glm::vec3 center = glm::vec3(model * glm::vec4(mesh.boundsCenter, 1.0f));
+		const float distance = glm::length(center - viewPosition) - mesh.boundsRadius * scale;
+		if (distance <= 0.0f)
 		{
-			meshes[i].Draw(shader);
+			return 0;
+		}
+		unsigned int lod = 0;
+		for (unsigned int level = 1; level < mesh.lods.size(); level++)
+		{
+			if (mesh.lods[level].error * scale / distance * pixelsPerUnit > pixelThreshold)
+			{
+				break;
+			}
+			lod = level;
 		}
+		return lod;
 	}
 private:
+	// GL names already in textures_loaded
+	std::unordered_set<unsigned int> loadedIds;
+	// scratch for the Draw calls
+	std::vector<unsigned char> meshletVisibility;
+	DrawBatch batch;
 
-	void loadModel(const std::string &path)
+	// Gather consecutive meshes that can share state into one batch each and draw it.
+	template <class Append>
+	void drawBatched(Shader &shader, Append append)
 	{
-		Assimp::Importer impoter;
-		const aiScene *scene = impoter.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals);
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+		drawCalls = 0;
+		const Mesh *previous = nullptr;
+		for (size_t first = 0; first < meshes.size();)
 		{
-			std::cout << "ERROR:ASSIMP::" << impoter.GetErrorString() << std::endl;
-			return;
+			batch.clear();
+			size_t last = first;
+			do
+			{
+				append(meshes[last], batch);
+				last++;
+			} while (last < meshes.size() && meshes[last].canBatchWith(meshes[first]));
+			if (!batch.counts.empty())
+			{
+				meshes[first].DrawBatched(shader, batch, !previous || !meshes[first].sharesTexturesWith(*previous));
+				previous = &meshes[first];
+				drawCalls++;
+			}
+			first = last;
 		}
-		directory = path.substr(0, path.find_last_of('/'));
+	}
 
-		processNode(scene->mRootNode, scene);
-	};
-	void processNode(aiNode *node, const aiScene *scene)
+	static bool loadCooked(const std::string &cachePath, const MeshCache::Key &key, bool buildMeshlets, ImportedModel &imported)
+	{
+		MeshCache::CookedModel cooked;
+		if (!cooked.open(cachePath, key))
+		{
+			return false;
+		}
+		imported.meshes.resize(cooked.meshes.size());
+		for (size_t i = 0; i < cooked.meshes.size(); i++)
+		{
+			const MeshCache::CookedMesh &cookedMesh = cooked.meshes[i];
+			MeshData &data = imported.meshes[i];
+			data.vertices.assign(cookedMesh.vertices, cookedMesh.vertices + cookedMesh.vertexCount);
+			data.indices.assign(cookedMesh.indices, cookedMesh.indices + cookedMesh.indexCount);
+			data.lods.assign(cookedMesh.lods, cookedMesh.lods + cookedMesh.lodCount);
+			data.textures = cookedMesh.textures;
+			// meshlets are cheap to cut from the cooked index order, so they are not stored in the cache
+			if (buildMeshlets)
+			{
+				Meshlets::build(data);
+			}
+		}
+		imported.valid = true;
+		return true;
+	}
+	// pack the material textures if asked, and start decoding the rest on the worker pool so uploadNext
+	// only uploads them
+	static void prepareTextures(ImportedModel &imported, bool packTextures)
+	{
+		if (packTextures)
+		{
+			imported.atlas.build(imported.directory, imported.meshes);
+			imported.atlas.printReport();
+		}
+		for (const MeshData &mesh : imported.meshes)
+		{
+			for (const TextureRef &ref : mesh.textures)
+			{
+				if (!imported.atlas.find(ref.path))
+				{
+					TextureCache::shared().prefetch(imported.directory + '/' + ref.path);
+				}
+			}
+		}
+	}
+	static void processNode(aiNode *node, const aiScene *scene, std::vector<aiMesh*> &work)
 	{
-		// process the node's meshes if any exist
+		// collect the node's meshes if any exist
 		for (unsigned int i = 0; i< node->mNumMeshes; i++)
 		{
-			aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			work.push_back(scene->mMeshes[node->mMeshes[i]]);
 		}
 		// do the same for the node's children
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, work);
 		}
 	}
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	static void processMeshes(const std::vector<aiMesh*> &work, const aiScene *scene, ImportProfile profile, bool buildMeshlets, std::vector<MeshData> &meshes)
 	{
-		std::vector<Vertex> vertices;
-		std::vector<unsigned int> indices;
-		std::vector<Texture> textures;
+		// meshes are converted on the worker pool while this thread reads the material texture paths.
+		// Results are kept in work order to keep `meshes` deterministic.
+		ThreadPool &pool = ThreadPool::shared();
+		const bool optimize = profile == IMPORT_SHIPPING;
+		const bool meshlets = buildMeshlets;
+		std::vector<MeshOptimizer::Report> reports(work.size());
+		std::vector<std::future<MeshData>> converted;
+		converted.reserve(work.size());
+		for (size_t i = 0; i < work.size(); i++)
+		{
+			const aiMesh *mesh = work[i];
+			MeshOptimizer::Report *report = &reports[i];
+			converted.push_back(pool.submit([mesh, optimize, meshlets, report]
+			{
+				MeshData data = processMesh(mesh);
+				if (optimize)
+				{
+					*report = MeshOptimizer::optimize(data);
+					MeshLodGenerator::generate(data);
+				}
+				if (meshlets)
+				{
+					Meshlets::build(data);
+				}
+				return data;
+			}));
+		}
 
-		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-		{
-			Vertex vertex;
-			// add position
-			glm::vec3 position;
-			position.x = mesh->mVertices[i].x;
-			position.y = mesh->mVertices[i].y;
-			position.z = mesh->mVertices[i].z;
-			vertex.Position = position;
-			// add normals
-			if (mesh->HasNormals())
+		std::vector<std::vector<TextureRef>> textures(work.size());
+		for (size_t i = 0; i < work.size(); i++)
+		{
+			textures[i] = processMaterial(work[i], scene);
+		}
+		meshes.reserve(meshes.size() + work.size());
+		for (size_t i = 0; i < work.size(); i++)
+		{
+			meshes.push_back(converted[i].get());
+			meshes.back().textures = std::move(textures[i]);
+		}
+
+		if (optimize)
+		{
+			for (size_t i = 0; i < reports.size(); i++)
 			{
-				glm::vec3 normal;
-				normal.x = mesh->mNormals[i].x;
-				normal.y = mesh->mNormals[i].y;
-				normal.z = mesh->mNormals[i].z;
-				vertex.Normal = normal;
+				const MeshOptimizer::Report &report = reports[i];
+				std::cout << "MODEL::OPTIMIZE::MESH " << i
+					<< " vertices " << report.verticesBefore << " -> " << report.verticesAfter
+					<< " ACMR " << report.before.acmr << " -> " << report.after.acmr
+					<< " ATVR " << report.before.atvr << " -> " << report.after.atvr << std::endl;
 			}
-			// add texture coordinates (if they exist)
-			if (mesh->mTextureCoords[0])
+		}
+	}
+	static MeshData processMesh(const aiMesh *mesh)
+	{
+#ifdef LEARNOPENGL_COUNT_ALLOCATIONS
+		const size_t allocationsBefore = AllocationCounter::threadCount();
+#endif
+		MeshData data;
+		const unsigned int vertexCount = mesh->mNumVertices;
+
+		// size both arrays up front so the conversion below never reallocates
+		size_t indexCount = 0;
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		{
+			indexCount += mesh->mFaces[i].mNumIndices;
+		}
+		data.vertices.resize(vertexCount);
+		data.indices.resize(indexCount);
+		Vertex *vertices = data.vertices.data();
+
+		// convert one attribute at a time so each loop is branch free. The 16 byte stores spill into the
+		// next attribute, which is why positions, normals and texture coordinates are written in that order.
+		static_assert(sizeof(aiVector3D) == sizeof(glm::vec3), "Assimp must be built with single precision ai_real");
+		convertVec3(mesh->mVertices, vertexCount, vertices, offsetof(Vertex, Position));
+		if (mesh->HasNormals())
+		{
+			convertVec3(mesh->mNormals, vertexCount, vertices, offsetof(Vertex, Normal));
+		}
+		else
+		{
+			for (unsigned int i = 0; i < vertexCount; i++)
 			{
-				glm::vec2 vec;
-				vec.x = mesh->mTextureCoords[0][i].x;
-				vec.y = mesh->mTextureCoords[0][i].y;
-				vertex.TexCoords = vec;
+				vertices[i].Normal = glm::vec3(0.0f);
 			}
-			else
+		}
+		// add texture coordinates (if they exist)
+		if (mesh->mTextureCoords[0])
+		{
+			const aiVector3D *texCoords = mesh->mTextureCoords[0];
+			for (unsigned int i = 0; i < vertexCount; i++)
 			{
-				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+				vertices[i].TexCoords = glm::vec2(texCoords[i].x, texCoords[i].y);
 			}
-			
-			vertices.push_back(vertex);
 		}
+		else
+		{
+			for (unsigned int i = 0; i < vertexCount; i++)
+			{
+				vertices[i].TexCoords = glm::vec2(0.0f, 0.0f);
+			}
+		}
+
 		// process indices
+		unsigned int *indices = data.indices.data();
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
+			const aiFace &face = mesh->mFaces[i];
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 			{
-				indices.push_back(face.mIndices[j]);
+				*indices++ = face.mIndices[j];
 			}
 		}
+
+#ifdef LEARNOPENGL_COUNT_ALLOCATIONS
+		// exactly one block for the vertices and one for the indices, however large the mesh is
+		assert(AllocationCounter::threadCount() - allocationsBefore <= 2 && "processMesh allocated per vertex");
+#endif
+		return data;
+	}
+	// Copy an array of aiVector3D into the vec3 at `offset` inside each Vertex.
+	static void convertVec3(const aiVector3D *source, unsigned int count, Vertex *vertices, size_t offset)
+	{
+		unsigned char *destination = reinterpret_cast<unsigned char*>(vertices) + offset;
+		unsigned int i = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		// one unaligned 16 byte load per vertex, which reads x of the next source vector, so the last vertex
+		// is left to the scalar loop. The store is x and y, then z, so nothing after the vec3 is written.
+		for (; i + 1 < count; i++)
+		{
+			float *value = reinterpret_cast<float*>(destination + i * sizeof(Vertex));
+			const __m128 xyz = _mm_loadu_ps(reinterpret_cast<const float*>(source + i));
+			_mm_storel_pi(reinterpret_cast<__m64*>(value), xyz);
+			_mm_store_ss(value + 2, _mm_movehl_ps(xyz, xyz));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			glm::vec3 *value = reinterpret_cast<glm::vec3*>(destination + i * sizeof(Vertex));
+			*value = glm::vec3(source[i].x, source[i].y, source[i].z);
+		}
+	}
+	static std::vector<TextureRef> processMaterial(const aiMesh *mesh, const aiScene *scene)
+	{
+		std::vector<TextureRef> textures;
 		// process materials
 		if (mesh->mMaterialIndex >= 0)
 		{
 			aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
 			// 1. diffuse maps
-			std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-			textures.end();
-			diffuseMaps.begin();
-			diffuseMaps.end();
-			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+			materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
 			// 2. specular maps
-			std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+			materialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
 		}
-
-		return Mesh(vertices, indices, textures);
+		return textures;
 	}
-	std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
+	static void materialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName, std::vector<TextureRef> &textures)
 	{
-		std::vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			bool skip = false;
-			// check if any textures have been loaded already
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true;
-					break;
-				}
-			}
-			if (!skip)
-			{
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture); // added to loaded textures
-			}
+			textures.push_back({ typeName, str.C_Str() });
 		}
-		return textures;
 	}
-};
-
-unsigned int TextureFromFile(const char *path, std::string &directory)
-{
-	std::string filename = std::string(path);
-	filename = directory + '/' + filename;
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
+	Texture loadTexture(const char *path, const std::string &typeName)
 	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
+		// textures are shared with every other model through the cache
+		Texture texture;
+		texture.handle = TextureCache::shared().acquire(directory + '/' + path);
+		texture.id = texture.handle.id();
+		texture.type = typeName;
+		texture.path = path;
+		if (loadedIds.insert(texture.id).second)
+		{
+			textures_loaded.push_back(texture); // added to loaded textures
+		}
+		return texture;
 	}
-	else
+	Texture packedTexture(const PackedTexture &packed, const TextureRef &ref) const
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		Texture texture;
+		texture.id = atlas.arrayId(packed.array);
+		texture.type = ref.type;
+		texture.path = ref.path;
+		texture.layer = packed.layer;
+		texture.transform = packed.transform;
+		return texture;
 	}
+};
 
-	return textureID;
-}
\ No newline at end of file
+unsigned int TextureFromFile(const char *path, std::string &directory)
+{
+	return TextureCache::shared().acquirePinned(directory + '/' + path);
+}
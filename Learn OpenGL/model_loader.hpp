@@ -0,0 +1,167 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "camera.hpp"
+#include "model.hpp"
+#include "shader.hpp"
+
+enum LoadState
+{
+	LOAD_IMPORTING,	// parsing and converting on a background thread
+	LOAD_UPLOADING,	// meshes are being uploaded a few per frame and draw as they arrive
+	LOAD_READY,
+	LOAD_FAILED
+};
+
+// Handle to a model loaded by ModelLoader. It can be drawn at any time: meshes show up as they are
+// uploaded, and until the first one is there the placeholder is drawn instead, if there is one.
+class AsyncModel
+{
+public:
+	Model model;
+	Model *placeholder;
+
+	AsyncModel(ImportProfile profile, VertexFormat vertexFormat, bool buildMeshlets, Model *placeholder, bool packTextures = false)
+		: model(profile, vertexFormat, buildMeshlets, packTextures), placeholder(placeholder)
+	{
+	}
+
+	LoadState state() const
+	{
+		return loadState;
+	}
+	bool ready() const
+	{
+		return loadState == LOAD_READY;
+	}
+	// fraction of the meshes that are drawable
+	float progress() const
+	{
+		if (loadState == LOAD_READY)
+			return 1.0f;
+		if (imported.meshes.empty())
+			return 0.0f;
+		return static_cast<float>(imported.uploaded) / imported.meshes.size();
+	}
+
+	void Draw(Shader &shader)
+	{
+		if (!model.meshes.empty())
+		{
+			model.Draw(shader);
+		}
+		else if (placeholder)
+		{
+			placeholder->Draw(shader);
+		}
+	}
+
+	void Draw(Shader &shader, const glm::mat4 &modelMatrix, const glm::mat4 &viewProjection, const Camera &camera, float viewportHeight, float pixelThreshold = 1.0f)
+	{
+		if (!model.meshes.empty())
+		{
+			model.Draw(shader, modelMatrix, viewProjection, camera, viewportHeight, pixelThreshold);
+		}
+		else if (placeholder)
+		{
+			placeholder->Draw(shader, modelMatrix, viewProjection, camera, viewportHeight, pixelThreshold);
+		}
+	}
+
+private:
+	friend class ModelLoader;
+	std::future<ImportedModel> pending;
+	ImportedModel imported;
+	LoadState loadState = LOAD_IMPORTING;
+};
+
+// Loads models without blocking the render loop. Files are read and converted on background threads;
+// the GL uploads happen in update(), which stops once the frame's time budget is used up.
+class ModelLoader
+{
+public:
+	/*
+	* Start loading a model.
+	* @param[in] path
+	* @param[in] profile
+	* @param[in] vertexFormat
+	* @param[in] buildMeshlets
+	* @param[in] placeholder Model drawn until the first mesh is uploaded, may be null. Must outlive the handle.
+	* @param[in] packTextures Pack the material textures into array textures (see material_atlas.hpp).
+	* @return handle that is drawable right away.
+	*/
+	std::shared_ptr<AsyncModel> load(const std::string &path, ImportProfile profile = IMPORT_FAST, VertexFormat vertexFormat = VERTEX_FULL,
+		bool buildMeshlets = false, Model *placeholder = nullptr, bool packTextures = false)
+	{
+		std::shared_ptr<AsyncModel> handle = std::make_shared<AsyncModel>(profile, vertexFormat, buildMeshlets, placeholder, packTextures);
+		// a thread of its own rather than the shared pool, because the import waits on pool jobs itself
+		handle->pending = std::async(std::launch::async, [path, profile, buildMeshlets, packTextures]
+		{
+			return Model::import(path, profile, buildMeshlets, packTextures);
+		});
+		loading.push_back(handle);
+		return handle;
+	}
+
+	/*
+	* Upload finished imports. Call once per frame on the GL thread. At least one mesh is uploaded per
+	* call when one is waiting, so loading always makes progress.
+	* @param[in] budgetSeconds Time after which no further mesh is started.
+	* @return void
+	*/
+	void update(double budgetSeconds)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		bool uploadedAny = false;
+		auto withinBudget = [&]()
+		{
+			return !uploadedAny || std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < budgetSeconds;
+		};
+
+		for (size_t i = 0; i < loading.size(); )
+		{
+			AsyncModel &handle = *loading[i];
+			if (handle.loadState == LOAD_IMPORTING &&
+				handle.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			{
+				handle.imported = handle.pending.get();
+				handle.loadState = handle.imported.valid ? LOAD_UPLOADING : LOAD_FAILED;
+			}
+			while (handle.loadState == LOAD_UPLOADING && withinBudget())
+			{
+				uploadedAny = true;
+				if (!handle.model.uploadNext(handle.imported))
+				{
+					handle.loadState = LOAD_READY;
+					handle.imported = ImportedModel();
+				}
+			}
+
+			if (handle.loadState == LOAD_READY || handle.loadState == LOAD_FAILED)
+			{
+				loading.erase(loading.begin() + i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	bool idle() const
+	{
+		return loading.empty();
+	}
+
+private:
+	std::vector<std::shared_ptr<AsyncModel>> loading;
+};
+
+#endif
@@ -6,7 +6,12 @@ out VS_OUT {
     vec3 normal;
 } vs_out;
 
-uniform mat4 view;
+// camera state shared by every program, see frame_uniforms.hpp
+layout (std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
 uniform mat4 model;
 
 void main()
@@ -0,0 +1,411 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hash.hpp"
+#include "mapped_file.hpp"
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// One stage of a program, read from its file.
+struct ShaderStage
+{
+	GLenum type;
+	std::string path;
+	std::string source;
+};
+
+// Linked programs, kept two ways. Within a run, programs built from the same sources and defines are
+// linked once and handed to every Shader that asks for them. Across runs, with ARB_get_program_binary,
+// each program's driver binary is written to a cache directory after its first link and loaded with
+// glProgramBinary on later starts instead of compiling GLSL.
+//
+// Keys hash every stage's type and its source as compiled, defines included, seeded with the GL vendor, renderer and
+// version strings, so a driver update or a different GPU misses rather than loading a binary it cannot
+// use. The driver may still reject a binary it wrote itself; that counts as a miss and the program is
+// compiled and its file rewritten.
+//
+// Programs compiled from source are handed over while the driver links them, and finished (their stages
+// and link checked, their shaders deleted and their binary written) by the first Shader that needs one
+// or by update(), whichever comes first, so programs nothing draws with are finished too. GL thread only.
+class ProgramCache
+{
+public:
+	static const uint32_t VERSION = 1;
+
+	struct Stats
+	{
+		size_t shared;		// programs handed out again from within the run
+		size_t loaded;		// binaries the driver accepted
+		size_t rejected;	// binaries the driver refused, or files that did not match
+		size_t compiled;
+		size_t written;
+	};
+
+	static ProgramCache &shared()
+	{
+		static ProgramCache instance;
+		return instance;
+	}
+
+	ProgramCache(const ProgramCache&) = delete;
+	ProgramCache& operator=(const ProgramCache&) = delete;
+
+	/*
+	* Start keeping binaries in a directory. Until this is called programs are only shared within the run.
+	* Needs a current GL context.
+	* @param[in] directory Created if it does not exist.
+	* @return false if the driver cannot hand out binaries or the directory cannot be created.
+	*/
+	bool enable(const std::string &directory)
+	{
+		driverKey = hashString(glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION) + "\n" +
+			glString(GL_SHADING_LANGUAGE_VERSION));
+		GLint formats = 0;
+		if (glfwExtensionSupported("GL_ARB_get_program_binary"))
+		{
+			getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(glfwGetProcAddress("glGetProgramBinary"));
+			programBinary = reinterpret_cast<ProgramBinaryProc>(glfwGetProcAddress("glProgramBinary"));
+			programParameteri = reinterpret_cast<ProgramParameteriProc>(glfwGetProcAddress("glProgramParameteri"));
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		if (!getProgramBinary || !programBinary || !programParameteri || formats == 0)
+		{
+			std::cout << "PROGRAM_CACHE::UNAVAILABLE programs are compiled on every start" << std::endl;
+			return false;
+		}
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if (!std::filesystem::is_directory(directory, error))
+		{
+			std::cout << "ERROR::PROGRAM_CACHE::DIRECTORY_NOT_CREATED: " << directory << std::endl;
+			return false;
+		}
+		root = directory;
+		active = true;
+		return true;
+	}
+
+	bool enabled() const
+	{
+		return active;
+	}
+
+	/*
+	* Key of a program built from some stages.
+	* @param[in] stages Every stage with its source.
+	* @return uint64_t
+	*/
+	uint64_t key(const std::vector<ShaderStage> &stages) const
+	{
+		uint64_t hash = driverKey;
+		for (const ShaderStage &stage : stages)
+		{
+			hash = hashBytes(&stage.type, sizeof(stage.type), hash);
+			hash = hashString(stage.source, hash);
+		}
+		return hash;
+	}
+
+	/*
+	* Program already linked this run from the same key.
+	* @param[in] key
+	* @return GL name, 0 if there is none.
+	*/
+	unsigned int find(uint64_t key)
+	{
+		auto found = programs.find(key);
+		if (found == programs.end())
+		{
+			return 0;
+		}
+		counters.shared++;
+		return found->second;
+	}
+
+	/*
+	* Load the cached binary of a program into a new program object.
+	* @param[in] key
+	* @param[in] program Fresh program object.
+	* @return false if there is no binary or the driver did not accept it; compile and link as usual then.
+	*/
+	bool load(uint64_t key, unsigned int program)
+	{
+		if (!active)
+		{
+			return false;
+		}
+		const std::string path = pathFor(key);
+		std::error_code error;
+		if (!std::filesystem::exists(path, error))
+		{
+			return false;
+		}
+		MappedFile file;
+		if (!file.open(path) || file.size() < sizeof(Header))
+		{
+			counters.rejected++;
+			return false;
+		}
+		Header header;
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.key != key ||
+			header.length != file.size() - sizeof(Header))
+		{
+			counters.rejected++;
+			return false;
+		}
+		programBinary(program, header.format, file.data() + sizeof(Header), static_cast<GLsizei>(header.length));
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			counters.rejected++;
+			return false;
+		}
+		counters.loaded++;
+		return true;
+	}
+
+	// Ask the driver to keep the binary of a program about to be linked.
+	void prepare(unsigned int program)
+	{
+		if (active)
+		{
+			programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		counters.compiled++;
+	}
+
+	/*
+	* Remember a program for the rest of the run, as soon as it is created so Shaders built from the same
+	* sources share it even while it is still linking.
+	* @param[in] key
+	* @param[in] program
+	* @return void
+	*/
+	void insert(uint64_t key, unsigned int program)
+	{
+		programs[key] = program;
+	}
+
+	/*
+	* Take over a program whose link was just started, to finish it once the link is done.
+	* @param[in] key
+	* @param[in] program
+	* @param[in] shaders Attached to the program, one per stage.
+	* @param[in] stages Without their sources, for error messages.
+	* @return void
+	*/
+	void linking(uint64_t key, unsigned int program, std::vector<unsigned int> shaders, std::vector<ShaderStage> stages)
+	{
+		links[program] = { key, std::move(shaders), std::move(stages) };
+	}
+
+	/*
+	* Wait for the link of a program taken over by linking(), report its errors, delete its shaders and
+	* keep its binary if it linked. Programs that are not linking are left alone.
+	* @param[in] program
+	* @return void
+	*/
+	void finish(unsigned int program)
+	{
+		auto found = links.find(program);
+		if (found == links.end())
+		{
+			return;
+		}
+		const Link link = std::move(found->second);
+		links.erase(found);
+		for (size_t i = 0; i < link.shaders.size(); i++)
+		{
+			checkCompile(link.shaders[i], link.stages[i]);
+		}
+		const bool linked = checkLink(program);
+		for (unsigned int shader : link.shaders)
+		{
+			glDetachShader(program, shader);
+			glDeleteShader(shader);
+		}
+		if (linked)
+		{
+			store(link.key, program);
+		}
+	}
+
+	// Finish the programs the driver is done linking, without waiting for the others. Call once per frame.
+	void update()
+	{
+		std::vector<unsigned int> done;
+		for (const auto &entry : links)
+		{
+			GLint complete = GL_FALSE;
+			glGetProgramiv(entry.first, GL_COMPLETION_STATUS_KHR, &complete);
+			if (complete)
+			{
+				done.push_back(entry.first);
+			}
+		}
+		for (unsigned int program : done)
+		{
+			finish(program);
+		}
+	}
+
+	/*
+	* With the cache on, write the binary of a program compiled from source.
+	* @param[in] key
+	* @param[in] program Successfully linked.
+	* @return void
+	*/
+	void store(uint64_t key, unsigned int program)
+	{
+		if (!active)
+		{
+			return;
+		}
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+		{
+			return;
+		}
+		std::vector<char> binary(static_cast<size_t>(length));
+		Header header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.key = key;
+		GLsizei written = 0;
+		getProgramBinary(program, length, &written, &header.format, binary.data());
+		header.length = static_cast<uint64_t>(written);
+
+		// written under another name and renamed, so a reader never sees half a file
+		const std::string path = pathFor(key);
+		const std::string temporary = path + ".tmp";
+		std::error_code error;
+		{
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(binary.data(), written);
+			if (!out)
+			{
+				out.close();
+				std::filesystem::remove(temporary, error);
+				std::cout << "ERROR::PROGRAM_CACHE::WRITE_FAILED: " << path << std::endl;
+				return;
+			}
+		}
+		std::filesystem::rename(temporary, path, error);
+		if (error)
+		{
+			std::filesystem::remove(temporary, error);
+			return;
+		}
+		counters.written++;
+	}
+
+	Stats stats() const
+	{
+		return counters;
+	}
+
+private:
+	typedef void (APIENTRY *GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+	typedef void (APIENTRY *ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+	typedef void (APIENTRY *ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+	static constexpr char MAGIC[4] = { 'L', 'O', 'P', 'B' };
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		GLenum format;
+		uint32_t reserved;
+		uint64_t length;
+	};
+
+	GetProgramBinaryProc getProgramBinary = nullptr;
+	ProgramBinaryProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+	std::string root;
+	bool active = false;
+	uint64_t driverKey = FNV_OFFSET_BASIS;
+	std::unordered_map<uint64_t, unsigned int> programs;
+	// programs still linking, and what finishing them needs
+	struct Link
+	{
+		uint64_t key;
+		std::vector<unsigned int> shaders;
+		std::vector<ShaderStage> stages;
+	};
+	std::unordered_map<unsigned int, Link> links;
+	Stats counters = {};
+
+	ProgramCache() = default;
+
+	static void checkCompile(unsigned int shader, const ShaderStage &stage)
+	{
+		int success;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+			const char *type = stage.type == GL_VERTEX_SHADER ? "VERTEX" : stage.type == GL_GEOMETRY_SHADER ? "GEOMETRY" : "FRAGMENT";
+			std::cout << "ERROR::SHADER::" << type << "::COMPILATION_FAILED " << stage.path << "\n" << infoLog << std::endl;
+		}
+	}
+
+	static bool checkLink(unsigned int program)
+	{
+		int success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(program, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+		}
+		return success != 0;
+	}
+
+	static std::string glString(GLenum name)
+	{
+		const GLubyte *value = glGetString(name);
+		return value ? reinterpret_cast<const char*>(value) : "";
+	}
+
+	std::string pathFor(uint64_t key) const
+	{
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+		return root + "/" + name + ".program";
+	}
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include "gpu_memory.hpp"
+
+// Offscreen framebuffer with a color texture and a depth-stencil renderbuffer, both multisampled when
+// samples are asked for. The attachments are sized to whatever resize() was last given, so a target that
+// follows the window is reallocated when the window changes instead of staying at its first size, and
+// their memory is recorded with GpuMemory under the target's owner.
+class RenderTarget
+{
+public:
+	unsigned int framebuffer = 0;
+	unsigned int color = 0;			// GL_TEXTURE_2D_MULTISAMPLE with samples, GL_TEXTURE_2D otherwise
+	unsigned int depthStencil = 0;
+	int width = 0;
+	int height = 0;
+
+	/*
+	* Constructor for the target. Nothing is allocated before the first resize().
+	* @param[in] owner Name the memory is recorded under, a string literal.
+	* @param[in] samples 0 for a single sampled target.
+	* @return RenderTarget
+	*/
+	explicit RenderTarget(const char *owner, int samples = 0) : owner(owner), samples(samples)
+	{
+	}
+
+	RenderTarget(const RenderTarget&) = delete;
+	RenderTarget& operator=(const RenderTarget&) = delete;
+
+	/*
+	* Allocate the attachments for a size, replacing the old ones. Sizes that did not change and empty
+	* sizes, which a minimized window reports, leave the target as it is.
+	* @param[in] width
+	* @param[in] height
+	* @return false if the framebuffer is not complete.
+	*/
+	bool resize(int width, int height)
+	{
+		if (width <= 0 || height <= 0 || (width == this->width && height == this->height))
+		{
+			return true;
+		}
+		release();
+		this->width = width;
+		this->height = height;
+
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glGenTextures(1, &color);
+		if (samples > 0)
+		{
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, color);
+			glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, GL_RGB, width, height, GL_TRUE);
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, color, 0);
+			GpuMemory::shared().trackTexture(color, GL_RGB, width, height, 1, 1, owner, GPU_MULTISAMPLE, samples);
+		}
+		else
+		{
+			glBindTexture(GL_TEXTURE_2D, color);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+			GpuMemory::shared().trackTexture(color, GL_RGB, width, height, 1, 1, owner, GPU_RENDER_TARGETS);
+		}
+
+		glGenRenderbuffers(1, &depthStencil);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+		if (samples > 0)
+		{
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height);
+		}
+		else
+		{
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+		GpuMemory::shared().trackRenderbuffer(depthStencil, GL_DEPTH24_STENCIL8, width, height, samples, owner);
+
+		const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		if (!complete)
+		{
+			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return complete;
+	}
+
+	// Delete the framebuffer and its attachments. Needs the context they were made in.
+	void release()
+	{
+		if (framebuffer == 0)
+		{
+			return;
+		}
+		GpuMemory::shared().releaseTexture(color);
+		GpuMemory::shared().releaseRenderbuffer(depthStencil);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &color);
+		glDeleteRenderbuffers(1, &depthStencil);
+		framebuffer = color = depthStencil = 0;
+		width = height = 0;
+	}
+
+private:
+	const char *owner;
+	int samples;
+};
+
+#endif
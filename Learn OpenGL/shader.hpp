@@ -4,11 +4,68 @@
 #pragma once
 
 #include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <cstdint>
 #include <string>
 #include <fstream>
+#include <functional>
 #include <sstream>
 #include <iostream>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "hash.hpp"
+#include "program_cache.hpp"
 
+// Name of a uniform, reduced to its hash. The constructors are the same for literals and strings, so a
+// literal passed straight to a setter is usually hashed at run time like a string would be; only a
+// UniformName that is itself a constant expression, such as those in UniformNames, is hashed while
+// compiling.
+struct UniformName
+{
+	uint64_t hash;
+	const char *literal;	// for error messages, null for run time strings
+
+	template <size_t N>
+	constexpr UniformName(const char (&name)[N]) : hash(hashLiteral(name)), literal(name)
+	{
+	}
+
+	UniformName(const std::string &name) : hash(hashString(name)), literal(nullptr)
+	{
+	}
+};
+
+// Uniforms set on every draw, hashed at compile time
+namespace UniformNames
+{
+	constexpr UniformName MODEL("model");
+	constexpr UniformName SHININESS("material.shininess");
+	constexpr UniformName MATERIAL_INDEX("materialIndex");
+	constexpr UniformName FEEDBACK_SLOT("feedbackSlot");
+	constexpr UniformName FEEDBACK_SCALE("feedbackScale");
+	constexpr UniformName POSITION_SCALE("positionScale");
+	constexpr UniformName POSITION_OFFSET("positionOffset");
+	constexpr UniformName OCTAHEDRAL_NORMALS("octahedralNormals");
+}
+
+// Location of a uniform of type T in one program, resolved once with Shader::uniform. A handle to a
+// uniform the program does not have sets nothing, like location -1 does.
+template <typename T>
+struct UniformHandle
+{
+	GLint location = -1;
+
+	bool valid() const
+	{
+		return location >= 0;
+	}
+};
+
+// Preprocessor definitions compiled into every stage of a program, each "NAME" or "NAME value".
+typedef std::vector<std::string> ShaderDefines;
 
 class Shader
 {
@@ -84,74 +141,90 @@ public:
 		
 
 		// shader Program
-		int success;
-		char infoLog[512];
-		ID = glCreateProgram();
 		//glAttachShader(ID, vertex);
 		//glAttachShader(ID, fragment);
-		attachShader(vertexPath, GL_VERTEX_SHADER);
-		attachShader(fragmentPath, GL_FRAGMENT_SHADER);
+		build({ { GL_VERTEX_SHADER, vertexPath }, { GL_FRAGMENT_SHADER, fragmentPath } }, ShaderDefines());
+	}
+
+	/*
+	* Constructor for one variant of a shader, see shader_permutations.hpp.
+	* @param[in] vertexPath File path to vertex shader.
+	* @param[in] fragmentPath File path to fragment shader.
+	* @param[in] defines Defined after the #version line of both stages.
+	* @return Shader
+	*/
+	Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines &defines)
+	{
+		build({ { GL_VERTEX_SHADER, vertexPath }, { GL_FRAGMENT_SHADER, fragmentPath } }, defines);
 	}
 
 	
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath)
 	{
-		int success;
-		char infoLog[512];
-		ID = glCreateProgram();
-		glLinkProgram(ID);
-		
-		attachShader(vertexPath, GL_VERTEX_SHADER);
-		attachShader(geometryPath, GL_GEOMETRY_SHADER);
-		attachShader(fragmentPath, GL_FRAGMENT_SHADER);
+		build({ { GL_VERTEX_SHADER, vertexPath }, { GL_GEOMETRY_SHADER, geometryPath }, { GL_FRAGMENT_SHADER, fragmentPath } }, ShaderDefines());
 	}
 	
 
 	
-	void attachShader(const char* shaderPath, GLenum shaderType)
+	/*
+	* Whether the program has finished linking, without waiting for it. With KHR_parallel_shader_compile
+	* the driver links in the background after the constructor returns; without it a Shader is always ready.
+	* @return bool
+	*/
+	bool ready() const
 	{
-		std::string fileCode;
-		std::ifstream shaderFile;
-		// compile shader
-		shaderFile.exceptions(std::ifstream::failbit || std::ifstream::badbit);
-		try
+		if (!linking)
 		{
-			shaderFile.open(shaderPath);
-			std::stringstream shaderStream;
-			shaderStream << shaderFile.rdbuf();
-			fileCode = shaderStream.str();
+			return true;
 		}
-		catch (std::ifstream::failure e)
+		GLint complete = GL_FALSE;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+		if (complete)
 		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+			wait();
 		}
-		const char* shaderCode = fileCode.c_str();
-		int success;
-		char infoLog[512];
+		return complete != GL_FALSE;
+	}
 
-		// compile shader
-		const unsigned int shader = glCreateShader(shaderType);
-		glShaderSource(shader, 1, &shaderCode, nullptr);
-		glCompileShader(shader);
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-		if (!success)
+	/*
+	* Wait for the link to finish, build the uniform table and run the setup queued with whenLinked. use()
+	* and the uniform lookups call it, so only the first use of a program that is still linking blocks.
+	* Errors are reported and the binary kept by the ProgramCache, here or in its update() if that saw the
+	* link finish first.
+	* @return void
+	*/
+	void wait() const
+	{
+		if (linking)
 		{
-			glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+			ProgramCache::shared().finish(ID);
+			linking = false;
+			reflect();
+			if (!pending.empty())
+			{
+				std::vector<std::function<void()>> setups;
+				setups.swap(pending);
+				run(setups);
+			}
 		}
+	}
 
-		glAttachShader(ID, shader);
-		glLinkProgram(ID);
-
-		glGetProgramiv(ID, GL_LINK_STATUS, &success);
-		if (!success)
+	/*
+	* Run setup that needs the linked program, such as sampler units and uniform block bindings, without
+	* waiting for the link: right away if the program has linked, otherwise from wait() at its first use.
+	* The program is current while setup runs, and the one that was current before is restored after.
+	* @param[in] setup
+	* @return void
+	*/
+	void whenLinked(std::function<void()> setup) const
+	{
+		if (linking)
 		{
-			glGetProgramInfoLog(ID, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			pending.push_back(std::move(setup));
+			return;
 		}
-		glDeleteShader(shader);
+		run({ std::move(setup) });
 	}
-	
 
 	/*
 	* Use shader. Equivalent to glUseProgram.
@@ -159,17 +232,90 @@ public:
 	*/
 	void use()
 	{
+		wait();
 		glUseProgram(ID);
 	};
+	/*
+	* Location of an active uniform, from the table built after linking. No GL call is made once the
+	* program has linked.
+	* @param[in] name Uniform name as glGetUniformLocation takes it, array elements included.
+	* @return GLint, -1 if the program has no such uniform.
+	*/
+	GLint location(UniformName name) const
+	{
+		wait();
+		auto found = uniforms.find(name.hash);
+		return found != uniforms.end() ? found->second.location : -1;
+	}
+
+	/*
+	* Resolve a uniform once for setting it by handle afterwards.
+	* @param[in] name Uniform name as glGetUniformLocation takes it.
+	* @return UniformHandle, invalid if the program has no such uniform or it is not of type T.
+	*/
+	template <typename T>
+	UniformHandle<T> uniform(UniformName name) const
+	{
+		wait();
+		UniformHandle<T> handle;
+		auto found = uniforms.find(name.hash);
+		if (found == uniforms.end())
+		{
+			return handle;
+		}
+		if (!accepts<T>(found->second.type))
+		{
+			std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH: " << (name.literal ? name.literal : "") << std::endl;
+			return handle;
+		}
+		handle.location = found->second.location;
+		return handle;
+	}
+
+	void set(UniformHandle<bool> uniform, bool value) const
+	{
+		glUniform1i(uniform.location, (int)value);
+	}
+
+	void set(UniformHandle<int> uniform, int value) const
+	{
+		glUniform1i(uniform.location, value);
+	}
+
+	void set(UniformHandle<float> uniform, float value) const
+	{
+		glUniform1f(uniform.location, value);
+	}
+
+	void set(UniformHandle<glm::vec2> uniform, const glm::vec2 &value) const
+	{
+		glUniform2fv(uniform.location, 1, &value[0]);
+	}
+
+	void set(UniformHandle<glm::vec3> uniform, const glm::vec3 &value) const
+	{
+		glUniform3fv(uniform.location, 1, &value[0]);
+	}
+
+	void set(UniformHandle<glm::vec4> uniform, const glm::vec4 &value) const
+	{
+		glUniform4fv(uniform.location, 1, &value[0]);
+	}
+
+	void set(UniformHandle<glm::mat4> uniform, const glm::mat4 &value) const
+	{
+		glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
 	/*
 	* Set a uniform bool value in the shader object
 	* @param name Name of uniform value
 	* @param value
 	* @return void
 	*/
-	void setBool(const std::string& name, bool value) const
+	void setBool(UniformName name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(location(name), (int)value);
 	};
 
 	/*
@@ -178,9 +324,9 @@ public:
 	* @param value
 	* @return void
 	*/
-	void setInt(const std::string& name, int value)
+	void setInt(UniformName name, int value)
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(location(name), value);
 	};
 
 	/*
@@ -189,39 +335,269 @@ public:
 	* @param value
 	* @return void
 	*/
-	void setFloat(const std::string& name, float value)
+	void setFloat(UniformName name, float value)
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(location(name), value);
 	};
 
-	void setMat4(const std::string& name, glm::mat4 &value)
+	void setMat4(UniformName name, const glm::mat4 &value)
+	{
+		glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	void setVec3(UniformName name, const glm::vec3 &value)
+	{
+		glUniform3fv(location(name), 1, &value[0]);
+	}
+
+	void setVec3(UniformName name, float x, float y, float z)
+	{
+		glUniform3f(location(name), x, y, z);
+	}
+
+	void setVec2(UniformName name, const glm::vec2 &value)
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+		glUniform2fv(location(name), 1, &value[0]);
 	}
 
-	void setVec3(const std::string& name, const glm::vec3 &value)
+	void setVec2(UniformName name, float x, float y)
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2f(location(name), x, y);
 	}
 
-	void setVec3(const std::string& name, float x, float y, float z)
+	void setVec4(UniformName name, float x, float y, float z, float w)
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform4f(location(name), x, y, z, w);
 	}
 
-	void setVec2(const std::string& name, const glm::vec2 &value)
+private:
+	struct Uniform
+	{
+		GLint location;
+		GLenum type;
+	};
+
+	// the driver may still be linking the program; cleared by whichever lookup first needs it, const or not
+	mutable bool linking = false;
+	// active uniforms of the default block by the hash of their name
+	mutable std::unordered_map<uint64_t, Uniform> uniforms;
+	// whenLinked setup waiting for the link to finish
+	mutable std::vector<std::function<void()>> pending;
+
+	// Whether the driver compiles and links in the background. Asked once, and the driver is left to use
+	// as many compiler threads as it wants.
+	static bool parallelLink()
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		static const bool supported = []()
+		{
+			typedef void (APIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+			MaxShaderCompilerThreadsProc maxThreads = nullptr;
+			if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+			{
+				maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+			}
+			else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+			{
+				maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+			}
+			if (!maxThreads)
+			{
+				return false;
+			}
+			maxThreads(0xFFFFFFFF);
+			return true;
+		}();
+		return supported;
 	}
 
-	void setVec2(const std::string& name, float x, float y)
+	static std::string readFile(const char *path)
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		std::ifstream file;
+		file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			file.open(path);
+			std::stringstream stream;
+			stream << file.rdbuf();
+			return stream.str();
+		}
+		catch (const std::ifstream::failure&)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+			return std::string();
+		}
+	}
+
+	static unsigned int compile(const ShaderStage &stage)
+	{
+		const char *code = stage.source.c_str();
+		const unsigned int shader = glCreateShader(stage.type);
+		glShaderSource(shader, 1, &code, nullptr);
+		glCompileShader(shader);
+		return shader;
 	}
 
-	void setVec4(const std::string& name, float x, float y, float z, float w)
+	// Put the defines after the #version line, which must come first, and number the lines that follow
+	// as in the file so compile errors still point at the right line.
+	static std::string inject(const std::string &source, const ShaderDefines &defines)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		if (defines.empty())
+		{
+			return source;
+		}
+		std::string block;
+		for (const std::string &define : defines)
+		{
+			block += "#define " + define + "\n";
+		}
+		size_t start = 0;
+		int line = 1;
+		if (source.compare(0, 8, "#version") == 0)
+		{
+			const size_t end = source.find('\n');
+			start = end == std::string::npos ? source.size() : end + 1;
+			line = 2;
+		}
+		block += "#line " + std::to_string(line) + "\n";
+		std::string injected = source.substr(0, start);
+		if (start > 0 && injected.back() != '\n')
+		{
+			injected += '\n';
+		}
+		return injected + block + source.substr(start);
+	}
+
+	// Take the program from the ProgramCache, or compile every stage and link once. Nothing waits for the
+	// driver here: with parallel compilation the link runs in the background until wait() or the cache's
+	// update() finishes it, without it wait() is called right away. The defines are part of the source the cache keys on, so each variant
+	// is cached on its own.
+	void build(const std::vector<std::pair<GLenum, const char*>> &paths, const ShaderDefines &defines)
+	{
+		std::vector<ShaderStage> stages;
+		for (const std::pair<GLenum, const char*> &path : paths)
+		{
+			stages.push_back({ path.first, path.second, inject(readFile(path.second), defines) });
+		}
+		ProgramCache &cache = ProgramCache::shared();
+		const uint64_t key = cache.key(stages);
+		ID = cache.find(key);
+		if (ID == 0)
+		{
+			ID = glCreateProgram();
+			cache.insert(key, ID);
+			if (!cache.load(key, ID))
+			{
+				std::vector<unsigned int> shaders;
+				for (ShaderStage &stage : stages)
+				{
+					shaders.push_back(compile(stage));
+					glAttachShader(ID, shaders.back());
+					stage.source.clear();
+				}
+				cache.prepare(ID);
+				glLinkProgram(ID);
+				cache.linking(key, ID, std::move(shaders), std::move(stages));
+			}
+		}
+		// a program shared with another Shader may still be linking too
+		linking = true;
+		if (!parallelLink())
+		{
+			wait();
+		}
+	}
+
+	// run setup with the program current, which glUniform needs, leaving whatever was bound before as it was
+	void run(const std::vector<std::function<void()>> &setups) const
+	{
+		GLint previous = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+		glUseProgram(ID);
+		for (const std::function<void()> &setup : setups)
+		{
+			setup();
+		}
+		glUseProgram(static_cast<GLuint>(previous));
+	}
+
+	// build the uniform table of the linked program
+	void reflect() const
+	{
+		uniforms.clear();
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<char> buffer(static_cast<size_t>(maxLength) + 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, static_cast<GLuint>(i), static_cast<GLsizei>(buffer.size()), &length, &size, &type, buffer.data());
+			const std::string name(buffer.data(), static_cast<size_t>(length));
+			const GLint location = glGetUniformLocation(ID, name.c_str());
+			if (location < 0)
+			{
+				// members of uniform blocks have no location
+				continue;
+			}
+			// arrays are listed once as name[0]; the bare name and every element can be set too
+			if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			{
+				const std::string base = name.substr(0, name.size() - 3);
+				add(base, { location, type });
+				for (GLint element = 0; element < size; element++)
+				{
+					const std::string elementName = base + "[" + std::to_string(element) + "]";
+					add(elementName, { glGetUniformLocation(ID, elementName.c_str()), type });
+				}
+			}
+			else
+			{
+				add(name, { location, type });
+			}
+		}
+	}
+
+	void add(const std::string &name, const Uniform &uniform) const
+	{
+		auto inserted = uniforms.emplace(hashString(name), uniform);
+		if (!inserted.second && inserted.first->second.location != uniform.location)
+		{
+			std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION: " << name << std::endl;
+		}
+	}
+
+	static bool isSampler(GLenum type)
+	{
+		// the sampler enums come in three runs, the middle one interleaved with the unsigned vectors
+		return (type >= GL_SAMPLER_1D && type <= GL_SAMPLER_2D_RECT_SHADOW) ||
+			(type >= GL_SAMPLER_1D_ARRAY && type <= GL_UNSIGNED_INT_SAMPLER_BUFFER &&
+				type != GL_UNSIGNED_INT_VEC2 && type != GL_UNSIGNED_INT_VEC3 && type != GL_UNSIGNED_INT_VEC4) ||
+			(type >= GL_SAMPLER_2D_MULTISAMPLE && type <= GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY);
+	}
+
+	// whether a GLSL type can be set through a handle of type T
+	template <typename T>
+	static bool accepts(GLenum type)
+	{
+		if constexpr (std::is_same<T, bool>::value)
+			return type == GL_BOOL || type == GL_INT;
+		else if constexpr (std::is_same<T, int>::value)
+			return type == GL_INT || type == GL_BOOL || isSampler(type);
+		else if constexpr (std::is_same<T, float>::value)
+			return type == GL_FLOAT;
+		else if constexpr (std::is_same<T, glm::vec2>::value)
+			return type == GL_FLOAT_VEC2;
+		else if constexpr (std::is_same<T, glm::vec3>::value)
+			return type == GL_FLOAT_VEC3;
+		else if constexpr (std::is_same<T, glm::vec4>::value)
+			return type == GL_FLOAT_VEC4;
+		else
+		{
+			static_assert(std::is_same<T, glm::mat4>::value, "no setter for this uniform type");
+			return type == GL_FLOAT_MAT4;
+		}
 	}
 };
 
@@ -0,0 +1,149 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "frame_uniforms.hpp"
+#include "shader.hpp"
+
+// Optional parts of the lit shader (cube.vert and cube.frag), each compiled in by its define
+enum ShaderFeature : uint32_t
+{
+	FEATURE_PHONG = 1 << 0,			// PHONG: specular from the reflected light, Blinn-Phong's half vector without it
+	FEATURE_NORMAL_MAP = 1 << 1,	// NORMAL_MAP: perturb the normal by material.normal
+	FEATURE_INSTANCING = 1 << 2,	// INSTANCING: the model matrix comes from the attribute at location 3
+	FEATURE_PACKED = 1 << 3			// PACKED: textures are layers of MaterialAtlas array textures
+};
+
+// What a draw needs from the lit shader. Features it does not ask for are left out of the program
+// instead of being branched over, and only as many point lights are lit as it asks for.
+struct ShaderFeatures
+{
+	uint32_t flags = 0;
+	int pointLights = LightData::POINT_LIGHTS;
+
+	ShaderFeatures with(ShaderFeature feature) const
+	{
+		ShaderFeatures features = *this;
+		features.flags |= feature;
+		return features;
+	}
+
+	ShaderFeatures without(ShaderFeature feature) const
+	{
+		ShaderFeatures features = *this;
+		features.flags &= ~static_cast<uint32_t>(feature);
+		return features;
+	}
+
+	ShaderFeatures lights(int count) const
+	{
+		ShaderFeatures features = *this;
+		features.pointLights = count;
+		return features;
+	}
+
+	bool has(ShaderFeature feature) const
+	{
+		return (flags & feature) != 0;
+	}
+
+	// the features and the light count in one value; the LightData block holds at most POINT_LIGHTS
+	uint32_t key() const
+	{
+		const int count = pointLights < 0 ? 0 : pointLights > LightData::POINT_LIGHTS ? LightData::POINT_LIGHTS : pointLights;
+		return flags | static_cast<uint32_t>(count) << 16;
+	}
+
+	// only what differs from the shader's defaults, so the default variant is the same program as one
+	// built from the files without defines
+	ShaderDefines defines() const
+	{
+		const int count = static_cast<int>(key() >> 16);
+		ShaderDefines defines;
+		if (count != LightData::POINT_LIGHTS)
+			defines.push_back("NR_POINT_LIGHTS " + std::to_string(count));
+		if (has(FEATURE_PHONG))
+			defines.push_back("PHONG");
+		if (has(FEATURE_NORMAL_MAP))
+			defines.push_back("NORMAL_MAP");
+		if (has(FEATURE_INSTANCING))
+			defines.push_back("INSTANCING");
+		if (has(FEATURE_PACKED))
+			defines.push_back("PACKED");
+		return defines;
+	}
+};
+
+// Every variant of one vertex and fragment shader pair, compiled the first time a draw asks for it and
+// kept for the rest of the run. The ProgramCache behind Shader keeps each variant's binary as well, so
+// later starts load the variants a scene uses instead of compiling them.
+class ShaderPermutations
+{
+public:
+	/*
+	* Constructor for the variants. Nothing is compiled before the first get().
+	* @param[in] vertexPath File path to vertex shader.
+	* @param[in] fragmentPath File path to fragment shader.
+	* @return ShaderPermutations
+	*/
+	ShaderPermutations(const char *vertexPath, const char *fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath)
+	{
+	}
+
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+	/*
+	* Variant for some features, compiled now if no draw asked for it before.
+	* @param[in] features
+	* @return Shader
+	*/
+	Shader &get(const ShaderFeatures &features)
+	{
+		std::unique_ptr<Shader> &variant = variants[features.key()];
+		if (!variant)
+		{
+			variant.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), features.defines()));
+			for (const std::function<void(Shader&)> &setup : setups)
+			{
+				setup(*variant);
+			}
+		}
+		return *variant;
+	}
+
+	/*
+	* Add state every variant needs once, such as uniform block bindings and sampler units. Runs for
+	* the variants already compiled and for each one compiled later.
+	* @param[in] setup
+	* @return void
+	*/
+	void onCreate(std::function<void(Shader&)> setup)
+	{
+		for (std::pair<const uint32_t, std::unique_ptr<Shader>> &variant : variants)
+		{
+			setup(*variant.second);
+		}
+		setups.push_back(std::move(setup));
+	}
+
+	size_t size() const
+	{
+		return variants.size();
+	}
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants;
+	std::vector<std::function<void(Shader&)>> setups;
+};
+
+#endif
@@ -0,0 +1,356 @@
+#ifndef TEXEL_CACHE_H
+#define TEXEL_CACHE_H
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ktx2.hpp"
+#include "mapped_file.hpp"
+#include "mipmap.hpp"
+
+// Decoded texels with their whole mip chain, mapped from a TexelCache file. The level pointers stay valid
+// across moves, until the texels are destroyed.
+struct MappedTexels
+{
+	MappedFile file;
+	std::vector<Ktx2::Level> levels;	// level 0 is the full size image, rows tightly packed
+};
+
+// On-disk cache of decoded images, so a warm start maps texels instead of running the image decoder.
+// Each file holds one image as glTexImage2D takes it, 8 bits per channel with the channels of the source,
+// followed by every mip level down to 1x1. The header takes the first page and every level starts on a
+// page boundary, so uploads copy straight out of the page cache.
+//
+// Files are named by the content hash of the source and the texel format. A hit bumps the file's
+// modification time, and once the directory grows past its limit the files used longest ago are deleted.
+class TexelCache
+{
+public:
+	static const uint32_t VERSION = 2;		// 2: chains filtered with Mipmap::runtimeSettings
+	static const size_t PAGE_SIZE = 4096;
+	static const int MAX_LEVELS = 16;
+
+	struct Stats
+	{
+		size_t hits;		// images mapped from a cache file
+		size_t misses;		// images that had to be decoded
+		size_t writes;
+		size_t evictions;
+		size_t files;
+		size_t bytes;		// size of the cache directory
+		size_t limitBytes;
+	};
+
+	static TexelCache &shared()
+	{
+		static TexelCache instance;
+		return instance;
+	}
+
+	TexelCache(const TexelCache&) = delete;
+	TexelCache& operator=(const TexelCache&) = delete;
+
+	/*
+	* Start using a cache directory. Until this is called the cache is off and images are always decoded.
+	* @param[in] directory Created if it does not exist.
+	* @param[in] limitBytes Size the directory is trimmed to.
+	* @return false if the directory cannot be created.
+	*/
+	bool enable(const std::string &directory, size_t limitBytes = static_cast<size_t>(1) << 30)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if (!std::filesystem::is_directory(directory, error))
+		{
+			std::cout << "ERROR::TEXEL_CACHE::DIRECTORY_NOT_CREATED: " << directory << std::endl;
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		root = directory;
+		limit = limitBytes;
+		scan();
+		trim();
+		active = true;
+		return true;
+	}
+
+	bool enabled() const
+	{
+		return active;
+	}
+
+	/*
+	* Map the cached texels of an image. Safe to call from any thread.
+	* @param[in] contentKey Hash of the source file.
+	* @param[out] texels
+	* @param[out] width
+	* @param[out] height
+	* @param[out] components
+	* @return false if there is no valid cache file, which counts as a miss.
+	*/
+	bool open(uint64_t contentKey, MappedTexels &texels, int &width, int &height, int &components)
+	{
+		const std::string path = pathFor(contentKey);
+		std::error_code error;
+		if (!std::filesystem::exists(path, error) || !map(path, contentKey, texels, width, height, components))
+		{
+			texels = MappedTexels();
+			std::lock_guard<std::mutex> lock(mutex);
+			counters.misses++;
+			return false;
+		}
+		// the modification time doubles as the last use for eviction
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.hits++;
+		return true;
+	}
+
+	/*
+	* Build the mip chain of a decoded image, write it to the cache and map the result. Safe to call from
+	* any thread, including pool jobs.
+	* @param[in] contentKey Hash of the source file.
+	* @param[in] pixels Base level.
+	* @param[in] width
+	* @param[in] height
+	* @param[in] components
+	* @param[out] texels
+	* @return false if the file could not be written; the pixels are still good to use.
+	*/
+	bool store(uint64_t contentKey, const unsigned char *pixels, int width, int height, int components, MappedTexels &texels)
+	{
+		std::vector<MipLevel> chain = Mipmap::buildChain(pixels, width, height, components);
+		if (chain.size() + 1 > static_cast<size_t>(MAX_LEVELS))
+		{
+			return false;
+		}
+
+		Header header = {};
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.contentKey = contentKey;
+		header.width = static_cast<uint32_t>(width);
+		header.height = static_cast<uint32_t>(height);
+		header.components = static_cast<uint32_t>(components);
+		header.levelCount = static_cast<uint32_t>(chain.size() + 1);
+		uint64_t offset = PAGE_SIZE;
+		for (uint32_t level = 0; level < header.levelCount; level++)
+		{
+			const int levelWidth = level == 0 ? width : chain[level - 1].width;
+			const int levelHeight = level == 0 ? height : chain[level - 1].height;
+			LevelRecord &record = header.levels[level];
+			record.offset = offset;
+			record.size = static_cast<uint64_t>(levelWidth) * levelHeight * components;
+			record.width = static_cast<uint32_t>(levelWidth);
+			record.height = static_cast<uint32_t>(levelHeight);
+			offset = alignUp(offset + record.size);
+		}
+
+		// written under a name of its own and renamed, so readers never map a partial file
+		const std::string path = pathFor(contentKey);
+		const std::string temporary = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		{
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			const std::vector<char> padding(PAGE_SIZE, 0);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(padding.data(), PAGE_SIZE - sizeof(header));
+			for (uint32_t level = 0; level < header.levelCount && out; level++)
+			{
+				const LevelRecord &record = header.levels[level];
+				const unsigned char *data = level == 0 ? pixels : chain[level - 1].pixels.data();
+				out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(record.size));
+				out.write(padding.data(), static_cast<std::streamsize>(alignUp(record.size) - record.size));
+			}
+			if (!out)
+			{
+				out.close();
+				std::error_code error;
+				std::filesystem::remove(temporary, error);
+				std::cout << "ERROR::TEXEL_CACHE::WRITE_FAILED: " << path << std::endl;
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		if (error)
+		{
+			// another thread stored the same image first, or the old file is still mapped
+			std::filesystem::remove(temporary, error);
+		}
+		int mappedWidth, mappedHeight, mappedComponents;
+		if (!map(path, contentKey, texels, mappedWidth, mappedHeight, mappedComponents))
+		{
+			texels = MappedTexels();
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.writes++;
+		counters.files++;
+		counters.bytes += static_cast<size_t>(offset);
+		trim();
+		return true;
+	}
+
+	Stats stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Stats result = counters;
+		result.limitBytes = limit;
+		return result;
+	}
+
+private:
+	static constexpr char MAGIC[4] = { 'L', 'O', 'T', 'C' };
+	// the layout every file holds: the source's channels, one byte each
+	static constexpr const char *FORMAT = "unorm8";
+
+	struct LevelRecord
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t contentKey;
+		uint32_t width;
+		uint32_t height;
+		uint32_t components;
+		uint32_t levelCount;
+		LevelRecord levels[MAX_LEVELS];
+	};
+	static_assert(sizeof(Header) <= PAGE_SIZE, "the header must fit the first page");
+
+	std::string root;
+	size_t limit = 0;
+	bool active = false;
+	Stats counters = {};
+	mutable std::mutex mutex;
+
+	TexelCache() = default;
+
+	static uint64_t alignUp(uint64_t value)
+	{
+		return (value + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+	}
+
+	std::string pathFor(uint64_t contentKey) const
+	{
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(contentKey));
+		return root + "/" + name + "-" + FORMAT + ".texels";
+	}
+
+	// map and validate a cache file
+	bool map(const std::string &path, uint64_t contentKey, MappedTexels &texels, int &width, int &height, int &components) const
+	{
+		texels.levels.clear();
+		if (!texels.file.open(path) || texels.file.size() < PAGE_SIZE)
+		{
+			return false;
+		}
+		Header header;
+		std::memcpy(&header, texels.file.data(), sizeof(header));
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.contentKey != contentKey ||
+			header.components < 1 || header.components > 4 || header.levelCount < 1 || header.levelCount > static_cast<uint32_t>(MAX_LEVELS) ||
+			header.levelCount != static_cast<uint32_t>(Mipmap::levelCount(header.width, header.height)))
+		{
+			return false;
+		}
+		for (uint32_t level = 0; level < header.levelCount; level++)
+		{
+			const LevelRecord &record = header.levels[level];
+			if (record.offset % PAGE_SIZE != 0 || record.offset + record.size > texels.file.size() ||
+				record.size != static_cast<uint64_t>(record.width) * record.height * header.components)
+			{
+				texels.levels.clear();
+				return false;
+			}
+			texels.levels.push_back({ texels.file.data() + record.offset, static_cast<size_t>(record.size),
+				static_cast<int>(record.width), static_cast<int>(record.height) });
+		}
+		width = static_cast<int>(header.width);
+		height = static_cast<int>(header.height);
+		components = static_cast<int>(header.components);
+		return true;
+	}
+
+	// count the files in the directory; expects the mutex to be held
+	void scan()
+	{
+		counters.files = 0;
+		counters.bytes = 0;
+		std::error_code error;
+		for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(root, error))
+		{
+			if (entry.path().extension() == ".texels")
+			{
+				counters.files++;
+				counters.bytes += static_cast<size_t>(entry.file_size(error));
+			}
+		}
+	}
+
+	// delete the least recently used files until the directory fits the limit; expects the mutex to be held
+	void trim()
+	{
+		if (counters.bytes <= limit)
+		{
+			return;
+		}
+		struct File
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type used;
+			size_t size;
+		};
+		std::vector<File> files;
+		std::error_code error;
+		for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(root, error))
+		{
+			if (entry.path().extension() == ".texels")
+			{
+				files.push_back({ entry.path(), entry.last_write_time(error), static_cast<size_t>(entry.file_size(error)) });
+			}
+		}
+		std::sort(files.begin(), files.end(), [](const File &a, const File &b)
+		{
+			return a.used < b.used;
+		});
+		counters.files = files.size();
+		counters.bytes = 0;
+		for (const File &file : files)
+		{
+			counters.bytes += file.size;
+		}
+		// the newest file stays even if it alone is over the limit; it was just written for a texture in use
+		for (size_t i = 0; i + 1 < files.size() && counters.bytes > limit; i++)
+		{
+			// a file that is still mapped cannot be deleted on Windows; it goes on a later trim
+			if (std::filesystem::remove(files[i].path, error))
+			{
+				counters.bytes -= files[i].size;
+				counters.files--;
+				counters.evictions++;
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,587 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "gpu_memory.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "mipmap.hpp"
+#include "stb_image.h"
+#include "texel_cache.hpp"
+#include "texture_cook.hpp"
+#include "thread_pool.hpp"
+
+class TextureCache;
+
+// Reference to a texture owned by the TextureCache. Copies share the texture; once the last handle is
+// gone the texture is deleted by the next TextureCache::collectGarbage.
+class TextureHandle
+{
+public:
+	TextureHandle() = default;
+	TextureHandle(const TextureHandle &other) : entry(other.entry)
+	{
+		retain();
+	}
+	TextureHandle(TextureHandle &&other) noexcept : entry(other.entry)
+	{
+		other.entry = nullptr;
+	}
+	TextureHandle& operator=(const TextureHandle &other)
+	{
+		if (entry != other.entry)
+		{
+			release();
+			entry = other.entry;
+			retain();
+		}
+		return *this;
+	}
+	TextureHandle& operator=(TextureHandle &&other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			entry = other.entry;
+			other.entry = nullptr;
+		}
+		return *this;
+	}
+	~TextureHandle()
+	{
+		release();
+	}
+
+	// GL name of the texture, 0 for an empty handle or an image that failed to load
+	unsigned int id() const;
+
+private:
+	friend class TextureCache;
+	struct Entry;
+	Entry *entry = nullptr;
+
+	explicit TextureHandle(Entry *entry) : entry(entry)
+	{
+		retain();
+	}
+	void retain();
+	void release();
+};
+
+struct TextureHandle::Entry
+{
+	unsigned int id = 0;
+	uint64_t contentKey = 0;
+	uint64_t fileSize = 0;
+	size_t bytes = 0;
+	size_t references = 0;
+};
+
+inline unsigned int TextureHandle::id() const
+{
+	return entry ? entry->id : 0;
+}
+inline void TextureHandle::retain()
+{
+	if (entry)
+		entry->references++;
+}
+inline void TextureHandle::release()
+{
+	if (entry)
+	{
+		entry->references--;
+		entry = nullptr;
+	}
+}
+
+// Pixels decoded by stb_image, or the mapped cooked file or cached texels that replace them, together with
+// the key of the file they came from.
+struct DecodedImage
+{
+	std::unique_ptr<unsigned char, void(*)(void*)> pixels{ nullptr, stbi_image_free };
+	Ktx2::Image compressed;
+	MappedTexels texels;	// the pixels and their mip chain, from the TexelCache
+	int width = 0;
+	int height = 0;
+	int components = 0;
+	uint64_t contentKey = 0;
+	uint64_t fileSize = 0;
+
+	// uncompressed base level, decoded or mapped; null if there is none
+	const unsigned char *basePixels() const
+	{
+		return pixels ? pixels.get() : texels.levels.empty() ? nullptr : texels.levels[0].data;
+	}
+};
+
+// Process-wide cache of 2D textures. A file is looked up by its canonical path first; a path that was
+// never seen is hashed and looked up by content, so the same image under two names is only decoded and
+// uploaded once. prefetch() may be called from any thread and decodes on the worker pool; acquire()
+// and the handles belong to the GL thread, which only uploads what the workers decoded.
+class TextureCache
+{
+public:
+	struct Stats
+	{
+		size_t pathHits;	// found by path, nothing read
+		size_t contentHits;	// new path, but the bytes matched a loaded texture
+		size_t misses;		// decoded and uploaded
+		size_t compressed;	// misses uploaded from a cooked block-compressed file
+		size_t failures;
+		size_t textures;	// resident textures
+		size_t bytes;		// estimated video memory of the resident textures, mipmaps included
+	};
+
+	static TextureCache& shared()
+	{
+		static TextureCache cache;
+		return cache;
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	/*
+	* Start decoding a texture on the worker pool so a later acquire() only has to upload it.
+	* @param[in] path Image file.
+	* @param[in] flipVertically
+	* @return void
+	*/
+	void prefetch(const std::string &path, bool flipVertically = true)
+	{
+		const std::string canonical = canonicalPath(path);
+		const PathRecord stamp = stampOf(canonical);
+		const uint64_t pathKey = hashString(canonical, salt(flipVertically));
+		std::lock_guard<std::mutex> lock(mutex);
+		if (findByPath(pathKey, stamp) || pending.count(pathKey))
+		{
+			return;
+		}
+		pending[pathKey] = ThreadPool::shared().submit([this, canonical, flipVertically]
+		{
+			return decodeFile(canonical, flipVertically, this);
+		});
+	}
+
+	/*
+	* Get a texture, loading it on a miss. A prefetched texture is taken from the pool instead of being
+	* decoded here.
+	* @param[in] path Image file.
+	* @param[in] flipVertically Flip rows on load, part of the cache key.
+	* @return handle, with id 0 if the image could not be loaded.
+	*/
+	TextureHandle acquire(const std::string &path, bool flipVertically = true)
+	{
+		const std::string canonical = canonicalPath(path);
+		const PathRecord stamp = stampOf(canonical);
+		const uint64_t pathKey = hashString(canonical, salt(flipVertically));
+
+		std::future<DecodedImage> decoding;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (TextureHandle::Entry *entry = findByPath(pathKey, stamp))
+			{
+				counters.pathHits++;
+				return TextureHandle(entry);
+			}
+			auto queued = pending.find(pathKey);
+			if (queued != pending.end())
+			{
+				decoding = std::move(queued->second);
+				pending.erase(queued);
+			}
+		}
+
+		DecodedImage image = decoding.valid() ? decoding.get() : decodeFile(canonical, flipVertically, this);
+		if (image.fileSize == 0)
+		{
+			return fail(path);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			paths[pathKey] = { image.contentKey, stamp.fileSize, stamp.modified };
+			auto cached = entries.find(image.contentKey);
+			if (cached != entries.end() && cached->second->fileSize == image.fileSize)
+			{
+				counters.contentHits++;
+				return TextureHandle(cached->second.get());
+			}
+		}
+		if (!image.compressed.levels.empty() && !supports(BlockCompression::glFormat(image.compressed.vkFormat)))
+		{
+			image.compressed = Ktx2::Image();
+		}
+		if (!image.basePixels() && image.compressed.levels.empty())
+		{
+			// the decode was skipped for a texture that has since been collected, or the driver cannot
+			// sample the cooked format and the source has to be decoded after all
+			image = decodeFile(canonical, flipVertically, nullptr);
+			if (!image.compressed.levels.empty() && !supports(BlockCompression::glFormat(image.compressed.vkFormat)))
+			{
+				image = decodeFile(canonical, flipVertically, nullptr, false);
+			}
+			if (!image.basePixels() && image.compressed.levels.empty())
+			{
+				return fail(path);
+			}
+		}
+
+		std::unique_ptr<TextureHandle::Entry> entry(new TextureHandle::Entry());
+		entry->contentKey = image.contentKey;
+		entry->fileSize = image.fileSize;
+		const bool compressed = !image.compressed.levels.empty();
+		if (compressed)
+		{
+			for (const Ktx2::Level &level : image.compressed.levels)
+				entry->bytes += level.size;
+		}
+		else
+		{
+			// the mip chain adds a third on top of the base level
+			entry->bytes = static_cast<size_t>(image.width) * image.height * image.components * 4 / 3;
+		}
+		if (uploader)
+		{
+			entry->id = uploader(std::move(image));
+		}
+		if (entry->id == 0 && compressed)
+		{
+			uploadCompressed(image.compressed, *entry);
+		}
+		else if (entry->id == 0)
+		{
+			upload(image, *entry);
+		}
+		TextureHandle handle(entry.get());
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.misses++;
+		counters.compressed += compressed;
+		entries[entry->contentKey] = std::move(entry);
+		return handle;
+	}
+
+	/*
+	* Read and decode an image file, or map its cooked file instead when there is an up to date one. With
+	* the TexelCache enabled, decoded images are mapped from it, or stored in it after the decode, and come
+	* back as texels rather than pixels. Safe to call from any thread.
+	* @param[in] path
+	* @param[in] flipVertically
+	* @param[in] skipLoaded Cache whose loaded textures need no decode, may be null.
+	* @param[in] useCooked Whether a cooked file may replace the decode.
+	* @return DecodedImage; fileSize is 0 if the file could not be read and none of pixels, texels and compressed are set if it was not decoded.
+	*/
+	static DecodedImage decodeFile(const std::string &path, bool flipVertically, const TextureCache *skipLoaded = nullptr, bool useCooked = true)
+	{
+		DecodedImage image;
+		MappedFile file;
+		if (!file.open(path))
+		{
+			return image;
+		}
+		image.fileSize = file.size();
+		image.contentKey = hashBytes(file.data(), file.size(), salt(flipVertically));
+		if (skipLoaded && skipLoaded->hasContent(image.contentKey))
+		{
+			return image;
+		}
+		if (useCooked && TextureCook::openCooked(path, flipVertically, image.compressed))
+		{
+			image.width = image.compressed.width;
+			image.height = image.compressed.height;
+			return image;
+		}
+		// the content key covers the flip, so the cached texels have the orientation asked for
+		TexelCache &texelCache = TexelCache::shared();
+		if (texelCache.enabled() && texelCache.open(image.contentKey, image.texels, image.width, image.height, image.components))
+		{
+			return image;
+		}
+		// the flip is per thread so workers decoding different textures do not race on it
+		stbi_set_flip_vertically_on_load_thread(flipVertically);
+		image.pixels.reset(stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &image.width, &image.height, &image.components, 0));
+		if (image.pixels && texelCache.enabled() &&
+			texelCache.store(image.contentKey, image.pixels.get(), image.width, image.height, image.components, image.texels))
+		{
+			image.pixels.reset();
+		}
+		return image;
+	}
+
+	/*
+	* Set the swizzle of the bound 2D texture from a KTXswizzle value such as "rrr1".
+	* @param[in] swizzle Anything but four characters leaves the swizzle alone.
+	* @return void
+	*/
+	static void applySwizzle(const std::string &swizzle)
+	{
+		if (swizzle.size() != 4)
+		{
+			return;
+		}
+		const GLenum channels[4] = { GL_TEXTURE_SWIZZLE_R, GL_TEXTURE_SWIZZLE_G, GL_TEXTURE_SWIZZLE_B, GL_TEXTURE_SWIZZLE_A };
+		for (int i = 0; i < 4; i++)
+		{
+			GLint source = GL_ZERO;
+			switch (swizzle[i])
+			{
+			case 'r': source = GL_RED; break;
+			case 'g': source = GL_GREEN; break;
+			case 'b': source = GL_BLUE; break;
+			case 'a': source = GL_ALPHA; break;
+			case '1': source = GL_ONE; break;
+			}
+			glTexParameteri(GL_TEXTURE_2D, channels[i], source);
+		}
+	}
+
+	/*
+	* Get a texture and keep it alive for as long as the cache, for callers that only hold GL names.
+	* @param[in] path
+	* @param[in] flipVertically
+	* @return GL name of the texture.
+	*/
+	unsigned int acquirePinned(const std::string &path, bool flipVertically = true)
+	{
+		pinned.push_back(acquire(path, flipVertically));
+		return pinned.back().id();
+	}
+
+	/*
+	* Hand uploads to another path, such as a TextureStreamer, instead of uploading them at once.
+	* @param[in] uploader Takes the decoded image and returns the GL name, or leaves the image alone and
+	* returns 0 to have the cache upload it; empty restores the default.
+	* @return void
+	*/
+	void setUploader(std::function<unsigned int(DecodedImage&&)> uploader)
+	{
+		this->uploader = std::move(uploader);
+	}
+
+	/*
+	* Get told about every texture just before collectGarbage deletes it, so GL names can be forgotten
+	* before they are reused.
+	* @param[in] listener Takes the GL name.
+	* @return void
+	*/
+	void addDeleteListener(std::function<void(unsigned int)> listener)
+	{
+		deleteListeners.push_back(std::move(listener));
+	}
+
+	// Delete the textures nobody holds a handle to anymore.
+	void collectGarbage()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto it = entries.begin(); it != entries.end(); )
+		{
+			if (it->second->references == 0)
+			{
+				for (const std::function<void(unsigned int)> &listener : deleteListeners)
+					listener(it->second->id);
+				GpuMemory::shared().releaseTexture(it->second->id);
+				glDeleteTextures(1, &it->second->id);
+				it = entries.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	Stats stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Stats result = counters;
+		result.textures = entries.size();
+		result.bytes = 0;
+		for (const auto &entry : entries)
+		{
+			result.bytes += entry.second->bytes;
+		}
+		return result;
+	}
+
+private:
+	struct PathRecord
+	{
+		uint64_t contentKey;
+		uint64_t fileSize;
+		uint64_t modified;
+	};
+
+	// keyed by the hash of the canonical path and by the hash of the file contents, both salted with the flip flag
+	std::unordered_map<uint64_t, PathRecord> paths;
+	std::unordered_map<uint64_t, std::unique_ptr<TextureHandle::Entry>> entries;
+	// declared after entries so the pinned handles are released first
+	std::vector<TextureHandle> pinned;
+	std::unordered_map<uint64_t, std::future<DecodedImage>> pending;
+	Stats counters = {};
+	mutable std::mutex mutex;
+	std::function<unsigned int(DecodedImage&&)> uploader;
+	std::vector<std::function<void(unsigned int)>> deleteListeners;
+	std::vector<GLint> compressedFormats;
+	bool formatsQueried = false;
+
+	TextureCache() = default;
+
+	// whether the driver takes a compressed format; GL thread only
+	bool supports(GLenum format)
+	{
+		if (!formatsQueried)
+		{
+			GLint count = 0;
+			glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+			compressedFormats.resize(count);
+			if (count > 0)
+			{
+				glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, compressedFormats.data());
+			}
+			formatsQueried = true;
+		}
+		// RGTC is core since 3.0, but drivers do not have to list it
+		return format == GL_COMPRESSED_RED_RGTC1 || format == GL_COMPRESSED_RG_RGTC2 ||
+			std::find(compressedFormats.begin(), compressedFormats.end(), static_cast<GLint>(format)) != compressedFormats.end();
+	}
+
+	static std::string canonicalPath(const std::string &path)
+	{
+		std::error_code error;
+		std::string canonical = std::filesystem::weakly_canonical(path, error).generic_string();
+		if (error)
+		{
+			canonical = std::filesystem::path(path).lexically_normal().generic_string();
+		}
+#ifdef _WIN32
+		// Windows paths are case insensitive
+		std::transform(canonical.begin(), canonical.end(), canonical.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+		return canonical;
+	}
+
+	static uint64_t salt(bool flipVertically)
+	{
+		return flipVertically ? FNV_OFFSET_BASIS : ~FNV_OFFSET_BASIS;
+	}
+
+	static PathRecord stampOf(const std::string &canonical)
+	{
+		PathRecord stamp = {};
+		std::error_code error;
+		stamp.fileSize = std::filesystem::file_size(canonical, error);
+		if (error)
+		{
+			return PathRecord();
+		}
+		stamp.modified = static_cast<uint64_t>(std::filesystem::last_write_time(canonical, error).time_since_epoch().count());
+		return stamp;
+	}
+
+	// expects the mutex to be held
+	TextureHandle::Entry *findByPath(uint64_t pathKey, const PathRecord &stamp) const
+	{
+		auto known = paths.find(pathKey);
+		if (known == paths.end() || known->second.modified != stamp.modified || known->second.fileSize != stamp.fileSize)
+		{
+			return nullptr;
+		}
+		auto cached = entries.find(known->second.contentKey);
+		return cached != entries.end() ? cached->second.get() : nullptr;
+	}
+
+	bool hasContent(uint64_t contentKey) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.count(contentKey) != 0;
+	}
+
+	TextureHandle fail(const std::string &path)
+	{
+		std::cout << "Texture failed to load at path: " << path << std::endl;
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.failures++;
+		return TextureHandle();
+	}
+
+	// upload every level of a cooked file as it is
+	static void uploadCompressed(const Ktx2::Image &image, TextureHandle::Entry &entry)
+	{
+		const GLenum format = BlockCompression::glFormat(image.vkFormat);
+		glGenTextures(1, &entry.id);
+		glBindTexture(GL_TEXTURE_2D, entry.id);
+		for (size_t level = 0; level < image.levels.size(); level++)
+		{
+			const Ktx2::Level &data = image.levels[level];
+			glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), format, data.width, data.height, 0, static_cast<GLsizei>(data.size), data.data);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(image.levels.size()) - 1);
+		applySwizzle(image.value("KTXswizzle"));
+		GpuMemory::shared().trackTexture(entry.id, format, image.levels[0].width, image.levels[0].height, 1,
+			static_cast<int>(image.levels.size()), "TextureCache");
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	// upload decoded pixels with mipmaps, or cached texels with the mipmaps they come with
+	static void upload(const DecodedImage &image, TextureHandle::Entry &entry)
+	{
+		GLenum format = GL_RGBA;
+		if (image.components == 1)
+			format = GL_RED;
+		else if (image.components == 2)
+			format = GL_RG;
+		else if (image.components == 3)
+			format = GL_RGB;
+
+		glGenTextures(1, &entry.id);
+		glBindTexture(GL_TEXTURE_2D, entry.id);
+		if (!image.texels.levels.empty())
+		{
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			for (size_t level = 0; level < image.texels.levels.size(); level++)
+			{
+				const Ktx2::Level &data = image.texels.levels[level];
+				glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), format, data.width, data.height, 0, format, GL_UNSIGNED_BYTE, data.data);
+			}
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(image.texels.levels.size()) - 1);
+		}
+		else
+		{
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.get());
+			const std::vector<MipLevel> chain = Mipmap::buildChain(image.pixels.get(), image.width, image.height, image.components);
+			for (size_t level = 0; level < chain.size(); level++)
+			{
+				glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level + 1), format, chain[level].width, chain[level].height, 0, format, GL_UNSIGNED_BYTE, chain[level].pixels.data());
+			}
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		}
+		GpuMemory::shared().trackTexture(entry.id, format, image.width, image.height, 1, Mipmap::levelCount(image.width, image.height), "TextureCache");
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+};
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef TEXTURE_COOK_H
+#define TEXTURE_COOK_H
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "block_compression.hpp"
+#include "ktx2.hpp"
+#include "mipmap.hpp"
+#include "stb_image.h"
+
+struct CookOptions
+{
+	bool srgb = false;				// color data; BC4 and BC5 outputs stay linear
+	bool highQuality = false;		// BC7 instead of BC1/BC3
+	bool flipVertically = true;		// match TextureCache::acquire's default
+	MipFilter filter = MIP_KAISER;
+	bool gammaCorrectMips = false;	// filter the color in linear light without tagging the output sRGB; implied by srgb
+	float alphaCutoff = 0.0f;		// keep the alpha test coverage of cut-out textures in every level
+};
+
+// Offline conversion of images into block-compressed KTX2 files with full mip chains, written next to
+// the source as <source>.ktx2. Runs on the CPU only, so it works on machines without a GPU. The
+// TextureCache picks a cooked file up in place of its source as long as the source has not changed
+// since, which the file records in a key/value entry.
+namespace TextureCook
+{
+	const char SOURCE_KEY[] = "LearnOpenGL.source";
+
+	inline std::string cookedPathFor(const std::string &sourcePath)
+	{
+		return sourcePath + ".ktx2";
+	}
+
+	/*
+	* Modification time and size of the source, as stored in the cooked file.
+	* @param[in] sourcePath
+	* @param[out] stamp
+	* @return false if the source does not exist.
+	*/
+	inline bool sourceStamp(const std::string &sourcePath, std::string &stamp)
+	{
+		std::error_code error;
+		const uint64_t size = std::filesystem::file_size(sourcePath, error);
+		if (error)
+			return false;
+		const uint64_t mtime = static_cast<uint64_t>(std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count());
+		if (error)
+			return false;
+		stamp = std::to_string(mtime) + " " + std::to_string(size);
+		return true;
+	}
+
+	/*
+	* Pick a block format from what the channels actually hold.
+	* @param[in] pixels
+	* @param[in] width
+	* @param[in] height
+	* @param[in] components
+	* @param[in] options
+	* @param[out] swizzle KTXswizzle value for a gray image stored in one channel, empty otherwise.
+	* @return BlockFormat
+	*/
+	inline BlockFormat chooseFormat(const unsigned char *pixels, int width, int height, int components, const CookOptions &options, std::string &swizzle)
+	{
+		swizzle.clear();
+		// one and two channels keep the layout the uncompressed upload gives them, GL_RED and GL_RG
+		if (components == 1)
+			return BLOCK_BC4;
+		if (components == 2)
+			return BLOCK_BC5;
+
+		bool gray = true, opaque = true;
+		const size_t count = static_cast<size_t>(width) * height;
+		for (size_t i = 0; i < count && (gray || opaque); i++)
+		{
+			const unsigned char *texel = pixels + i * components;
+			gray = gray && texel[0] == texel[1] && texel[1] == texel[2];
+			opaque = opaque && (components == 3 || texel[3] == 255);
+		}
+		if (gray && opaque && !options.srgb)
+		{
+			swizzle = "rrr1";
+			return BLOCK_BC4;
+		}
+		if (options.highQuality)
+			return BLOCK_BC7;
+		return opaque ? BLOCK_BC1 : BLOCK_BC3;
+	}
+
+	/*
+	* Cook one image. Encodes on the worker pool, so do not call from a pool job.
+	* @param[in] sourcePath
+	* @param[in] options
+	* @return false if the source could not be read or the output not written.
+	*/
+	inline bool cook(const std::string &sourcePath, const CookOptions &options)
+	{
+		std::string stamp;
+		if (!sourceStamp(sourcePath, stamp))
+		{
+			std::cout << "ERROR::TEXTURE_COOK::SOURCE_NOT_FOUND: " << sourcePath << std::endl;
+			return false;
+		}
+		int width, height, components;
+		stbi_set_flip_vertically_on_load_thread(options.flipVertically);
+		std::unique_ptr<unsigned char, void(*)(void*)> pixels(stbi_load(sourcePath.c_str(), &width, &height, &components, 0), stbi_image_free);
+		if (!pixels)
+		{
+			std::cout << "ERROR::TEXTURE_COOK::DECODE_FAILED: " << sourcePath << std::endl;
+			return false;
+		}
+
+		std::string swizzle;
+		const BlockFormat format = chooseFormat(pixels.get(), width, height, components, options, swizzle);
+		std::vector<std::vector<unsigned char>> levels;
+		levels.push_back(BlockCompression::encodeImage(pixels.get(), width, height, components, format));
+		MipSettings mips;
+		mips.filter = options.filter;
+		mips.srgb = options.srgb || options.gammaCorrectMips;
+		mips.alphaCutoff = options.alphaCutoff;
+		mips.parallel = true;
+		for (const MipLevel &level : Mipmap::generate(pixels.get(), width, height, components, mips))
+		{
+			levels.push_back(BlockCompression::encodeImage(level.pixels.data(), level.width, level.height, components, format));
+		}
+
+		// text values carry their NUL
+		std::map<std::string, std::string> values;
+		values["KTXorientation"] = std::string(options.flipVertically ? "ru" : "rd") + '\0';
+		if (!swizzle.empty())
+			values["KTXswizzle"] = swizzle + '\0';
+		values[SOURCE_KEY] = stamp + '\0';
+		const std::string cookedPath = cookedPathFor(sourcePath);
+		if (!Ktx2::write(cookedPath, BlockCompression::vkFormat(format, options.srgb), width, height, levels, values))
+		{
+			return false;
+		}
+
+		size_t bytes = 0;
+		for (const std::vector<unsigned char> &level : levels)
+			bytes += level.size();
+		std::cout << "TEXTURE_COOK::" << cookedPath << " " << BlockCompression::name(format) << (options.srgb ? " SRGB " : " ")
+			<< width << "x" << height << " LEVELS " << levels.size() << " BYTES " << bytes << std::endl;
+		return true;
+	}
+
+	/*
+	* Open the cooked file of an image if it was cooked from the current source with the given orientation.
+	* @param[in] sourcePath
+	* @param[in] flipVertically
+	* @param[out] image
+	* @return false if there is no usable cooked file.
+	*/
+	inline bool openCooked(const std::string &sourcePath, bool flipVertically, Ktx2::Image &image)
+	{
+		std::string stamp;
+		const std::string cookedPath = cookedPathFor(sourcePath);
+		std::error_code error;
+		if (!std::filesystem::exists(cookedPath, error) || !sourceStamp(sourcePath, stamp) || !image.open(cookedPath))
+		{
+			return false;
+		}
+		if (image.value(SOURCE_KEY) != stamp || image.value("KTXorientation") != (flipVertically ? "ru" : "rd") ||
+			BlockCompression::glFormat(image.vkFormat) == 0)
+		{
+			image = Ktx2::Image();
+			return false;
+		}
+		return true;
+	}
+
+	/*
+	* Command line front end: cook every file argument with the options set by the flags before it.
+	* Flags: --srgb, --linear, --bc7, --fast (BC1/BC3), --flip, --no-flip, --box, --kaiser, --gamma-mips,
+	* --linear-mips, --cutout[=reference] (0.5 by default), --no-cutout.
+	* @param[in] argc
+	* @param[in] argv Arguments after the --cook switch.
+	* @return process exit code.
+	*/
+	inline int run(int argc, char *argv[])
+	{
+		CookOptions options;
+		int failures = 0, cooked = 0;
+		for (int i = 0; i < argc; i++)
+		{
+			const std::string argument = argv[i];
+			if (argument == "--srgb")
+				options.srgb = true;
+			else if (argument == "--linear")
+				options.srgb = false;
+			else if (argument == "--bc7")
+				options.highQuality = true;
+			else if (argument == "--fast")
+				options.highQuality = false;
+			else if (argument == "--flip")
+				options.flipVertically = true;
+			else if (argument == "--no-flip")
+				options.flipVertically = false;
+			else if (argument == "--box")
+				options.filter = MIP_BOX;
+			else if (argument == "--kaiser")
+				options.filter = MIP_KAISER;
+			else if (argument == "--gamma-mips")
+				options.gammaCorrectMips = true;
+			else if (argument == "--linear-mips")
+				options.gammaCorrectMips = false;
+			else if (argument == "--cutout")
+				options.alphaCutoff = 0.5f;
+			else if (argument.rfind("--cutout=", 0) == 0)
+				options.alphaCutoff = static_cast<float>(std::atof(argument.c_str() + 9));
+			else if (argument == "--no-cutout")
+				options.alphaCutoff = 0.0f;
+			else if (cook(argument, options))
+				cooked++;
+			else
+				failures++;
+		}
+		std::cout << "TEXTURE_COOK::COOKED " << cooked << " FAILED " << failures << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+}
+
+#endif
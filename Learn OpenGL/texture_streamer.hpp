@@ -0,0 +1,389 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "gpu_memory.hpp"
+#include "mipmap.hpp"
+#include "texture_cache.hpp"
+#include "thread_pool.hpp"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// Uploads textures through a ring of pixel unpack buffers instead of from client memory, spending at
+// most a fixed number of bytes per frame. Each frame writes into the next buffer of the ring, and a
+// buffer is only reused once the fence placed after its uploads has signalled; if it has not, the
+// frame uploads nothing rather than waiting. Mip chains are built on the worker pool, or come mapped with
+// texels from the TexelCache and are copied from the page cache into the buffers, and are uploaded
+// coarsest level first, lowering GL_TEXTURE_BASE_LEVEL as each finer level completes, so a texture is
+// drawable after its first frame and sharpens over the following ones.
+//
+// With ARB_buffer_storage the buffers are mapped once, persistently; otherwise each frame maps its
+// buffer unsynchronized, which the fences make safe.
+class TextureStreamer
+{
+public:
+	struct Stats
+	{
+		size_t bytesLastFrame;
+		size_t pending;			// textures waiting for their mip chain or for upload
+		size_t completed;
+		size_t stalledFrames;	// frames skipped because the GPU still read the next buffer
+		bool persistent;
+	};
+
+	/*
+	* Constructor for the streamer. Needs a current GL context.
+	* @param[in] bytesPerFrame Upload budget, also the size of each buffer in the ring.
+	* @param[in] bufferCount Buffers in the ring, at least the number of frames the GPU may lag behind.
+	* @return TextureStreamer
+	*/
+	explicit TextureStreamer(size_t bytesPerFrame = 4 << 20, unsigned int bufferCount = 3)
+		: bytesPerFrame(bytesPerFrame), ring(bufferCount)
+	{
+		typedef void (APIENTRY *BufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+		BufferStorageProc bufferStorage = nullptr;
+		if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+		{
+			bufferStorage = reinterpret_cast<BufferStorageProc>(glfwGetProcAddress("glBufferStorage"));
+		}
+		persistent = bufferStorage != nullptr;
+
+		for (Buffer &buffer : ring)
+		{
+			glGenBuffers(1, &buffer.id);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+			if (persistent)
+			{
+				const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				bufferStorage(GL_PIXEL_UNPACK_BUFFER, bytesPerFrame, nullptr, flags);
+				buffer.mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytesPerFrame, flags));
+			}
+			else
+			{
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, bytesPerFrame, nullptr, GL_STREAM_DRAW);
+			}
+			GpuMemory::shared().trackBuffer(buffer.id, GPU_STAGING_BUFFERS, bytesPerFrame, "TextureStreamer");
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// The buffers are left to the context, which is gone by the time the streamer goes out of scope, but
+	// mip chains still being built read from the jobs and must finish first.
+	~TextureStreamer()
+	{
+		for (const std::unique_ptr<Job> &job : jobs)
+		{
+			if (!job->chainReady)
+			{
+				job->chain.wait();
+			}
+		}
+	}
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	/*
+	* Create a texture for a decoded image and queue its pixels. Every level is allocated right away so the
+	* name can be handed out; the contents arrive over the next frames.
+	* @param[in] image Decoded base level or cached texels, owned by the streamer from now on.
+	* @return GL name of the texture.
+	*/
+	unsigned int enqueue(DecodedImage &&image)
+	{
+		std::unique_ptr<Job> job(new Job());
+		job->format = GL_RGBA;
+		if (image.components == 1)
+			job->format = GL_RED;
+		else if (image.components == 2)
+			job->format = GL_RG;
+		else if (image.components == 3)
+			job->format = GL_RGB;
+		job->components = image.components;
+		const int levels = Mipmap::levelCount(image.width, image.height);
+
+		glGenTextures(1, &job->id);
+		glBindTexture(GL_TEXTURE_2D, job->id);
+		int width = image.width, height = image.height;
+		for (int level = 0; level < levels; level++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, level, job->format, width, height, 0, job->format, GL_UNSIGNED_BYTE, nullptr);
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		GpuMemory::shared().trackTexture(job->id, job->format, image.width, image.height, 1, levels, "TextureStreamer");
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		job->level = levels - 1;
+		job->base = std::move(image);
+		const unsigned int id = job->id;
+		if (!job->base.texels.levels.empty())
+		{
+			job->chainReady = true;
+			jobs.push_back(std::move(job));
+			return id;
+		}
+		Job *building = job.get();
+		job->chain = ThreadPool::shared().submit([building]
+		{
+			const DecodedImage &base = building->base;
+			return Mipmap::buildChain(base.pixels.get(), base.width, base.height, base.components);
+		});
+		jobs.push_back(std::move(job));
+		return id;
+	}
+
+	/*
+	* Upload up to the frame budget. Call once per frame on the GL thread.
+	* @return void
+	*/
+	void update()
+	{
+		lastFrameBytes = 0;
+		if (jobs.empty())
+		{
+			return;
+		}
+		Buffer &buffer = ring[current];
+		if (buffer.fence)
+		{
+			if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				stalledFrames++;
+				return;
+			}
+			glDeleteSync(buffer.fence);
+			buffer.fence = nullptr;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+		unsigned char *mapped = buffer.mapped;
+		if (!persistent)
+		{
+			mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytesPerFrame,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		// stage rows into the buffer and record the copies; they are issued after the unmap
+		size_t offset = 0;
+		std::vector<Copy> copies;
+		for (auto it = jobs.begin(); it != jobs.end() && offset < bytesPerFrame; )
+		{
+			Job &job = **it;
+			if (!takeChain(job))
+			{
+				++it;
+				continue;
+			}
+			stage(job, mapped, offset, copies);
+			if (job.level < 0)
+			{
+				completed++;
+				it = jobs.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		if (!persistent)
+		{
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		for (const Copy &copy : copies)
+		{
+			glBindTexture(GL_TEXTURE_2D, copy.id);
+			glTexSubImage2D(GL_TEXTURE_2D, copy.level, copy.x, copy.y, copy.width, copy.rows, copy.format, GL_UNSIGNED_BYTE, (void*)copy.offset);
+			if (copy.lastRows)
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, copy.level);
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		if (offset > 0)
+		{
+			buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			current = (current + 1) % ring.size();
+		}
+		lastFrameBytes = offset;
+	}
+
+	Stats stats() const
+	{
+		return { lastFrameBytes, jobs.size(), completed, stalledFrames, persistent };
+	}
+
+	// True while levels of the texture are still to be uploaded, so its storage keeps changing.
+	bool streaming(unsigned int id) const
+	{
+		return std::any_of(jobs.begin(), jobs.end(), [id](const std::unique_ptr<Job> &job)
+		{
+			return job->id == id;
+		});
+	}
+
+private:
+	struct Buffer
+	{
+		unsigned int id = 0;
+		unsigned char *mapped = nullptr;
+		GLsync fence = nullptr;
+	};
+
+	struct Job
+	{
+		unsigned int id = 0;
+		GLenum format = GL_RGBA;
+		int components = 4;
+		DecodedImage base;
+		std::future<std::vector<MipLevel>> chain;
+		std::vector<MipLevel> levels;	// 1 .. count - 1
+		bool chainReady = false;
+		int level = 0;					// next level to upload, counting down to 0; -1 when done
+		int row = 0;					// next row of that level
+		int column = 0;					// next pixel of that row, for rows larger than a buffer
+	};
+
+	struct Copy
+	{
+		unsigned int id;
+		int level;
+		int x;
+		int y;
+		int width;
+		int rows;
+		GLenum format;
+		size_t offset;
+		bool lastRows;
+	};
+
+	size_t bytesPerFrame;
+	std::vector<Buffer> ring;
+	unsigned int current = 0;
+	bool persistent = false;
+	std::deque<std::unique_ptr<Job>> jobs;
+	size_t lastFrameBytes = 0;
+	size_t completed = 0;
+	size_t stalledFrames = 0;
+
+	// move a finished mip chain into the job, false while it is still being built. Jobs are only
+	// dropped after this succeeded, so the worker never outlives the base image it reads.
+	static bool takeChain(Job &job)
+	{
+		if (job.chainReady)
+		{
+			return true;
+		}
+		if (job.chain.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return false;
+		}
+		job.levels = job.chain.get();
+		job.chainReady = true;
+		return true;
+	}
+
+	// copy as many rows of the job's next levels as fit into the buffer
+	void stage(Job &job, unsigned char *mapped, size_t &offset, std::vector<Copy> &copies)
+	{
+		while (job.level >= 0 && offset < bytesPerFrame)
+		{
+			int width, height;
+			const unsigned char *pixels;
+			if (!job.base.texels.levels.empty())
+			{
+				const Ktx2::Level &mapped = job.base.texels.levels[job.level];
+				width = mapped.width;
+				height = mapped.height;
+				pixels = mapped.data;
+			}
+			else if (job.level == 0)
+			{
+				width = job.base.width;
+				height = job.base.height;
+				pixels = job.base.pixels.get();
+			}
+			else
+			{
+				width = job.levels[job.level - 1].width;
+				height = job.levels[job.level - 1].height;
+				pixels = job.levels[job.level - 1].pixels.data();
+			}
+			const size_t rowBytes = static_cast<size_t>(width) * job.components;
+
+			int rows = static_cast<int>(std::min<size_t>((bytesPerFrame - offset) / rowBytes, height - job.row));
+			if (rows == 0 || job.column > 0)
+			{
+				if (offset > 0)
+				{
+					return;
+				}
+				// a row larger than the whole buffer goes over several frames, as much of it as fits each time
+				const int count = static_cast<int>(std::min<size_t>(bytesPerFrame / job.components, width - job.column));
+				const size_t runBytes = static_cast<size_t>(count) * job.components;
+				std::memcpy(mapped, pixels + job.row * rowBytes + static_cast<size_t>(job.column) * job.components, runBytes);
+				job.column += count;
+				const bool rowDone = job.column == width;
+				copies.push_back({ job.id, job.level, job.column - count, job.row, count, 1, job.format, 0, rowDone && job.row + 1 == height });
+				offset = runBytes;
+				if (!rowDone)
+				{
+					return;
+				}
+				job.column = 0;
+				rows = 1;
+			}
+			else
+			{
+				std::memcpy(mapped + offset, pixels + job.row * rowBytes, rows * rowBytes);
+				copies.push_back({ job.id, job.level, 0, job.row, width, rows, job.format, offset, job.row + rows == height });
+				offset += rows * rowBytes;
+			}
+
+			job.row += rows;
+			if (job.row == height)
+			{
+				if (!copies.empty() && copies.back().id == job.id && copies.back().level == job.level)
+				{
+					copies.back().lastRows = true;
+				}
+				else
+				{
+					glBindTexture(GL_TEXTURE_2D, job.id);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level);
+				}
+				job.row = 0;
+				job.level--;
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+// Fixed set of worker threads pulling jobs off a FIFO queue. Jobs must not touch the GL context, which
+// only the thread that created it may use.
+class ThreadPool
+{
+public:
+	/*
+	* Constructor for the thread pool
+	* @param[in] threadCount Number of workers. 0 picks one per hardware thread, leaving one for the GL thread.
+	* @return ThreadPool
+	*/
+	explicit ThreadPool(unsigned int threadCount = 0)
+	{
+		if (threadCount == 0)
+		{
+			const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+			threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+		for (unsigned int i = 0; i < threadCount; i++)
+		{
+			workers.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	/*
+	* Queue a job.
+	* @param[in] job Callable taking no arguments.
+	* @return future holding the job's result.
+	*/
+	template <class F>
+	auto submit(F&& job) -> std::future<typename std::invoke_result<F>::type>
+	{
+		using Result = typename std::invoke_result<F>::type;
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push([task] { (*task)(); });
+		}
+		wake.notify_one();
+		return result;
+	}
+
+	size_t size() const
+	{
+		return workers.size();
+	}
+
+	// Process-wide pool shared by the asset loaders.
+	static ThreadPool& shared()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+		}
+	}
+};
+
+#endif